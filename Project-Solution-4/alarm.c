@@ -1,5 +1,32 @@
 /*
  * alarm.c - implements the alarm library
+ *
+ * alarms are kept in a hierarchical timing wheel. time is counted in
+ * ticks of WHEEL_TICK_NS, and there are WHEEL_LEVELS wheels of
+ * WHEEL_SLOTS slots: a slot of level 0 holds the alarms due at one
+ * tick, and a slot of level n those due in a span of WHEEL_SLOTS^n
+ * ticks. an alarm goes in the lowest level whose span reaches it,
+ * and as time passes the slots of the higher levels are emptied into
+ * the lower ones. registering, deregistering and expiring an alarm
+ * are constant time, however many are registered.
+ *
+ * an alarm with slack may be fired up to that many milliseconds late,
+ * and is put at the tick in that window with the most trailing zero
+ * bits, so alarms due at about the same time share a tick, and wake
+ * the system once.
+ *
+ * callbacks are run by a pool of callback threads, which take the
+ * alarms due in turn, so a slow callback delays only the alarms
+ * behind it on its own thread. each callback is timed, and those
+ * which take longer than ALARM_CALLBACK_BUDGET_NS are reported. a
+ * direct alarm is instead fired by whichever thread finds it due, so
+ * it fires even while every callback thread is blocked.
+ *
+ * entries are allocated a slab at a time, and never freed until the
+ * system shuts down, only kept for reuse. an alarm's id is the index
+ * of its entry with the entry's generation, which changes each time
+ * the entry is reused, so deregistering an alarm which has already
+ * fired, even if its entry is now another alarm's, does nothing.
  */
 
 
@@ -10,50 +37,454 @@
 
 #include "interrupts.h"
 
+#include "machineprimitives_ext.h"
+
 #include "alarm_private.h"
 
 #include "minithread_private.h"
 
-#include "priority_queue.h"
+#include "queue.h"
+
+#include "trace.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#pragma intrinsic(_BitScanForward)
+#endif
+
+
+/* the length of a tick - alarms are due to the millisecond */
+#define WHEEL_TICK_NS (1000000)
+
+/* 4 levels of 256 slots cover 2^32 ticks, more than any delay */
+#define WHEEL_BITS (8)
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS (4)
+
+/* the number of threads which run alarm callbacks */
+#define ALARM_CALLBACK_THREADS (2)
+
+/* how long (nanoseconds) a callback may run before it is reported */
+#define ALARM_CALLBACK_BUDGET_NS (1000000)
+
+/* the number of entries allocated at once */
+#define ALARM_SLAB_SHIFT (8)
+#define ALARM_SLAB_ENTRIES (1 << ALARM_SLAB_SHIFT)
+
+/* the number of slabs there is first room for - it doubles when full */
+#define ALARM_SLABS_INITIAL (4)
+
+/* the words of the bitmap of a level's occupied slots */
+#define WHEEL_WORD_BITS (32)
+#define WHEEL_WORDS (WHEEL_SLOTS / WHEEL_WORD_BITS)
 
 
 struct alarm_entry {
 	alarm_callback func;
 	arg_t arg;
-	long time;
+	__int64 time;  // when it is due, from currentTimeNanos
+	__int64 expire;  // the tick it is due at - time rounded up, then within its slack
+	int interval;  // milliseconds between firings, or 0 if it fires once
+	int slack;  // milliseconds it may be fired late
+	int direct;  // fired by whichever thread finds it due, not a callback thread
+	unsigned int index;  // in the slabs
+	unsigned int generation;  // changed each time it is reused
+	queue_link_t link;  // on a slot, the ready queue or the spare queue
 };
 typedef struct alarm_entry *alarm_entry_t;
 
 struct alarm {
-	priority_queue_t registered;
+	iqueue_t slots[WHEEL_LEVELS * WHEEL_SLOTS];
+	unsigned int occupied[WHEEL_LEVELS][WHEEL_WORDS];
+	__int64 wheel_time;  // the last tick the wheel was advanced to
+	int count;  // the number of alarms in the slots
+	iqueue_t ready;  // alarms which are due, in order
+	iqueue_t spare;  // entries kept for reuse
+	alarm_entry_t *slabs;
+	int slab_count;
+	int slab_room;
+	minithread_t waiting[ALARM_CALLBACK_THREADS];  // callback threads with no alarm to fire
+	int waiting_count;
+	int running;  // callbacks taken and not yet returned
+	int overruns;  // callbacks which took longer than the budget
+	__int64 longest;  // the longest a callback has taken
 };
 
 
+/*
+ * HELPER FUNCTIONS
+ */
+
+/* index of the lowest set bit of a non-zero word */
+static int alarm_first_set(unsigned int bits) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return (int) index;
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+/* the first occupied slot of a level at or after index, or -1 */
+static int alarm_wheel_first(alarm_t me, int level, int index) {
+	int word = index / WHEEL_WORD_BITS;
+	unsigned int bits;
+
+	if ( index >= WHEEL_SLOTS ) {
+		return -1;
+	}
+	bits = me->occupied[level][word] & (~0u << (index % WHEEL_WORD_BITS));
+	while ( !bits ) {
+		if ( ++word == WHEEL_WORDS ) {
+			return -1;
+		}
+		bits = me->occupied[level][word];
+	}
+	return word * WHEEL_WORD_BITS + alarm_first_set(bits);
+}
+
+/* put an alarm in the slot its expiry falls in, or on the
+   ready queue if it is already due */
+static void alarm_wheel_insert(alarm_t me, alarm_entry_t al) {
+	__int64 delta = al->expire - me->wheel_time;
+	int level = 0;
+	int index;
+
+	if ( delta <= 0 ) {
+		iqueue_append(&(me->ready), &(al->link));
+		return;
+	}
+	while ( level < WHEEL_LEVELS - 1 && delta >= ((__int64)1 << (WHEEL_BITS * (level + 1))) ) {
+		level++;
+	}
+	index = (int)((al->expire >> (WHEEL_BITS * level)) & WHEEL_MASK);
+	iqueue_append(&(me->slots[level * WHEEL_SLOTS + index]), &(al->link));
+	me->occupied[level][index / WHEEL_WORD_BITS] |= 1u << (index % WHEEL_WORD_BITS);
+	me->count++;
+}
+
+/* take an alarm out of its slot */
+static void alarm_wheel_remove(alarm_t me, alarm_entry_t al) {
+	iqueue_t *slot = al->link.queue;
+	int position = (int)(slot - me->slots);
+	int index = position & WHEEL_MASK;
+
+	iqueue_delete(slot, &(al->link));
+	me->count--;
+	if ( !iqueue_length(slot) ) {
+		me->occupied[position >> WHEEL_BITS][index / WHEEL_WORD_BITS] &= ~(1u << (index % WHEEL_WORD_BITS));
+	}
+}
+
+/* empty a slot, passing each alarm in it to insert again */
+static void alarm_wheel_redistribute(alarm_t me, int level, int index) {
+	iqueue_t *slot = &(me->slots[level * WHEEL_SLOTS + index]);
+	queue_link_t *link;
+
+	while ( iqueue_length(slot) ) {
+		link = slot->first;
+		alarm_wheel_remove(me, queue_item(link, struct alarm_entry, link));
+		alarm_wheel_insert(me, queue_item(link, struct alarm_entry, link));
+	}
+}
+
+/* move the wheel on to tick now, making the alarms due by then ready */
+static void alarm_wheel_advance(alarm_t me, __int64 now) {
+	__int64 tick;
+	int level;
+	int index;
+
+	while ( me->wheel_time < now ) {
+		if ( !me->count ) {
+			me->wheel_time = now;
+			break;
+		}
+
+		// skip to the next occupied slot of level 0, or the end of
+		// its turn, when the next slot of level 1 is due to be emptied
+		index = alarm_wheel_first(me, 0, (int)(me->wheel_time & WHEEL_MASK) + 1);
+		if ( index == -1 ) {
+			tick = (me->wheel_time | WHEEL_MASK) + 1;
+		} else {
+			tick = (me->wheel_time & ~(__int64)WHEEL_MASK) + index;
+		}
+		if ( tick > now ) {
+			me->wheel_time = now;
+			break;
+		}
+		me->wheel_time = tick;
+
+		// at the end of a level's turn, empty the next slot of the level above
+		for ( level = 1; level < WHEEL_LEVELS && !((tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK); level++ ) {
+			alarm_wheel_redistribute(me, level, (int)((tick >> (WHEEL_BITS * level)) & WHEEL_MASK));
+		}
+		alarm_wheel_redistribute(me, 0, (int)(tick & WHEEL_MASK));
+	}
+}
+
+/* allocate another slab of entries, all of them spare */
+static int alarm_slab_grow(alarm_t me) {
+	alarm_entry_t slab;
+	alarm_entry_t *slabs;
+	int i;
+
+	if ( me->slab_count == me->slab_room ) {
+		slabs = realloc(me->slabs, 2 * me->slab_room * sizeof(alarm_entry_t));
+		if ( !slabs ) {
+			return -1;
+		}
+		me->slabs = slabs;
+		me->slab_room *= 2;
+	}
+	slab = malloc(ALARM_SLAB_ENTRIES * sizeof(struct alarm_entry));
+	if ( !slab ) {
+		return -1;
+	}
+	for ( i = 0; i < ALARM_SLAB_ENTRIES; i++ ) {
+		slab[i].index = (me->slab_count << ALARM_SLAB_SHIFT) + i;
+		slab[i].generation = 1;
+		iqueue_link_init(&(slab[i].link));
+		iqueue_append(&(me->spare), &(slab[i].link));
+	}
+	me->slabs[me->slab_count++] = slab;
+	return 0;
+}
+
+/* a spare entry */
+static alarm_entry_t alarm_entry_get(alarm_t me) {
+	queue_link_t *link;
+	if ( !iqueue_length(&(me->spare)) && alarm_slab_grow(me) != 0 ) {
+		return NULL;
+	}
+	iqueue_dequeue(&(me->spare), &link);
+	return queue_item(link, struct alarm_entry, link);
+}
+
+/* keep an entry for reuse, so that its id no longer refers to it */
+static void alarm_entry_put(alarm_t me, alarm_entry_t al) {
+	if ( ++al->generation == 0 ) {
+		// the id of entry 0 with generation 0 would be ALARM_ID_NONE
+		al->generation = 1;
+	}
+	iqueue_append(&(me->spare), &(al->link));
+}
+
+/* the entry an id refers to, or NULL if it no longer does */
+static alarm_entry_t alarm_entry_find(alarm_t me, alarm_id_t id) {
+	unsigned int index = (unsigned int)(id & 0xffffffff);
+	unsigned int generation = (unsigned int)(id >> 32);
+	alarm_entry_t al;
+
+	if ( (index >> ALARM_SLAB_SHIFT) >= (unsigned int)me->slab_count ) {
+		return NULL;
+	}
+	al = &(me->slabs[index >> ALARM_SLAB_SHIFT][index & (ALARM_SLAB_ENTRIES - 1)]);
+	if ( al->generation != generation ) {
+		return NULL;
+	}
+	return al;
+}
+
+/* set when an alarm is due, and the tick it expires at */
+static void alarm_entry_schedule(alarm_entry_t al, __int64 time) {
+	__int64 latest;
+	__int64 differ;
+
+	al->time = time;
+	al->expire = (time + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+	if ( al->slack > 0 ) {
+		// keep the bits above the highest which differs between the
+		// first and last tick of the window, and clear the rest
+		latest = al->expire + (__int64)al->slack * 1000000 / WHEEL_TICK_NS;
+		differ = al->expire ^ latest;
+		while ( differ & (differ - 1) ) {
+			differ &= differ - 1;
+		}
+		al->expire = latest & ~(differ - 1);
+	}
+}
+
+/* register an alarm, due in delay milliseconds, and then every
+   interval milliseconds if that is not 0 */
+static int alarm_register_entry(int delay, int interval, int slack, int direct, alarm_callback func, arg_t arg, alarm_id_t *id_p) {
+	alarm_t me = minithread_alarm_system();
+	alarm_entry_t al;
+	__int64 now;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	al = alarm_entry_get(me);
+	if ( !al ) {
+		set_interrupt_level(old_int);
+		return -1;
+	}
+	al->func = func;
+	al->arg = arg;
+	al->interval = interval;
+	al->slack = slack > 0 ? slack : 0;
+	al->direct = direct;
+	now = currentTimeNanos();
+	alarm_entry_schedule(al, now + (__int64)delay * 1000000);
+	// the wheel is only moved on when alarms are taken, so may be behind -
+	// an alarm put in a slot against the old time can be in the slots of
+	// the next turn while the wheel still shows the last
+	alarm_wheel_advance(me, now / WHEEL_TICK_NS);
+	alarm_wheel_insert(me, al);
+	dbgprintf("ALARM: reg %d\n", me->count);
+	minithread_clock_program();
+	// the idle thread may be waiting for a later alarm
+	minithread_wake_idle_by(al->expire * WHEEL_TICK_NS);
+	set_interrupt_level(old_int);
+	if (id_p) {
+		*id_p = ((alarm_id_t)al->generation << 32) | al->index;
+	}
+	return 0;
+}
+
+/* move the wheel on to now, and fire the direct alarms now due, so
+   that they never wait for a callback thread */
+static void alarm_advance(alarm_t me) {
+	queue_link_t *link;
+	queue_link_t *next;
+	alarm_entry_t al;
+	alarm_callback func;
+	arg_t arg;
+
+	alarm_wheel_advance(me, currentTimeNanos() / WHEEL_TICK_NS);
+	for ( link = me->ready.first; link; link = next ) {
+		next = link->next;
+		al = queue_item(link, struct alarm_entry, link);
+		if ( al->direct ) {
+			func = al->func;
+			arg = al->arg;
+			iqueue_delete(&(me->ready), link);
+			alarm_entry_put(me, al);
+			(*func)(arg);
+			// the callback may have changed the ready list
+			next = me->ready.first;
+		}
+	}
+}
+
+/* take the next alarm due, and return its callback and argument - a
+   periodic alarm is put back in the wheel, and another kept for reuse */
+static int alarm_take_ready(alarm_t me, alarm_callback *func_p, arg_t *arg_p) {
+	queue_link_t *link;
+	alarm_entry_t next;
+
+	alarm_advance(me);
+	if ( iqueue_dequeue(&(me->ready), &link) != 0 ) {
+		return -1;
+	}
+	next = queue_item(link, struct alarm_entry, link);
+	*func_p = next->func;
+	*arg_p = next->arg;
+	if ( next->interval ) {
+		// due again an interval after it was due, skipping any missed
+		__int64 interval = (__int64)next->interval * 1000000;
+		__int64 missed = ((__int64)currentTimeNanos() - next->time) / interval;
+		alarm_entry_schedule(next, next->time + (missed + 1) * interval);
+		alarm_wheel_insert(me, next);
+	} else {
+		alarm_entry_put(me, next);
+	}
+	dbgprintf("ALARM: fire %d\n", me->count);
+	return 0;
+}
+
+/* body of a callback thread - fire alarms as they are due */
+static int alarm_callback_thread(arg_t arg) {
+	alarm_t me = (alarm_t)arg;
+	alarm_callback func;
+	arg_t func_arg;
+	__int64 start;
+	__int64 elapsed;
+	interrupt_level_t old_int;
+
+	for ( ;; ) {
+		old_int = set_interrupt_level(DISABLED);
+		while ( alarm_take_ready(me, &func, &func_arg) != 0 ) {
+			// wait for alarm_dispatch to start us. the idle thread does
+			// not wait for alarms which are due while every callback
+			// thread is busy, so tell it one is free
+			me->waiting[me->waiting_count++] = minithread_self();
+			minithread_wake_idle();
+			minithread_stop();
+			set_interrupt_level(DISABLED);
+		}
+		me->running++;
+		set_interrupt_level(old_int);
+
+		TRACE_EVENT(TRACE_ALARM_FIRE, minithread_id(), func);
+		start = currentTimeNanos();
+		(*func)(func_arg);
+		elapsed = currentTimeNanos() - start;
+
+		old_int = set_interrupt_level(DISABLED);
+		me->running--;
+		if ( elapsed > ALARM_CALLBACK_BUDGET_NS ) {
+			me->overruns++;
+			if ( elapsed > me->longest ) {
+				me->longest = elapsed;
+			}
+			TRACE_EVENT(TRACE_ALARM_OVERRUN, minithread_id(), elapsed / 1000);
+		}
+		set_interrupt_level(old_int);
+	}
+	return 0;
+}
+
+
 /* 
  * register an alarm to go off in delay milliseconds. the library
  * will fire the alarm after at least delay milliseconds have
  * passed by calling func with the single argument arg. the alarm may
- * be fired arbitrarily later than delay milliseconds, but alarms will
- * be fired in order (absolute time registered + registered delay should
- * never be lower for a subsequent alarm than for the previous alarm).
+ * be fired arbitrarily later than delay milliseconds. alarms are
+ * handed out in order of the time they are due, but callbacks are run
+ * by a pool of callback threads, so they may run concurrently and out
+ * of order - a callback due later may start, or finish, before one due
+ * earlier. callbacks which must not overlap have to lock for themselves.
  * if requested, return out an alarm id which uniquely identifies this
  * alarm. This id can be used to later deregister the alarm.
  * on success, return 0. on failure, return -1.
  */
 int alarm_register(int delay, alarm_callback func, arg_t arg, alarm_id_t *id_p) {
-	alarm_t me = minithread_alarm_system();
-	alarm_entry_t al = malloc(sizeof(struct alarm_entry));
-	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	al->time = ticks + ((delay * MILLISECOND) / PERIOD);
-	al->func = func;
-	al->arg = arg;
-	priority_queue_enqueue(me->registered, al->time, al);
-	dbgprintf("ALARM: reg %d\n", priority_queue_length(me->registered));
-	set_interrupt_level(old_int);
-	if (id_p) {
-		*id_p = al;
+	return alarm_register_entry(delay, 0, 0, 0, func, arg, id_p);
+}
+
+
+/* 
+ * register an alarm as alarm_register does, but which may be fired
+ * up to slack milliseconds late, so that it can be fired together
+ * with others due about the same time.
+ * on success, return 0. on failure, return -1.
+ */
+int alarm_register_slack(int delay, int slack, alarm_callback func, arg_t arg, alarm_id_t *id_p) {
+	return alarm_register_entry(delay, 0, slack, 0, func, arg, id_p);
+}
+
+
+/* 
+ * register an alarm to go off every interval milliseconds, each
+ * time up to slack milliseconds late, until it is deregistered.
+ * on success, return 0. on failure, return -1.
+ */
+int alarm_register_periodic(int interval, int slack, alarm_callback func, arg_t arg, alarm_id_t *id_p) {
+	if ( interval <= 0 ) {
+		return -1;
 	}
-	return 0;
+	return alarm_register_entry(interval, interval, slack, 0, func, arg, id_p);
+}
+
+
+/* 
+ * register an alarm as alarm_register does, to be fired by the thread
+ * which finds it due - a callback thread, or the idle thread or an
+ * interrupt handler in alarm_dispatch - with interrupts disabled.
+ * on success, return 0. on failure, return -1.
+ */
+int alarm_register_direct(int delay, alarm_callback func, arg_t arg, alarm_id_t *id_p) {
+	return alarm_register_entry(delay, 0, 0, 1, func, arg, id_p);
 }
 
 
@@ -63,16 +494,27 @@ int alarm_register(int delay, alarm_callback func, arg_t arg, alarm_id_t *id_p)
  */
 int alarm_deregister(alarm_id_t id) {
 	alarm_t me = minithread_alarm_system();
+	alarm_entry_t al;
 	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	if ( priority_queue_delete(me->registered, id) == 0 ) {
-		dbgprintf("ALARM: dereg %d\n", priority_queue_length(me->registered));
+	al = alarm_entry_find(me, id);
+	if ( !al ) {
+		// already fired or deregistered, and perhaps reused since
 		set_interrupt_level(old_int);
-		free(id);
-		return 0;
+		return -1;
+	}
+	if ( al->link.queue == &(me->ready) ) {
+		iqueue_delete(&(me->ready), &(al->link));
+	} else if ( al->link.queue >= me->slots && al->link.queue < me->slots + WHEEL_LEVELS * WHEEL_SLOTS ) {
+		alarm_wheel_remove(me, al);
 	} else {
+		// not in the wheel, which a registered alarm always is
 		set_interrupt_level(old_int);
 		return -1;
 	}
+	alarm_entry_put(me, al);
+	dbgprintf("ALARM: dereg %d\n", me->count);
+	set_interrupt_level(old_int);
+	return 0;
 }
 
 
@@ -82,19 +524,49 @@ int alarm_deregister(alarm_id_t id) {
  */
 alarm_t alarm_system_initialize(void) {
 	alarm_t obj = malloc(sizeof(struct alarm));
+	int i;
 	dbgprintf("Initializing alarm system...\n");
-	obj->registered = priority_queue_new(0);
+	if ( !obj ) {
+		return NULL;
+	}
+	for ( i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++ ) {
+		iqueue_init(&(obj->slots[i]));
+	}
+	memset(obj->occupied, 0, sizeof(obj->occupied));
+	obj->wheel_time = currentTimeNanos() / WHEEL_TICK_NS;
+	obj->count = 0;
+	iqueue_init(&(obj->ready));
+	iqueue_init(&(obj->spare));
+	obj->slabs = malloc(ALARM_SLABS_INITIAL * sizeof(alarm_entry_t));
+	obj->slab_count = 0;
+	obj->slab_room = ALARM_SLABS_INITIAL;
+	if ( !obj->slabs ) {
+		free(obj);
+		return NULL;
+	}
+	obj->waiting_count = 0;
+	obj->running = 0;
+	obj->overruns = 0;
+	obj->longest = 0;
+
+	// each callback thread stops itself until there is an alarm to fire
+	for ( i = 0; i < ALARM_CALLBACK_THREADS; i++ ) {
+		minithread_t thread = minithread_create_system(alarm_callback_thread, (arg_t)obj);
+		if ( thread ) {
+			minithread_start(thread);
+		}
+	}
 	return obj;
 }
 
 
 /* 
- * return true (1) if there are registered alarms,
- * or return false (0) if there are none registered
+ * return true (1) if there are registered alarms, or callbacks
+ * still running, or return false (0) if there are none
  */
 int alarm_has_remaining(void) {
 	alarm_t me = minithread_alarm_system();
-	if ( priority_queue_length(me->registered) ) {
+	if ( me->count || iqueue_length(&(me->ready)) || me->running ) {
 		return 1;
 	}
 	return 0;
@@ -108,36 +580,99 @@ int alarm_has_remaining(void) {
  */
 int alarm_has_ready(void) {
 	alarm_t me = minithread_alarm_system();
+	int ready;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	alarm_advance(me);
+	ready = iqueue_length(&(me->ready)) > 0;
+	set_interrupt_level(old_int);
+	return ready;
+}
+
+
+/* 
+ * return true (1) if a callback thread is waiting for an alarm
+ * to fire, or return false (0) if they are all busy
+ */
+int alarm_has_waiting(void) {
+	return minithread_alarm_system()->waiting_count > 0;
+}
+
+
+/* 
+ * return the number of callbacks which have run for longer than
+ * their budget, and the longest any callback has taken in
+ * nanoseconds in longest_p, if it is not NULL
+ */
+int alarm_overruns(__int64 *longest_p) {
+	alarm_t me = minithread_alarm_system();
+	int overruns;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	overruns = me->overruns;
+	if ( longest_p ) {
+		*longest_p = me->longest;
+	}
+	set_interrupt_level(old_int);
+	return overruns;
+}
+
+
+/* 
+ * return the time (from currentTimeNanos) at which the next
+ * alarm will be ready, or -1 if there are none registered.
+ * the time may be early when the next alarm is in a slot
+ * of a higher level, which is the time that slot is emptied
+ */
+__int64 alarm_next_deadline(void) {
+	alarm_t me = minithread_alarm_system();
+	__int64 time = -1;
+	__int64 turn;
+	int level;
+	int index;
+	int current;
 	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	if ( alarm_has_remaining() ) {
-		alarm_entry_t next;
-		priority_queue_peak(me->registered, &next);
-		if ( next->time <= ticks ) {
-			set_interrupt_level(old_int);
-			return 1;
+
+	if ( iqueue_length(&(me->ready)) ) {
+		time = queue_item(me->ready.first, struct alarm_entry, link)->time;
+	} else if ( me->count ) {
+		// the alarms of a level are all due before the next turn of
+		// the level above, so the first level with any holds the next
+		for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+			turn = (__int64)1 << (WHEEL_BITS * (level + 1));
+			current = (int)((me->wheel_time >> (WHEEL_BITS * level)) & WHEEL_MASK);
+			index = alarm_wheel_first(me, level, current + 1);
+			if ( index != -1 ) {
+				time = ((me->wheel_time & ~(turn - 1)) + ((__int64)index << (WHEEL_BITS * level))) * WHEEL_TICK_NS;
+				break;
+			}
+			if ( alarm_wheel_first(me, level, 0) != -1 ) {
+				// only slots of the level's next turn are occupied
+				time = ((me->wheel_time & ~(turn - 1)) + turn) * WHEEL_TICK_NS;
+				break;
+			}
 		}
 	}
 	set_interrupt_level(old_int);
-	return 0;
+	return time;
 }
 
 
 /* 
- * fire the next ready alarm
+ * hand the alarms which are due to the alarm callback threads,
+ * and return the number of those started
  */
-int alarm_fire_next(void) {
+int alarm_dispatch(void) {
 	alarm_t me = minithread_alarm_system();
+	int started = 0;
 	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	if ( alarm_has_ready() ) {
-		alarm_entry_t next;
-		priority_queue_dequeue(me->registered, &next);
-		dbgprintf("ALARM: fire %d\n", priority_queue_length(me->registered));
-		set_interrupt_level(ENABLED);
-		(*(next->func))(next->arg);
-		free(next);
+	if ( me ) {
+		alarm_advance(me);
+		while ( started < iqueue_length(&(me->ready)) && me->waiting_count > 0 ) {
+			minithread_start(me->waiting[--me->waiting_count]);
+			started++;
+		}
 	}
 	set_interrupt_level(old_int);
-	return 0;
+	return started;
 }
 
 
@@ -146,7 +681,16 @@ int alarm_fire_next(void) {
  * on success, return 0. on failure, return -1.
  */
 int alarm_system_cleanup(alarm_t alarm_system) {
-	priority_queue_free(alarm_system->registered);
+	int i;
+	for ( i = 0; i < alarm_system->slab_count; i++ ) {
+		free(alarm_system->slabs[i]);
+	}
+	free(alarm_system->slabs);
+	if ( alarm_system->overruns ) {
+		kprintf("ALARM: %d callbacks over their budget of %d us, the longest taking %d us\n",
+			alarm_system->overruns, ALARM_CALLBACK_BUDGET_NS / 1000, (int)(alarm_system->longest / 1000));
+	}
+	// the callback threads are freed with the thread system
 	free(alarm_system);
 	dbgprintf("...alarm system cleaned up.\n");
 	return 0;
@@ -16,8 +16,13 @@ typedef int *arg_t;
 /* alarm callback function pointer */
 typedef void(*alarm_callback)(arg_t);
 
-/* alarm id type */
-typedef void* alarm_id_t;
+/* alarm id type - an id is not given out again until its entry has
+   been reused 2^32 times, so deregistering an alarm which has already
+   fired is safe */
+typedef unsigned __int64 alarm_id_t;
+
+/* an id no alarm has */
+#define ALARM_ID_NONE (0)
 
 
 
@@ -29,9 +34,11 @@ typedef void* alarm_id_t;
  * register an alarm to go off in delay milliseconds. the library
  * will fire the alarm after at least delay milliseconds have
  * passed by calling func with the single argument arg. the alarm may
- * be fired arbitrarily later than delay milliseconds, but alarms will
- * be fired in order (absolute time registered + registered delay should
- * never be lower for a subsequent alarm than for the previous alarm).
+ * be fired arbitrarily later than delay milliseconds. alarms are
+ * handed out in order of the time they are due, but callbacks are run
+ * by a pool of callback threads, so they may run concurrently and out
+ * of order - a callback due later may start, or finish, before one due
+ * earlier. callbacks which must not overlap have to lock for themselves.
  * if requested, return out an alarm id which uniquely identifies this
  * alarm. This id can be used to later deregister the alarm.
  * on success, return 0. on failure, return -1.
@@ -39,6 +46,25 @@ typedef void* alarm_id_t;
 extern int alarm_register(int delay, alarm_callback func, arg_t arg, alarm_id_t *id_p);
 
 
+/* 
+ * register an alarm as alarm_register does, but which may be fired
+ * up to slack milliseconds late. alarms whose slack overlaps are
+ * fired together, with one wakeup, and so may not be fired in order.
+ * on success, return 0. on failure, return -1.
+ */
+extern int alarm_register_slack(int delay, int slack, alarm_callback func, arg_t arg, alarm_id_t *id_p);
+
+
+/* 
+ * register an alarm to go off every interval milliseconds, each
+ * time up to slack milliseconds late, until it is deregistered
+ * with the id returned. if it is fired more than an interval
+ * late, the firings missed are skipped.
+ * on success, return 0. on failure, return -1.
+ */
+extern int alarm_register_periodic(int interval, int slack, alarm_callback func, arg_t arg, alarm_id_t *id_p);
+
+
 /* 
  * deregister the alarm corresponing to id.
  * on success, return 0. on failure, return -1.
@@ -46,5 +72,14 @@ extern int alarm_register(int delay, alarm_callback func, arg_t arg, alarm_id_t
 extern int alarm_deregister(alarm_id_t id);
 
 
+/* 
+ * return the number of callbacks which have run for longer than
+ * their budget (1 ms) - they delay the other alarms - and, if
+ * longest_p is not NULL, the longest any has taken in nanoseconds.
+ * each overrun is also recorded in the trace.
+ */
+extern int alarm_overruns(__int64 *longest_p);
+
+
 
 #endif __ALARM_H__
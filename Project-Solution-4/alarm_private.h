@@ -26,6 +26,16 @@ typedef struct alarm *alarm_t;
 alarm_t alarm_system_initialize(void);
 
 
+/* 
+ * register an alarm as alarm_register does, but fired by whichever
+ * thread finds it due, with interrupts disabled, rather than by a
+ * callback thread - so it fires even while every callback thread is
+ * blocked. func must be short, and must not block.
+ * on success, return 0. on failure, return -1.
+ */
+int alarm_register_direct(int delay, alarm_callback func, arg_t arg, alarm_id_t *id_p);
+
+
 /* 
  * return true (1) if there are registered alarms,
  * or return false (0) if there are none registered
@@ -42,10 +52,26 @@ int alarm_has_ready(void);
 
 
 /* 
- * fire the next ready alarm
- * on success, return 0. on failure, return -1.
+ * return true (1) if a callback thread is waiting for an alarm
+ * to fire, or return false (0) if they are all busy
+ */
+int alarm_has_waiting(void);
+
+
+/* 
+ * return the time (from currentTimeNanos) at which the next
+ * alarm will be ready, or -1 if there are none registered
+ */
+__int64 alarm_next_deadline(void);
+
+
+/* 
+ * hand the alarms which are due to the alarm callback threads,
+ * starting as many of those waiting as there are alarms, and
+ * return the number started. called with interrupts disabled,
+ * so it can be called from an interrupt handler
  */
-int alarm_fire_next(void);
+int alarm_dispatch(void);
 
 
 /*
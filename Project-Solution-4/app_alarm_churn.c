@@ -0,0 +1,81 @@
+/*
+ * Alarm churn benchmark.
+ *
+ * Registers ALARMS alarms, far enough in the future that none fire,
+ * then repeatedly deregisters one at random and registers another in
+ * its place, as minimsg does with a retransmit alarm for every
+ * message, and reports the time each pair takes. The alarms are then
+ * deregistered.
+ *
+ * Change ALARMS to vary how many alarms are outstanding, and
+ * CHURN_ROUNDS how many are replaced.
+ */
+
+#include "defs.h"
+#include "minithread.h"
+#include "machineprimitives_ext.h"
+#include "alarm.h"
+
+#define ALARMS 100000
+
+#define CHURN_ROUNDS 1000000
+
+/* alarms are due between 10 seconds and 10 minutes from now */
+#define DELAY_MIN (10 * 1000)
+#define DELAY_SPREAD (10 * 60 * 1000)
+
+
+alarm_id_t ids[ALARMS];
+
+unsigned int seed = 1;
+
+/* a pseudo-random number - rand() only gives 15 bits */
+unsigned int churn_random(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 1;
+}
+
+void never(arg_t arg) {
+	printf("Alarm fired early.\n");
+}
+
+int churn(arg_t arg) {
+	__int64 start, elapsed;
+	int i, j;
+
+	printf("Registering %d alarms ...\n", ALARMS);
+	start = currentTimeNanos();
+	for ( i = 0; i < ALARMS; i++ ) {
+		alarm_register(DELAY_MIN + churn_random() % DELAY_SPREAD, never, NULL, &ids[i]);
+	}
+	elapsed = currentTimeNanos() - start;
+	printf("%d alarms registered in %lu us (%lu ns / register).\n",
+		ALARMS, (unsigned long)(elapsed / 1000), (unsigned long)(elapsed / ALARMS));
+
+	printf("Replacing %d alarms ...\n", CHURN_ROUNDS);
+	start = currentTimeNanos();
+	for ( i = 0; i < CHURN_ROUNDS; i++ ) {
+		j = churn_random() % ALARMS;
+		alarm_deregister(ids[j]);
+		alarm_register(DELAY_MIN + churn_random() % DELAY_SPREAD, never, NULL, &ids[j]);
+	}
+	elapsed = currentTimeNanos() - start;
+	printf("%d alarms replaced in %lu us (%lu ns / deregister and register).\n",
+		CHURN_ROUNDS, (unsigned long)(elapsed / 1000), (unsigned long)(elapsed / CHURN_ROUNDS));
+
+	for ( i = 0; i < ALARMS; i++ ) {
+		alarm_deregister(ids[i]);
+	}
+	return 0;
+}
+
+
+void main(void) {
+	printf("app_alarm_churn begins.\n");
+
+	minithread_system_initialize(churn, NULL);
+
+	dbgprintf("Memory Leaks (If Any) Follow:\n");
+	_CrtDumpMemoryLeaks();
+	system("pause");
+}
@@ -0,0 +1,167 @@
+/*
+ * Bounded buffer benchmark.
+ *
+ * Passes ITEMS items from a producer to a consumer through a buffer
+ * of BUFFER_SIZE items three ways - with semaphores guarding a ring
+ * buffer as in app_buffer.c, with messages acknowledged through
+ * minimsg as in app_mp_buffer.c, and with a channel - and reports
+ * the time each takes.
+ *
+ * Change ITEMS to vary the number of items passed.
+ */
+
+#include "defs.h"
+#include "minithread.h"
+#include "machineprimitives_ext.h"
+#include "synch.h"
+#include "minimsg.h"
+#include "channel.h"
+
+#define BUFFER_SIZE 10
+
+#define ITEMS 100000
+
+
+/* semaphores */
+
+int buffer[BUFFER_SIZE];
+int head, tail;
+semaphore_t empty;
+semaphore_t full;
+
+int sem_consumer(arg_t arg) {
+	int i, item;
+	for ( i = 0; i < ITEMS; i++ ) {
+		semaphore_P(full);
+		item = buffer[tail];
+		tail = (tail + 1) % BUFFER_SIZE;
+		semaphore_V(empty);
+	}
+	return item;
+}
+
+int sem_producer(arg_t arg) {
+	int i;
+	for ( i = 1; i <= ITEMS; i++ ) {
+		semaphore_P(empty);
+		buffer[head] = i;
+		head = (head + 1) % BUFFER_SIZE;
+		semaphore_V(full);
+	}
+	return 0;
+}
+
+
+/* minimsg - the consumer acknowledges each item, and the producer
+ * waits for an acknowledgement whenever BUFFER_SIZE are outstanding
+ */
+
+minimsg_port_t consume;
+minimsg_port_t produce;
+
+int msg_consumer(arg_t arg) {
+	int i, size, item;
+	for ( i = 0; i < ITEMS; i++ ) {
+		size = sizeof(int);
+		minimsg_receive(consume, (minimsg_data_t)&item, &size, NULL, NULL);
+		minimsg_send(consume, produce, sizeof(int), (minimsg_data_t)&item, 0);
+	}
+	return item;
+}
+
+int msg_producer(arg_t arg) {
+	int i, size, ack, in_buff = 0;
+	for ( i = 1; i <= ITEMS; i++ ) {
+		if ( in_buff == BUFFER_SIZE ) {
+			size = sizeof(int);
+			minimsg_receive(produce, (minimsg_data_t)&ack, &size, NULL, NULL);
+			in_buff--;
+		}
+		minimsg_send(produce, consume, sizeof(int), (minimsg_data_t)&i, 0);
+		in_buff++;
+	}
+	while ( in_buff > 0 ) {
+		size = sizeof(int);
+		minimsg_receive(produce, (minimsg_data_t)&ack, &size, NULL, NULL);
+		in_buff--;
+	}
+	return 0;
+}
+
+
+/* channel */
+
+channel_t channel;
+
+int channel_consumer(arg_t arg) {
+	int item;
+	while ( channel_recv(channel, &item) == 0 ) {
+	}
+	return 0;
+}
+
+int channel_producer(arg_t arg) {
+	int i;
+	for ( i = 1; i <= ITEMS; i++ ) {
+		channel_send(channel, &i);
+	}
+	channel_close(channel);
+	return 0;
+}
+
+
+/* run a producer and consumer, and return how long it takes both
+ * to finish, in ms
+ */
+double run(proc_t producer, proc_t consumer) {
+	minithread_t threads[2];
+	unsigned __int64 start;
+
+	start = currentTimeNanos();
+	threads[0] = minithread_fork_joinable(consumer, NULL);
+	threads[1] = minithread_fork_joinable(producer, NULL);
+	minithread_join(threads[0], NULL);
+	minithread_join(threads[1], NULL);
+	return (double)(__int64)(currentTimeNanos() - start) / 1000000.0;
+}
+
+void report(char *buffered_by, double ms) {
+	printf("%-12s %8.1f ms (%.0f items / second)\n", buffered_by, ms, ms > 0 ? ITEMS * 1000.0 / ms : 0.0);
+}
+
+
+int bench(arg_t arg) {
+	printf("Passing %d items through a buffer of %d ...\n", ITEMS, BUFFER_SIZE);
+
+	empty = semaphore_create();
+	full = semaphore_create();
+	semaphore_initialize(empty, BUFFER_SIZE);
+	semaphore_initialize(full, 0);
+	head = tail = 0;
+	report("semaphores", run(sem_producer, sem_consumer));
+	semaphore_destroy(empty);
+	semaphore_destroy(full);
+
+	consume = minimsg_port_create();
+	produce = minimsg_port_create();
+	report("minimsg", run(msg_producer, msg_consumer));
+	minimsg_port_destroy(consume);
+	minimsg_port_destroy(produce);
+
+	channel = channel_create(sizeof(int), BUFFER_SIZE);
+	report("channel", run(channel_producer, channel_consumer));
+	channel_destroy(channel);
+
+	return 0;
+}
+
+
+void main(void) {
+	printf("app_channel_bench begins.\n");
+
+	minithread_system_initialize(bench, NULL);
+
+	dbgprintf("Memory Leaks (If Any) Follow:\n");
+	_CrtDumpMemoryLeaks();
+	system("pause");
+}
@@ -0,0 +1,229 @@
+/*
+ * Lock contention benchmark.
+ *
+ * Runs the same workloads with the semaphore emulations of each
+ * lock and with the locks in synch.h, and reports the time each
+ * takes: THREADS threads taking a mutex, a producer and consumer
+ * passing items through a condition variable, and READERS readers
+ * against one writer on a reader-writer lock.
+ *
+ * Change ROUNDS to vary how long each workload runs.
+ */
+
+#include "defs.h"
+#include "minithread.h"
+#include "machineprimitives_ext.h"
+#include "synch.h"
+
+#define THREADS 8
+#define READERS 8
+#define ROUNDS 100000
+#define ITEMS 100000
+
+
+int counter;
+int items;
+
+semaphore_t sem_lock;
+semaphore_t sem_items;
+semaphore_t sem_read_count;
+int read_count;
+mutex_t mutex;
+condvar_t condvar;
+rwlock_t rwlock;
+
+
+int sem_locker(arg_t arg) {
+	int i;
+	for ( i = 0; i < ROUNDS; i++ ) {
+		semaphore_P(sem_lock);
+		counter++;
+		semaphore_V(sem_lock);
+	}
+	return 0;
+}
+
+int mutex_locker(arg_t arg) {
+	int i;
+	for ( i = 0; i < ROUNDS; i++ ) {
+		mutex_lock(mutex);
+		counter++;
+		mutex_unlock(mutex);
+	}
+	return 0;
+}
+
+
+int sem_producer(arg_t arg) {
+	int i;
+	for ( i = 0; i < ITEMS; i++ ) {
+		semaphore_P(sem_lock);
+		items++;
+		semaphore_V(sem_lock);
+		semaphore_V(sem_items);
+	}
+	return 0;
+}
+
+int sem_consumer(arg_t arg) {
+	int i;
+	for ( i = 0; i < ITEMS; i++ ) {
+		semaphore_P(sem_items);
+		semaphore_P(sem_lock);
+		items--;
+		semaphore_V(sem_lock);
+	}
+	return 0;
+}
+
+int condvar_producer(arg_t arg) {
+	int i;
+	for ( i = 0; i < ITEMS; i++ ) {
+		mutex_lock(mutex);
+		items++;
+		condvar_signal(condvar);
+		mutex_unlock(mutex);
+	}
+	return 0;
+}
+
+int condvar_consumer(arg_t arg) {
+	int i;
+	for ( i = 0; i < ITEMS; i++ ) {
+		mutex_lock(mutex);
+		while ( items == 0 ) {
+			condvar_wait(condvar, mutex);
+		}
+		items--;
+		mutex_unlock(mutex);
+	}
+	return 0;
+}
+
+
+// the classic readers-writers solution - the first reader in
+// locks out writers, and the last one out lets them in
+int sem_reader(arg_t arg) {
+	int i, value;
+	for ( i = 0; i < ROUNDS; i++ ) {
+		semaphore_P(sem_read_count);
+		if ( ++read_count == 1 ) {
+			semaphore_P(sem_lock);
+		}
+		semaphore_V(sem_read_count);
+
+		value = counter;
+
+		semaphore_P(sem_read_count);
+		if ( --read_count == 0 ) {
+			semaphore_V(sem_lock);
+		}
+		semaphore_V(sem_read_count);
+	}
+	return value;
+}
+
+int sem_writer(arg_t arg) {
+	int i;
+	for ( i = 0; i < ROUNDS / READERS; i++ ) {
+		semaphore_P(sem_lock);
+		counter++;
+		semaphore_V(sem_lock);
+	}
+	return 0;
+}
+
+int rwlock_reader(arg_t arg) {
+	int i, value;
+	for ( i = 0; i < ROUNDS; i++ ) {
+		rwlock_read_lock(rwlock);
+		value = counter;
+		rwlock_read_unlock(rwlock);
+	}
+	return value;
+}
+
+int rwlock_writer(arg_t arg) {
+	int i;
+	for ( i = 0; i < ROUNDS / READERS; i++ ) {
+		rwlock_write_lock(rwlock);
+		counter++;
+		rwlock_write_unlock(rwlock);
+	}
+	return 0;
+}
+
+
+// run count threads of proc, and one of other if not NULL,
+// and return how long it takes them all to finish, in ms
+double run(proc_t proc, int count, proc_t other) {
+	minithread_t threads[THREADS + READERS + 1];
+	unsigned __int64 start;
+	int i, n = 0;
+
+	start = currentTimeNanos();
+	for ( i = 0; i < count; i++ ) {
+		threads[n++] = minithread_fork_joinable(proc, NULL);
+	}
+	if ( other ) {
+		threads[n++] = minithread_fork_joinable(other, NULL);
+	}
+	for ( i = 0; i < n; i++ ) {
+		minithread_join(threads[i], NULL);
+	}
+	return (double)(__int64)(currentTimeNanos() - start) / 1000000.0;
+}
+
+void report(char *workload, double sem_ms, double lock_ms) {
+	printf("%-24s semaphores %8.1f ms   locks %8.1f ms\n", workload, sem_ms, lock_ms);
+}
+
+
+int contend(arg_t arg) {
+	double sem_ms, lock_ms;
+
+	sem_lock = semaphore_create();
+	sem_items = semaphore_create();
+	sem_read_count = semaphore_create();
+	mutex = mutex_create();
+	condvar = condvar_create();
+	rwlock = rwlock_create();
+	semaphore_initialize(sem_lock, 1);
+	semaphore_initialize(sem_items, 0);
+	semaphore_initialize(sem_read_count, 1);
+
+	counter = 0;
+	sem_ms = run(sem_locker, THREADS, NULL);
+	lock_ms = run(mutex_locker, THREADS, NULL);
+	report("mutex", sem_ms, lock_ms);
+
+	items = 0;
+	sem_ms = run(sem_producer, 1, sem_consumer);
+	lock_ms = run(condvar_producer, 1, condvar_consumer);
+	report("producer / consumer", sem_ms, lock_ms);
+
+	read_count = 0;
+	sem_ms = run(sem_reader, READERS, sem_writer);
+	lock_ms = run(rwlock_reader, READERS, rwlock_writer);
+	report("readers / writer", sem_ms, lock_ms);
+
+	semaphore_destroy(sem_lock);
+	semaphore_destroy(sem_items);
+	semaphore_destroy(sem_read_count);
+	mutex_destroy(mutex);
+	condvar_destroy(condvar);
+	rwlock_destroy(rwlock);
+
+	return 0;
+}
+
+
+void main(void) {
+	printf("app_lock_contention begins.\n");
+
+	minithread_system_initialize(contend, NULL);
+
+	dbgprintf("Memory Leaks (If Any) Follow:\n");
+	_CrtDumpMemoryLeaks();
+	system("pause");
+}
@@ -10,8 +10,20 @@
 #include "defs.h"
 #include "minithread.h"
 #include "minimsg.h"
+#include "network.h"
 
+/* record all traffic to CAPTURE_FILE, for replay by app_net_replay.
+ * messages between local ports never reach the network, so this also
+ * turns on INTER_PROCESS - start a second process for it to talk to
+ */
+#define CAPTURE 0
+#define CAPTURE_FILE "minimsg.pcap"
+
+#if CAPTURE
+#define INTER_PROCESS 1
+#else
 #define INTER_PROCESS 0
+#endif
 
 #define BUFFER_SIZE 10
 
@@ -107,6 +119,10 @@ int producer(arg_t arg) {
 	minimsg_port_t sys_produce;
 
 	pcount = 0;
+
+	if ( CAPTURE ) {
+		network_capture_start(CAPTURE_FILE);
+	}
 	
 	produce = minimsg_port_create();
 
@@ -204,6 +220,10 @@ int producer(arg_t arg) {
 
 	minimsg_port_destroy(produce);
 
+	if ( CAPTURE ) {
+		network_capture_stop();
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,154 @@
+/*
+ * Mailbox queue benchmark.
+ *
+ * Delivers ITEMS items to one consumer from 1 up to PRODUCERS
+ * producers, each an OS thread as a network receive thread or
+ * another worker would be, two ways - through a queue_t guarded
+ * by one lock, as mailboxes were, and through the lock-free
+ * mpsc_queue_t they use now - and reports the time each takes.
+ * Each producer's items must arrive in the order it sent them,
+ * and any which do not are reported.
+ *
+ * Change ITEMS to vary the number of items delivered.
+ */
+
+#include "defs.h"
+#include "machineprimitives_ext.h"
+#include "queue.h"
+
+#define PRODUCERS 8
+
+#define ITEMS 1000000
+
+
+struct item {
+	mpsc_link_t link;
+	int producer;
+	int sequence;
+};
+
+struct item *items;
+int producers;
+
+/* a lock, as interrupts being disabled was */
+
+queue_t locked_queue;
+tas_lock_t lock;
+
+int locked_producer(void *arg) {
+	int i;
+	for ( i = (int)arg; i < ITEMS; i += producers ) {
+		while ( atomic_test_and_set(&lock) ) {
+		}
+		queue_append(locked_queue, &items[i]);
+		atomic_clear(&lock);
+	}
+	return 0;
+}
+
+struct item *locked_consume(void) {
+	struct item *item;
+	int ret;
+	do {
+		while ( atomic_test_and_set(&lock) ) {
+		}
+		ret = queue_dequeue(locked_queue, (any_t*)&item);
+		atomic_clear(&lock);
+	} while ( ret != 0 );
+	return item;
+}
+
+
+/* lock-free */
+
+mpsc_queue_t mpsc_queue;
+
+int mpsc_producer(void *arg) {
+	int i;
+	for ( i = (int)arg; i < ITEMS; i += producers ) {
+		mpsc_queue_push(&mpsc_queue, &items[i].link);
+	}
+	return 0;
+}
+
+struct item *mpsc_consume(void) {
+	mpsc_link_t *link;
+	while ( mpsc_queue_pop(&mpsc_queue, &link) != 0 ) {
+	}
+	return queue_item(link, struct item, link);
+}
+
+
+/* start the producers, consume every item as it arrives, and return
+ * how long it takes, in ms
+ */
+double run(int (*producer)(void *), struct item *(*consume)(void)) {
+	HANDLE threads[PRODUCERS];
+	int last[PRODUCERS];
+	unsigned __int64 start;
+	struct item *item;
+	DWORD id;
+	int i, out_of_order = 0;
+
+	for ( i = 0; i < ITEMS; i++ ) {
+		items[i].producer = i % producers;
+		items[i].sequence = i;
+	}
+	for ( i = 0; i < producers; i++ ) {
+		last[i] = -1;
+	}
+
+	start = currentTimeNanos();
+	for ( i = 0; i < producers; i++ ) {
+		threads[i] = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)producer, (void*)i, 0, &id);
+	}
+	for ( i = 0; i < ITEMS; i++ ) {
+		item = (*consume)();
+		if ( item->sequence < last[item->producer] ) {
+			out_of_order++;
+		}
+		last[item->producer] = item->sequence;
+	}
+	for ( i = 0; i < producers; i++ ) {
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+	start = currentTimeNanos() - start;
+
+	if ( out_of_order ) {
+		printf("%d items out of order!\n", out_of_order);
+	}
+	return (double)(__int64)start / 1000000.0;
+}
+
+void report(char *queued_by, double ms) {
+	printf("  %-10s %8.1f ms (%.0f items / second)\n", queued_by, ms, ms > 0 ? ITEMS * 1000.0 / ms : 0.0);
+}
+
+
+void main(void) {
+	printf("app_mpsc_bench begins.\n");
+
+	items = (struct item *)malloc(ITEMS * sizeof(struct item));
+	if ( !items ) {
+		return;
+	}
+
+	for ( producers = 1; producers <= PRODUCERS; producers *= 2 ) {
+		printf("Delivering %d items from %d producers ...\n", ITEMS, producers);
+
+		locked_queue = queue_new();
+		atomic_clear(&lock);
+		report("locked", run(locked_producer, locked_consume));
+		queue_free(locked_queue);
+
+		mpsc_queue_init(&mpsc_queue);
+		report("lock-free", run(mpsc_producer, mpsc_consume));
+	}
+
+	free(items);
+
+	dbgprintf("Memory Leaks (If Any) Follow:\n");
+	_CrtDumpMemoryLeaks();
+	system("pause");
+}
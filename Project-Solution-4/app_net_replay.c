@@ -0,0 +1,70 @@
+/*
+ * Network receive path benchmark.
+ *
+ * Replays the datagrams received in a capture file back through
+ * the minimsg network interrupt handler as fast as possible, and
+ * reports the rate achieved. A capture can be recorded from any
+ * application by calling network_capture_start(CAPTURE_FILE) after
+ * the system is initialized (set CAPTURE in app_mp_buffer.c, and
+ * run a second process for it to talk to).
+ *
+ * minimsg_replay_start has minimsg recreate the ports the messages
+ * were captured going to, with a thread receiving from each, and
+ * deliver every message in every round, even though it has been
+ * seen before. The time reported runs until all of them have been
+ * received.
+ *
+ * Change REPLAY_ROUNDS to vary how many times the capture is replayed.
+ */
+
+#include "defs.h"
+#include "minithread.h"
+#include "machineprimitives.h"
+#include "minimsg.h"
+#include "network.h"
+
+#define CAPTURE_FILE "minimsg.pcap"
+
+#define REPLAY_ROUNDS 100
+
+
+int replay(arg_t arg) {
+	unsigned __int64 start, elapsed;
+	int delivered, received;
+
+	printf("Replaying %s %d times ...\n", CAPTURE_FILE, REPLAY_ROUNDS);
+
+	if ( minimsg_replay_start() != 0 ) {
+		printf("Could not start replaying.\n");
+		return 0;
+	}
+
+	start = currentTimeMillis();
+	delivered = network_replay(CAPTURE_FILE, REPLAY_ROUNDS);
+	received = minimsg_replay_stop();
+	elapsed = currentTimeMillis() - start;
+
+	if ( delivered < 0 ) {
+		printf("Could not replay %s.\n", CAPTURE_FILE);
+		return 0;
+	}
+
+	printf("%d packets delivered and %d messages received in %lu ms", delivered, received, (unsigned long)elapsed);
+	if ( elapsed > 0 ) {
+		printf(" (%lu packets / second)", (unsigned long)((delivered * 1000.0) / elapsed));
+	}
+	printf(".\n");
+
+	return 0;
+}
+
+
+void main(void) {
+	printf("app_net_replay begins.\n");
+
+	minithread_system_initialize(replay, NULL);
+
+	dbgprintf("Memory Leaks (If Any) Follow:\n");
+	_CrtDumpMemoryLeaks();
+	system("pause");
+}
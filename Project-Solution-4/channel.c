@@ -0,0 +1,300 @@
+/*
+ * channel.c - bounded channels between minithreads
+ *
+ * a channel is guarded by disabling interrupts, as semaphores are.
+ * a thread waiting on a channel queues a group of waiters, as a
+ * semaphore_P_any does, one for each case it waits on, on the
+ * channel's senders or receivers, and the group records the case
+ * done. whoever completes a waiting case copies the value to or
+ * from the waiting thread directly, so it never has to retry.
+ */
+
+#include <string.h>
+
+#include "defs.h"
+
+#include "interrupts.h"
+#include "minithread.h"
+#include "queue.h"
+#include "synch_private.h"
+#include "channel.h"
+
+
+/* cases waited on without allocating */
+#define CHANNEL_SELECT_INLINE (8)
+
+struct channel {
+	int elem_size;
+	int capacity;
+	char *buffer;
+	int head; /* the index of the first value buffered */
+	int count; /* the number of values buffered */
+	int closed;
+	iqueue_t senders; /* waiters - only while the buffer is full */
+	iqueue_t receivers; /* waiters - only while the buffer is empty */
+};
+
+/* the state of the generator picking the case channel_select
+ * tries first - private, so as not to disturb the application's rand
+ */
+static unsigned int channel_random_state = 1;
+
+/* with interrupts disabled, return a pseudo-random number from 0 to n - 1 */
+static int channel_random(int n) {
+	channel_random_state = channel_random_state * 1103515245 + 12345;
+	return (int)((channel_random_state >> 16) % n);
+}
+
+/* with interrupts disabled, record that the waiter's case is done,
+ * and wake its thread
+ */
+static void channel_complete(struct synch_waiter *waiter, int closed) {
+	waiter->group->closed = closed;
+	synch_group_grant(waiter);
+}
+
+/* with interrupts disabled, send value if that can be done without
+ * waiting, and return 1, or else return 0
+ */
+static int channel_try_send_locked(channel_t channel, void *value, int *closed_p) {
+	struct synch_waiter *waiter;
+
+	*closed_p = 0;
+	if ( channel->closed ) {
+		*closed_p = 1;
+		return 1;
+	}
+	if ( (waiter = synch_group_take(&channel->receivers)) != NULL ) {
+		/* a receiver is waiting, so the buffer is empty */
+		memcpy(waiter->value, value, channel->elem_size);
+		channel_complete(waiter, 0);
+		return 1;
+	}
+	if ( channel->count < channel->capacity ) {
+		memcpy(channel->buffer + ((channel->head + channel->count) % channel->capacity) * channel->elem_size,
+			value, channel->elem_size);
+		channel->count++;
+		return 1;
+	}
+	return 0;
+}
+
+/* with interrupts disabled, receive into value if that can be done
+ * without waiting, and return 1, or else return 0
+ */
+static int channel_try_recv_locked(channel_t channel, void *value, int *closed_p) {
+	struct synch_waiter *waiter;
+
+	*closed_p = 0;
+	if ( channel->count > 0 ) {
+		memcpy(value, channel->buffer + channel->head * channel->elem_size, channel->elem_size);
+		channel->head = (channel->head + 1) % channel->capacity;
+		channel->count--;
+		/* make room for a waiting sender's value */
+		if ( (waiter = synch_group_take(&channel->senders)) != NULL ) {
+			memcpy(channel->buffer + ((channel->head + channel->count) % channel->capacity) * channel->elem_size,
+				waiter->value, channel->elem_size);
+			channel->count++;
+			channel_complete(waiter, 0);
+		}
+		return 1;
+	}
+	if ( (waiter = synch_group_take(&channel->senders)) != NULL ) {
+		/* unbuffered - take it straight from the sender */
+		memcpy(value, waiter->value, channel->elem_size);
+		channel_complete(waiter, 0);
+		return 1;
+	}
+	if ( channel->closed ) {
+		memset(value, 0, channel->elem_size);
+		*closed_p = 1;
+		return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Create a channel of values elem_size bytes long, buffering up to
+ * capacity of them. Return NULL on failure.
+ */
+channel_t channel_create(int elem_size, int capacity) {
+	channel_t channel;
+
+	if ( elem_size <= 0 || capacity < 0 ) {
+		return NULL;
+	}
+	channel = (channel_t)malloc(sizeof(struct channel));
+	if ( channel == NULL ) {
+		return NULL;
+	}
+	channel->buffer = NULL;
+	if ( capacity > 0 ) {
+		channel->buffer = (char *)malloc(elem_size * capacity);
+		if ( channel->buffer == NULL ) {
+			free(channel);
+			return NULL;
+		}
+	}
+	channel->elem_size = elem_size;
+	channel->capacity = capacity;
+	channel->head = 0;
+	channel->count = 0;
+	channel->closed = 0;
+	iqueue_init(&channel->senders);
+	iqueue_init(&channel->receivers);
+	return channel;
+}
+
+/*
+ * Cleanup all resources consumed by the channel.
+ * Return 0 on success, -1 on failure.
+ */
+int channel_destroy(channel_t channel) {
+	if ( iqueue_length(&channel->senders) || iqueue_length(&channel->receivers) ) {
+		return -1;
+	}
+	free(channel->buffer);
+	free(channel);
+	return 0;
+}
+
+/*
+ * Send the value at value, waiting for room or a receiver.
+ */
+int channel_send(channel_t channel, void *value) {
+	channel_case_t send_case;
+
+	send_case.channel = channel;
+	send_case.op = CHANNEL_SEND;
+	send_case.value = value;
+	channel_select(&send_case, 1, 1);
+	return send_case.closed ? CHANNEL_CLOSED : 0;
+}
+
+/*
+ * Receive a value into value, waiting for one to be sent.
+ */
+int channel_recv(channel_t channel, void *value) {
+	channel_case_t recv_case;
+
+	recv_case.channel = channel;
+	recv_case.op = CHANNEL_RECV;
+	recv_case.value = value;
+	channel_select(&recv_case, 1, 1);
+	return recv_case.closed ? CHANNEL_CLOSED : 0;
+}
+
+/*
+ * Send the value at value, if that can be done without waiting.
+ */
+int channel_try_send(channel_t channel, void *value) {
+	int closed, done;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+
+	done = channel_try_send_locked(channel, value, &closed);
+	set_interrupt_level(old_int);
+	return !done ? CHANNEL_WOULD_BLOCK : closed ? CHANNEL_CLOSED : 0;
+}
+
+/*
+ * Receive a value into value, if that can be done without waiting.
+ */
+int channel_try_recv(channel_t channel, void *value) {
+	int closed, done;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+
+	done = channel_try_recv_locked(channel, value, &closed);
+	set_interrupt_level(old_int);
+	return !done ? CHANNEL_WOULD_BLOCK : closed ? CHANNEL_CLOSED : 0;
+}
+
+/*
+ * Close the channel, waking every thread waiting on it.
+ * Return 0, or -1 if it was already closed.
+ */
+int channel_close(channel_t channel) {
+	struct synch_waiter *waiter;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+
+	if ( channel->closed ) {
+		set_interrupt_level(old_int);
+		return -1;
+	}
+	channel->closed = 1;
+	while ( (waiter = synch_group_take(&channel->receivers)) != NULL ) {
+		memset(waiter->value, 0, channel->elem_size);
+		channel_complete(waiter, 1);
+	}
+	while ( (waiter = synch_group_take(&channel->senders)) != NULL ) {
+		channel_complete(waiter, 1);
+	}
+	set_interrupt_level(old_int);
+	return 0;
+}
+
+/*
+ * Complete whichever of the n cases can be done first. Return the
+ * index of the case done, CHANNEL_WOULD_BLOCK if none can be done
+ * and block is 0, or -1 on failure.
+ */
+int channel_select(channel_case_t cases[], int n, int block) {
+	struct synch_waiter inline_waiters[CHANNEL_SELECT_INLINE];
+	struct synch_waiter *waiters = inline_waiters;
+	channel_t channel;
+	interrupt_level_t old_int;
+	int start, i, j, closed;
+
+	if ( n <= 0 ) {
+		return -1;
+	}
+	for ( i = 0; i < n; i++ ) {
+		cases[i].closed = 0;
+	}
+
+	old_int = set_interrupt_level(DISABLED);
+	/* start at a random case, so an early one which is always ready
+	 * does not starve the rest
+	 */
+	start = n > 1 ? channel_random(n) : 0;
+	for ( j = 0; j < n; j++ ) {
+		i = (start + j) % n;
+		if ( cases[i].op == CHANNEL_SEND
+			? channel_try_send_locked(cases[i].channel, cases[i].value, &closed)
+			: channel_try_recv_locked(cases[i].channel, cases[i].value, &closed) ) {
+			set_interrupt_level(old_int);
+			cases[i].closed = closed;
+			return i;
+		}
+	}
+	if ( !block ) {
+		set_interrupt_level(old_int);
+		return CHANNEL_WOULD_BLOCK;
+	}
+
+	if ( n > CHANNEL_SELECT_INLINE ) {
+		waiters = (struct synch_waiter *)malloc(n * sizeof(struct synch_waiter));
+		if ( waiters == NULL ) {
+			set_interrupt_level(old_int);
+			return -1;
+		}
+	}
+	/* one waiter for each case, all completed through the first */
+	for ( i = 0; i < n; i++ ) {
+		channel = cases[i].channel;
+		synch_group_add(&waiters[0], &waiters[i], i,
+			cases[i].op == CHANNEL_SEND ? &channel->senders : &channel->receivers);
+		waiters[i].value = cases[i].value;
+	}
+	synch_wait(&waiters[0]);
+	/* take the cases which were not done off their queues */
+	synch_group_cancel(waiters, n);
+	set_interrupt_level(old_int);
+
+	i = waiters[0].which;
+	cases[i].closed = waiters[0].closed;
+	if ( waiters != inline_waiters ) {
+		free(waiters);
+	}
+	return i;
+}
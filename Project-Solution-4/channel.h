@@ -0,0 +1,86 @@
+/*
+ * channel.h - bounded channels between minithreads
+ *
+ * a channel carries values of a fixed size, copied in by send and
+ * out by recv, through a ring buffer holding up to capacity of them.
+ * with a capacity of 0 a send waits for a recv to take its value
+ * straight from it. once a channel is closed nothing more may be sent,
+ * but what was sent before can still be received. channel_select
+ * waits on several channels at once, and completes exactly one send
+ * or recv.
+ */
+
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+
+typedef struct channel *channel_t;
+
+/* results of channel operations, besides 0 (success) */
+#define CHANNEL_CLOSED (-1) /* the channel is closed, or closed and empty */
+#define CHANNEL_WOULD_BLOCK (-2) /* not done, as it would have to wait */
+
+/* the operation of a channel_select case */
+#define CHANNEL_SEND (0)
+#define CHANNEL_RECV (1)
+
+/* one case of a channel_select */
+typedef struct channel_case {
+	channel_t channel;
+	int op; /* CHANNEL_SEND or CHANNEL_RECV */
+	void *value; /* the value sent, or the buffer received into */
+	int closed; /* set if the case completed because the channel is closed */
+} channel_case_t;
+
+
+/*
+ * Create a channel of values elem_size bytes long, buffering up to
+ * capacity of them. Return NULL on failure.
+ */
+extern channel_t channel_create(int elem_size, int capacity);
+
+/*
+ * Cleanup all resources consumed by the channel, which no thread may
+ * be waiting on. Return 0 on success, -1 on failure.
+ */
+extern int channel_destroy(channel_t channel);
+
+/*
+ * Send the value at value, waiting until there is room for it or a
+ * thread to receive it. Return 0, or CHANNEL_CLOSED if the channel
+ * is or becomes closed first, in which case it is not sent.
+ */
+extern int channel_send(channel_t channel, void *value);
+
+/*
+ * Receive a value into value, waiting until one is sent. Return 0,
+ * or CHANNEL_CLOSED, with value zeroed, if the channel is closed and
+ * every value sent has been received.
+ */
+extern int channel_recv(channel_t channel, void *value);
+
+/*
+ * As channel_send and channel_recv, but return CHANNEL_WOULD_BLOCK
+ * rather than wait.
+ */
+extern int channel_try_send(channel_t channel, void *value);
+extern int channel_try_recv(channel_t channel, void *value);
+
+/*
+ * Close the channel, waking every thread waiting on it.
+ * Return 0, or -1 if it was already closed.
+ */
+extern int channel_close(channel_t channel);
+
+/*
+ * Complete whichever of the n cases can be done first - if several
+ * can be done at once one is picked at random, so none is starved.
+ * A case completes with closed set, as channel_send or channel_recv
+ * would return CHANNEL_CLOSED, if its channel is closed. Return the
+ * index of the case done, CHANNEL_WOULD_BLOCK if none can be done and
+ * block is 0, or -1 on failure.
+ */
+extern int channel_select(channel_case_t cases[], int n, int block);
+
+
+#endif __CHANNEL_H__
@@ -45,6 +45,58 @@
     exit(1);\
   }
 
+#elif defined(__linux__) /* Linux definitions */
+#include <time.h>
+#include <assert.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+// Platform Includes - <windows.h> and <crtdbg.h> are the ones in
+// linux/, which stand in for the Win32 and debug heap calls used
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include <crtdbg.h>
+
+#define __int64 long long
+
+// The bounds checked C runtime functions used
+#define sprintf_s snprintf
+#define strcpy_s(dest, size, src) ((void)strncpy((dest), (src), (size)), (dest)[(size) - 1] = '\0', 0)
+#define fopen_s(file_p, name, mode) ((*(file_p) = fopen((name), (mode))) == NULL ? errno : 0)
+
+// Debug Printf (output goes to stderr, when DEBUG is set)
+#define dbgprintf(message,...) { if ( DEBUG ) \
+	fprintf(stderr, message, ##__VA_ARGS__); }
+
+// Debug Printf with Location (output goes to stderr, when DEBUG is
+//  set, includes line number and file name)
+#define dbglocprintf(message,...) { if ( DEBUG ) { \
+	fprintf(stderr, "file: %s, line: %d\t",__FILE__,__LINE__); \
+	fprintf(stderr, message, ##__VA_ARGS__); } }
+
+
+/* Macro to clean up the code for waiting on mutexes */
+#define WaitOnObject(mutex)\
+  if (WaitForSingleObject(mutex, INFINITE) != WAIT_OBJECT_0) {\
+      printf("Error: code %d.\n", errno);\
+      exit(1);\
+  }
+
+#define AbortOnCondition(cond,message) \
+ if (cond) {\
+    printf("Abort: %s:%d %d, MSG:%s\n", __FILE__, __LINE__, errno, message);\
+    exit(1);\
+ }
+
+#define AbortOnError(fctcall) \
+   if (fctcall == 0) {\
+      printf("Error: file %s line %d: code %d.\n", __FILE__, __LINE__, errno);\
+      exit(1);\
+   }
+
 #else /* Windows NT definitions */
 #include <time.h>
 #include <assert.h>
@@ -15,13 +15,15 @@
 #define _WIN32_WINNT 0x0400
 #include <windows.h>
 #include <winsock.h>
+#include <mmsystem.h>  /* timeBeginPeriod, for tickless mode */
+#pragma comment(lib, "winmm.lib")
 
 #include <stdio.h>
 #include <setjmp.h>
 
 #include "defs.h"
 #include "interrupts_private.h"
-#include "machineprimitives.h"
+#include "machineprimitives_ext.h"
 
 #ifdef WINCE
 #define EIP context.Pc
@@ -42,6 +44,16 @@ char clock_enabled;
 
 static HANDLE clock_poll_done = NULL;
 
+/* the timer the clock thread waits on */
+static HANDLE clock_timer = NULL;
+
+/* set to end an interrupt_wait, by any interrupt but a clock tick */
+static HANDLE idle_event = NULL;
+
+/* the number of interrupts waiting for the system thread to be
+   interruptible, while which it must not block */
+static volatile LONG interrupts_deferred = 0;
+
 typedef struct signal_queue_t signal_queue_t;
 struct signal_queue_t {
   HANDLE threadid;
@@ -70,6 +82,23 @@ static HANDLE mutex = NULL;
  */
 interrupt_level_t interrupt_level;
 
+/*
+ * With more than one worker thread running minithreads, the interrupt
+ * level also serves as a kernel lock: disabling interrupts on any worker
+ * takes the lock, enabling them releases it, and a worker's level is
+ * simply whether it holds the lock. The lock itself belongs to
+ * minithread.c. The context switch writes interrupt_level from every
+ * worker, so the system thread's own level is kept separately in
+ * system_level.
+ */
+extern int minithread_kernel_locking(void);
+extern void minithread_kernel_lock(void);
+extern void minithread_kernel_unlock(void);
+extern unsigned long minithread_kernel_lock_holder(void);
+
+static DWORD system_thread_id = 0;
+static interrupt_level_t system_level = ENABLED;
+
 typedef struct interrupt_queue_t interrupt_queue_t;
 struct interrupt_queue_t {
   int type; 
@@ -116,8 +145,42 @@ static int readytoreturn = 0;
 #pragma warning(disable:4996)
 
 interrupt_level_t set_interrupt_level(interrupt_level_t newlevel) {
+	DWORD me;
+	interrupt_level_t oldlevel;
+
 	//dbgprintf("Set interrupt level to %d.\n", newlevel);
-	return swap(&interrupt_level, newlevel);
+	if (!minithread_kernel_locking())
+		return swap(&interrupt_level, newlevel);
+
+	me = GetCurrentThreadId();
+	oldlevel = (minithread_kernel_lock_holder() == me) ? DISABLED : ENABLED;
+
+	/* mask interrupts before waiting for the lock, so that a handler
+	   on the system thread never waits for a lock its own thread holds */
+	if (me == system_thread_id && newlevel == DISABLED) {
+		system_level = DISABLED;
+		interrupt_level = DISABLED;
+	}
+
+	if (oldlevel == ENABLED && newlevel == DISABLED) {
+		minithread_kernel_lock();
+	} else if (oldlevel == DISABLED && newlevel == ENABLED) {
+		minithread_kernel_unlock();
+	}
+
+	if (me == system_thread_id && newlevel == ENABLED) {
+		system_level = ENABLED;
+		interrupt_level = ENABLED;
+	}
+
+	return oldlevel;
+}
+
+/* can the system thread take an interrupt right now? */
+static int system_thread_interruptible(void) {
+	if (minithread_kernel_locking())
+		return system_level == ENABLED && minithread_kernel_lock_holder() != system_thread_id;
+	return interrupt_level == ENABLED;
 }
 
 unsigned int loopforever_start(void) {
@@ -188,8 +251,16 @@ void __fastcall receive_interrupt(CONTEXT* context, int type, void* arg) {
   } else {
     /* now, call the appropriate interrupt handler */
     //dbgprintf("SYS:interrupt of type %d.\n", type);
-    if (interrupt_info->handler != NULL)
+    if (interrupt_info->handler != NULL) {
+      interrupt_level_t oldlevel = DISABLED;
+
+      /* with several workers the handler must hold the kernel lock */
+      if (minithread_kernel_locking())
+        oldlevel = set_interrupt_level(DISABLED);
       interrupt_info->handler(arg); 
+      if (minithread_kernel_locking())
+        set_interrupt_level(oldlevel);
+    }
   }
   
   WaitOnObject(mutex);
@@ -206,6 +277,7 @@ void __fastcall receive_interrupt(CONTEXT* context, int type, void* arg) {
     //dbgprintf("SYS:disabling interrupts in handler.\n");
     interrupt_level = DISABLED;
   }  
+  system_level = DISABLED;
   ReleaseMutex(mutex);
 
   /* 
@@ -281,6 +353,7 @@ DWORD WINAPI interrupt_return_assist(LPVOID ptr) {
 	  if (DEBUG)
 	    kprintf("IRA:enabling interrupts.\n");
 	  interrupt_level = ENABLED;
+	  system_level = ENABLED;
 
 	  AbortOnError(SetThreadContext(sq->threadid, sq->context));
 
@@ -323,6 +396,7 @@ void send_interrupt(int type, void* arg) {
   CONTEXT context;
   int safe_to_proceed = 0;
   int drop_interrupt = 0;
+  int deferred = 0;
   interrupt_queue_t* interrupt_info = NULL;
 
   for (;;) {
@@ -366,7 +440,7 @@ void send_interrupt(int type, void* arg) {
        */
       switch (interrupt_info->property){
       case INTERRUPT_DROP:
-	if (interrupt_level == DISABLED
+	if (!system_thread_interruptible()
 	    || (EIP < start_address)
 	    || (EIP > end_address)) {
 	  drop_interrupt = 1;
@@ -377,10 +451,11 @@ void send_interrupt(int type, void* arg) {
 	}
 	break;
       case INTERRUPT_DEFER:
-	if (interrupt_level == ENABLED 
+	if (system_thread_interruptible() 
 	    && (EIP >= start_address)
 	    && (EIP <= end_address)) {
 	  interrupt_level = DISABLED;
+	  system_level = DISABLED;
 	  safe_to_proceed = 1;
 	}
 	break;
@@ -410,10 +485,22 @@ void send_interrupt(int type, void* arg) {
 
     if (drop_interrupt == 1)
       return;
-    else
+    else {
+      /* if the system thread is blocked idle, outside minithread
+	 code, wake it so that it can take the interrupt - and keep
+	 it from blocking again until it has */
+      if (!deferred) {
+	deferred = 1;
+	InterlockedIncrement(&interrupts_deferred);
+      }
+      interrupt_wake();
       SwitchToThread();
+    }
   }
 
+  if (deferred)
+    InterlockedDecrement(&interrupts_deferred);
+
   /* now fix the system thread's stack so it runs run_user_handler */
   {
     int stack;
@@ -471,24 +558,23 @@ DWORD WINAPI clock_poll(LPVOID arg) {
   Sleep(PERIOD/1000); /* sleep requires time in milliseconds */
   send_interrupt(CLOCK_INTERRUPT_TYPE, NULL);
 #else
+#if !CLOCK_TICKLESS
   LARGE_INTEGER i;
-  HANDLE timer; 
+#endif
   /* HANDLE thread = GetCurrentThread(); */
-  char name[32];
-
-  sprintf(name, "timer %d", pid);
-  timer = CreateWaitableTimer(NULL, TRUE, name);
-  assert(timer != NULL);
 
   WaitOnObject(clock_poll_done);
   while (clock_enabled) {
+#if !CLOCK_TICKLESS
     i.QuadPart = -PERIOD*10; /* NT timer values are in hundreds of nanoseconds */
-    AbortOnError(SetWaitableTimer(timer, &i, 0, NULL, NULL, FALSE));
+    AbortOnError(SetWaitableTimer(clock_timer, &i, 0, NULL, NULL, FALSE));
+#endif
+    /* when tickless, the timer is only set by minithread_clock_set_deadline */
 
-    if (WaitForSingleObject(timer, INFINITE) == WAIT_OBJECT_0) {
+    if (WaitForSingleObject(clock_timer, INFINITE) == WAIT_OBJECT_0) {
       //if (DEBUG)
 	//kprintf("CLK: clock tick.\n");
-	  ticks++;
+	  InterlockedIncrement(&ticks);
 	  clock_enabled ? send_interrupt(CLOCK_INTERRUPT_TYPE, NULL): clock_enabled;
     }
   }
@@ -554,9 +640,26 @@ void minithread_clock_init(interrupt_handler_t clock_handler)
   sprintf(name, "clock poll mutex %d", pid);
   clock_poll_done = CreateMutex(NULL, FALSE, name);
 
+  /* auto-reset, so each wake ends one wait */
+  idle_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+  /* manual-reset when periodic, as it is set again for every tick;
+     auto-reset when tickless, so it fires once per deadline */
+  sprintf(name, "timer %d", pid);
+  clock_timer = CreateWaitableTimer(NULL, CLOCK_TICKLESS ? FALSE : TRUE, name);
+  assert(clock_timer != NULL);
+#if CLOCK_TICKLESS
+  /* the default timer resolution is about 15ms */
+  timeBeginPeriod(1);
+#endif
+
   interrupt_level = DISABLED;
+  system_level = DISABLED;
+  system_thread_id = GetCurrentThreadId();
 
-  register_interrupt(CLOCK_INTERRUPT_TYPE, clock_handler, INTERRUPT_DROP);
+  /* a tickless clock interrupt is not repeated, so it must not be lost */
+  register_interrupt(CLOCK_INTERRUPT_TYPE, clock_handler, 
+		     CLOCK_TICKLESS ? INTERRUPT_DEFER : INTERRUPT_DROP);
 
 #ifndef WINCE
   /* overcome an NT "feature" -- GetCurrentThread() returns a "pseudohandle" to
@@ -584,15 +687,66 @@ void minithread_clock_init(interrupt_handler_t clock_handler)
  */
 void minithread_clock_stop(void) {
 	interrupt_level = DISABLED;
+	system_level = DISABLED;
 	clock_enabled = 0;
 
+#if CLOCK_TICKLESS
+	/* the clock thread may be waiting for no deadline */
+	minithread_clock_set_deadline(0);
+#endif
+
 	WaitOnObject(clock_poll_done);
 
 	ReleaseMutex(clock_poll_done);
 
+#if CLOCK_TICKLESS
+	timeEndPeriod(1);
+#endif
+	CloseHandle(clock_timer);
+	clock_timer = NULL;
+	CloseHandle(idle_event);
+	idle_event = NULL;
+
 	deregister_interrupt(CLOCK_INTERRUPT_TYPE);
 }
 
+/*
+ * block the system thread until woken by an interrupt or the clock
+ */
+void interrupt_wait(__int64 deadline) {
+	__int64 now = currentTimeNanos();
+	DWORD timeout = INFINITE;
+
+	if (interrupts_deferred || (deadline != -1 && deadline <= now))
+		return;
+	if (deadline != -1) {
+		/* round up, so as not to wake just before the deadline */
+		timeout = (DWORD)((deadline - now + 999999) / 1000000);
+	}
+	WaitForSingleObject(idle_event, timeout);
+}
+
+void minithread_clock_set_deadline(__int64 deadline) {
+#if CLOCK_TICKLESS
+	LARGE_INTEGER due;
+	__int64 now;
+
+	if (deadline == -1) {
+		CancelWaitableTimer(clock_timer);
+		return;
+	}
+	/* relative, in hundreds of nanoseconds - at least one */
+	now = currentTimeNanos();
+	due.QuadPart = deadline > now ? -((deadline - now + 99) / 100) : -1;
+	AbortOnError(SetWaitableTimer(clock_timer, &due, 0, NULL, NULL, FALSE));
+#endif
+}
+
+void interrupt_wake(void) {
+	if (idle_event != NULL)
+		SetEvent(idle_event);
+}
+
 int register_interrupt(int type, interrupt_handler_t handler, 
 		       interrupt_property_t property){
   interrupt_queue_t* new_interrupt, *interrupt_info;
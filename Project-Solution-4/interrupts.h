@@ -32,7 +32,15 @@
 #define PERIOD (100*MILLISECOND)
 #endif
 
-/* a global variable to maintain time */
+/*
+ * CLOCK_TICKLESS selects the clock mode. in periodic mode (0) the clock
+ * interrupts every PERIOD. in tickless mode (1) it interrupts only once
+ * the deadline last set with minithread_clock_set_deadline has passed,
+ * to within the resolution of the OS timers (a millisecond or better).
+ */
+#define CLOCK_TICKLESS (0)
+
+/* a global variable to maintain time - the number of clock interrupts */
 extern long ticks;
 
 typedef void (*interrupt_handler_t)(void* );
@@ -95,4 +103,13 @@ extern void minithread_clock_init(interrupt_handler_t clock_handler);
  */
 extern void minithread_clock_stop(void);
 
+/*
+ * in tickless mode, set the time (from currentTimeNanos) at which the
+ * clock next interrupts, replacing any deadline set before - or cancel
+ * it, with -1. a deadline already passed interrupts at once. an
+ * interrupt which cannot be taken when it is due is retried until it is.
+ * in periodic mode this does nothing. may be called from any thread.
+ */
+extern void minithread_clock_set_deadline(__int64 deadline);
+
 #endif  __INTERRUPTS_H__
@@ -0,0 +1,490 @@
+/*   
+ * Linux implementation of the virtual interrupts, and of the 
+ * virtual clock device - the same interface as interrupts.c.
+ *
+ * Interrupts are signals sent to the system thread: the clock is
+ * a POSIX timer raising SIGALRM there every PERIOD, and send_interrupt
+ * raises SIGIO. A signal handler runs on the interrupted minithread's
+ * own stack, just as a real interrupt would, so the minithread handler
+ * can switch away and, when switched back to, simply return through
+ * the signal frame. There is no need for a return assist thread or
+ * for rewriting the system thread's context.
+ *
+ * Link this, and machineprimitives_x86_64.c, outside of start() and
+ * end(), as with interrupts.c.
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+#include "defs.h"
+#include "interrupts_private.h"
+#include "machineprimitives_ext.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define CLOCK_SIGNAL SIGALRM
+#define SEND_SIGNAL SIGIO
+
+/* how long (nanoseconds) send_interrupt waits before signalling again,
+   and a tickless clock waits before retrying an interrupt */
+#define SEND_RETRY (50 * 1000)
+
+/* a global variable to maintain time */
+long ticks;
+
+char clock_enabled;
+
+/*
+ * Virtual processor interrupt level (spl). 
+ * Are interrupts enabled? A new interrupt will only be taken when interrupts
+ * are enabled.
+ */
+interrupt_level_t interrupt_level;
+
+/*
+ * As in interrupts.c: with more than one worker thread running
+ * minithreads, disabling interrupts also takes the kernel lock of
+ * minithread.c, and the system thread's own level is kept separately
+ * in system_level.
+ */
+extern int minithread_kernel_locking(void);
+extern void minithread_kernel_lock(void);
+extern void minithread_kernel_unlock(void);
+extern unsigned long minithread_kernel_lock_holder(void);
+
+static DWORD system_thread_id = 0;
+static interrupt_level_t system_level = ENABLED;
+
+typedef struct interrupt_queue_t interrupt_queue_t;
+struct interrupt_queue_t {
+  int type; 
+  interrupt_handler_t handler;
+  interrupt_property_t property;
+  interrupt_queue_t* next;
+};
+
+/*
+ * an interrupt sent from another thread, waiting to be taken. it
+ * lives on the sender's stack, and the sender waits until done.
+ */
+typedef struct pending_interrupt_t pending_interrupt_t;
+struct pending_interrupt_t {
+  int type;
+  void* arg;
+  volatile int done;
+  pending_interrupt_t* next;
+};
+
+/* interrupts sent but not yet taken, most recent first */
+static pending_interrupt_t* volatile pending = NULL;
+
+/* 
+ * we only preempt if the minithread which is running is at an address
+ * between start() and end(), which enclose all the minithread and
+ * user-supplied code. In this way we protect the C library, which is
+ * not "minithread-safe".
+ */
+extern unsigned int start(void);
+extern unsigned int end(void);
+
+/* Code outside these addresses belongs to the operating system */
+static unsigned long start_address;
+static unsigned long end_address;
+
+static pthread_t system_thread;  /* thread running the minithreads */
+static timer_t clock_timer;
+
+/* written to end an interrupt_wait, by any interrupt but a clock tick */
+static int idle_event = -1;
+
+static interrupt_queue_t* interrupt_queue = NULL;
+
+
+interrupt_level_t set_interrupt_level(interrupt_level_t newlevel) {
+  DWORD me;
+  interrupt_level_t oldlevel;
+
+  if (!minithread_kernel_locking())
+    return swap(&interrupt_level, newlevel);
+
+  me = GetCurrentThreadId();
+  oldlevel = (minithread_kernel_lock_holder() == me) ? DISABLED : ENABLED;
+
+  /* mask interrupts before waiting for the lock, so that a handler
+     on the system thread never waits for a lock its own thread holds */
+  if (me == system_thread_id && newlevel == DISABLED) {
+    system_level = DISABLED;
+    interrupt_level = DISABLED;
+  }
+
+  if (oldlevel == ENABLED && newlevel == DISABLED) {
+    minithread_kernel_lock();
+  } else if (oldlevel == DISABLED && newlevel == ENABLED) {
+    minithread_kernel_unlock();
+  }
+
+  if (me == system_thread_id && newlevel == ENABLED) {
+    system_level = ENABLED;
+    interrupt_level = ENABLED;
+  }
+
+  return oldlevel;
+}
+
+/* can the system thread take an interrupt right now? */
+static int system_thread_interruptible(void) {
+  if (minithread_kernel_locking())
+    return system_level == ENABLED && minithread_kernel_lock_holder() != system_thread_id;
+  return interrupt_level == ENABLED;
+}
+
+void loopforever() {
+  for(;;)
+    ;
+  /* NOT REACHED */
+  exit(1);
+}
+
+static interrupt_queue_t* find_interrupt(int type) {
+  interrupt_queue_t* interrupt_info = interrupt_queue;
+  while (interrupt_info!=NULL && interrupt_info->type!=type)
+    interrupt_info = interrupt_info->next;
+
+  if (interrupt_info == NULL) {
+    /* we couldn't find the interrupt with type "type" so we crash the
+       system.
+    */
+    kprintf("INT ERR: An interrupt of the unregistered type %d was received. Crashing.\n",
+	    type);
+    exit(-1);
+  }
+  return interrupt_info;
+}
+
+/* run the user's supplied interrupt handler, with interrupts disabled;
+   they are enabled again on return, since they must have been enabled
+   for the interrupt to be taken.
+   */
+static void take_interrupt(interrupt_queue_t* interrupt_info, void* arg) {
+  interrupt_level_t oldlevel = DISABLED;
+
+  interrupt_level = DISABLED;
+  system_level = DISABLED;
+
+  /* with several workers the handler must hold the kernel lock */
+  if (minithread_kernel_locking())
+    oldlevel = set_interrupt_level(DISABLED);
+  if (interrupt_info->handler != NULL)
+    interrupt_info->handler(arg);
+  if (minithread_kernel_locking())
+    set_interrupt_level(oldlevel);
+
+  system_level = ENABLED;
+  interrupt_level = ENABLED;
+}
+
+/* take (or drop) the interrupts other threads have sent. ones
+   which have to be deferred go back on the pending list. */
+static void take_pending(int safe) {
+  pending_interrupt_t *list, *next, *sent = NULL;
+  interrupt_queue_t* interrupt_info;
+
+  /* take the whole list, and put it in the order it was sent */
+  list = __sync_lock_test_and_set(&pending, NULL);
+  while (list != NULL) {
+    next = list->next;
+    list->next = sent;
+    sent = list;
+    list = next;
+  }
+
+  while (sent != NULL) {
+    next = sent->next;
+    interrupt_info = find_interrupt(sent->type);
+    if (safe) {
+      take_interrupt(interrupt_info, sent->arg);
+      __sync_synchronize();
+      sent->done = 1;
+    } else if (interrupt_info->property == INTERRUPT_DROP) {
+      sent->done = 1;
+    } else {
+      /* defer - and if the system thread is blocked idle, outside
+	 minithread code, wake it so that it can take the interrupt */
+      interrupt_wake();
+      do {
+	sent->next = pending;
+      } while (!__sync_bool_compare_and_swap(&pending, sent->next, sent));
+    }
+    sent = next;
+  }
+}
+
+/* the signal handler, for both clock ticks and sent interrupts. it
+   only goes on to the user's handlers if interrupts are enabled and
+   the system thread was interrupted in minithread code - otherwise
+   the clock tick is dropped (or retried shortly, when tickless) and
+   sent interrupts are deferred.
+   */
+static void receive_signal(int sig, siginfo_t* info, void* context) {
+  ucontext_t* uc = (ucontext_t*) context;
+  unsigned long pc = (unsigned long) uc->uc_mcontext.gregs[REG_RIP];
+  int saved_errno = errno;
+  int safe;
+
+  safe = system_thread_interruptible() 
+    && pc >= start_address 
+    && pc <= end_address;
+
+  if (sig == CLOCK_SIGNAL) {
+    __sync_fetch_and_add(&ticks, 1 + timer_getoverrun(clock_timer));
+    if (safe && clock_enabled) {
+      take_interrupt(find_interrupt(CLOCK_INTERRUPT_TYPE), NULL);
+    } else if (CLOCK_TICKLESS && clock_enabled) {
+      struct itimerspec retry;
+      memset(&retry, 0, sizeof(retry));
+      retry.it_value.tv_nsec = SEND_RETRY;
+      timer_settime(clock_timer, 0, &retry, NULL);
+    }
+  }
+
+  if (pending != NULL)
+    take_pending(safe);
+
+  errno = saved_errno;
+}
+
+/* 
+ * Send an interrupt to the system thread, to call the appropriate
+ * interrupt handler with the specified argument. this waits until the
+ * interrupt has been taken (or dropped): clock interrupts are dropped
+ * and network interrupts deferred while interrupts are disabled or the
+ * system thread is in a non-preemptable state. must not be called
+ * from the system thread.
+*/
+void send_interrupt(int type, void* arg) {
+  pending_interrupt_t sent;
+  struct timespec retry;
+
+  retry.tv_sec = 0;
+  retry.tv_nsec = SEND_RETRY;
+
+  sent.type = type;
+  sent.arg = arg;
+  sent.done = 0;
+  do {
+    sent.next = pending;
+  } while (!__sync_bool_compare_and_swap(&pending, sent.next, &sent));
+
+  while (!sent.done) {
+    pthread_kill(system_thread, SEND_SIGNAL);
+    if (!sent.done)
+      nanosleep(&retry, NULL);
+  }
+}
+
+/*
+ * Setup the interval timer and install user interrupt handler.  After this
+ * routine is called, and after you call set_interrupt_level(ENABLED), clock
+ * interrupts will begin to be sent.  They will call the handler
+ * function h specified by the caller.
+ */
+void minithread_clock_init(interrupt_handler_t clock_handler)
+{
+  struct sigaction action;
+  struct sigevent event;
+  struct itimerspec period;
+
+  if (clock_handler == NULL) {
+    kprintf("INT ERR: Must provide an interrupt handler, interrupts not started.\n");
+    return;
+  }
+
+  dbgprintf("Starting clock interrupts...\n");
+
+  clock_enabled = 1;
+  ticks = 0;
+
+  /* set values for start_address and end_address */
+  start_address = (unsigned long) start;
+  end_address = (unsigned long) end;
+
+  interrupt_level = DISABLED;
+  system_level = DISABLED;
+  system_thread = pthread_self();
+  system_thread_id = GetCurrentThreadId();
+
+  register_interrupt(CLOCK_INTERRUPT_TYPE, clock_handler, INTERRUPT_DROP);
+
+  /* reading it resets it, so each wake ends one wait */
+  idle_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  AbortOnCondition(idle_event == -1, "eventfd");
+
+  /* handlers may switch away and not return for some time, so the
+     signals must not stay blocked while they run - interrupt_level
+     keeps them from nesting */
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = receive_signal;
+  action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  AbortOnCondition(sigaction(CLOCK_SIGNAL, &action, NULL) != 0, "sigaction");
+  AbortOnCondition(sigaction(SEND_SIGNAL, &action, NULL) != 0, "sigaction");
+
+  /* ticks go to the system thread alone */
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = CLOCK_SIGNAL;
+  event.sigev_notify_thread_id = system_thread_id;
+  AbortOnCondition(timer_create(CLOCK_MONOTONIC, &event, &clock_timer) != 0, "timer_create");
+
+  /* when tickless, the timer is only set by minithread_clock_set_deadline */
+  if (CLOCK_TICKLESS)
+    return;
+
+  period.it_value.tv_sec = PERIOD / SECOND;
+  period.it_value.tv_nsec = (PERIOD % SECOND) * 1000;
+  period.it_interval = period.it_value;
+  AbortOnCondition(timer_settime(clock_timer, 0, &period, NULL) != 0, "timer_settime");
+}
+
+/*
+ * stops clock interrupts and cleans up after it
+ */
+void minithread_clock_stop(void) {
+	interrupt_level = DISABLED;
+	system_level = DISABLED;
+	clock_enabled = 0;
+
+	timer_delete(clock_timer);
+	close(idle_event);
+	idle_event = -1;
+
+	dbgprintf("...clock interrupts stopped.\n");
+
+	deregister_interrupt(CLOCK_INTERRUPT_TYPE);
+}
+
+void minithread_clock_set_deadline(__int64 deadline) {
+  struct itimerspec at;
+
+  if (!CLOCK_TICKLESS)
+    return;
+
+  /* all zero disarms the timer; an absolute time already passed
+     fires it at once */
+  memset(&at, 0, sizeof(at));
+  if (deadline != -1) {
+    at.it_value.tv_sec = deadline / 1000000000;
+    at.it_value.tv_nsec = deadline % 1000000000;
+    if (deadline == 0)
+      at.it_value.tv_nsec = 1;
+  }
+  timer_settime(clock_timer, TIMER_ABSTIME, &at, NULL);
+}
+
+/*
+ * block the system thread until woken by an interrupt, or the deadline
+ */
+void interrupt_wait(__int64 deadline) {
+  unsigned long long count;
+  struct pollfd idle_poll;
+  struct timespec timeout;
+  __int64 now;
+
+  idle_poll.fd = idle_event;
+  idle_poll.events = POLLIN;
+
+  /* with interrupts waiting to be taken, return to minithread code
+     where they can be - a deferral also wakes a wait in progress.
+     other signals end the poll, so check again after each */
+  while (pending == NULL) {
+    now = currentTimeNanos();
+    if (deadline != -1 && deadline <= now)
+      return;
+    timeout.tv_sec = (deadline - now) / 1000000000;
+    timeout.tv_nsec = (deadline - now) % 1000000000;
+    if (ppoll(&idle_poll, 1, deadline == -1 ? NULL : &timeout, NULL) >= 0)
+      break;
+  }
+  (void)!read(idle_event, &count, sizeof(count));
+}
+
+/* safe in a signal handler */
+void interrupt_wake(void) {
+  unsigned long long one = 1;
+  if (idle_event != -1)
+    (void)!write(idle_event, &one, sizeof(one));
+}
+
+int register_interrupt(int type, interrupt_handler_t handler, 
+		       interrupt_property_t property){
+  interrupt_queue_t* new_interrupt, *interrupt_info;
+  int error=0;
+  interrupt_level_t old_interrupt_level;
+
+  /* disable interrupts not to have surprises */
+  old_interrupt_level = set_interrupt_level(DISABLED);
+  
+  /* look for an interrupt of the desired type */
+  interrupt_info = interrupt_queue;
+  while (interrupt_info!=NULL && interrupt_info->type!=type)
+    interrupt_info = interrupt_info->next;
+  
+  if (interrupt_info != NULL) {
+    /* interrupt already exists, return error */
+    error=-1;
+	kprintf("INT ERR: An interrupt of this type already registered.\n");
+  } else {
+    new_interrupt = (interrupt_queue_t*) malloc(sizeof(interrupt_queue_t));
+    new_interrupt->type = type;
+    new_interrupt->handler = handler;
+    new_interrupt->property = property;
+
+    /* insert it in the queue */
+    new_interrupt->next = interrupt_queue;
+    interrupt_queue = new_interrupt;
+  }
+
+  /* put interrupts in their previous state */
+  (void)set_interrupt_level(old_interrupt_level);
+
+  return error;
+}
+
+
+int deregister_interrupt(int type) {
+	int ret = 0;
+	interrupt_queue_t *prev = NULL;
+	interrupt_queue_t *interrupt_info = interrupt_queue;
+	/* disable interrupts */
+	interrupt_level_t old_interrupt_level = set_interrupt_level(DISABLED);
+
+	/* look for an interrupt of the desired type */
+	while ( (interrupt_info != NULL) && (interrupt_info->type != type) ) {
+		prev = interrupt_info;
+		interrupt_info = interrupt_info->next;
+	}
+
+	if (interrupt_info != NULL) {
+		/* interrupt found, delete */
+		if ( prev ) {
+			prev->next = interrupt_info->next;
+		} else {
+			interrupt_queue = interrupt_info->next;
+		}
+		free(interrupt_info);
+	} else {
+		/* interrupt not registered, error */
+		ret = -1;
+	}
+	
+	set_interrupt_level(old_interrupt_level);
+	return ret;
+}
@@ -51,5 +51,16 @@ int register_interrupt(int type, interrupt_handler_t handler,
  */
 int deregister_interrupt(int type);
 
+/* block the system thread, rather than spinning, until an interrupt
+ * other than a clock tick is sent, until currentTimeNanos reaches
+ * deadline (-1 for no limit), or until interrupt_wake is called. for
+ * the idle thread, with interrupts enabled: an interrupt sent meanwhile
+ * is taken once it returns. it may also return early.
+ */
+void interrupt_wait(__int64 deadline);
+
+/* end an interrupt_wait - callable from any thread */
+void interrupt_wake(void);
+
 
 #endif  __INTERRUPTS_H_
@@ -0,0 +1,10 @@
+/*
+ * The debug heap of the Microsoft C runtime, for building the
+ * minisystem on Linux, which has none - leaks are left to valgrind.
+ */
+#ifndef __LINUX_CRTDBG_H_
+#define __LINUX_CRTDBG_H_
+
+#define _CrtDumpMemoryLeaks() (0)
+
+#endif __LINUX_CRTDBG_H_
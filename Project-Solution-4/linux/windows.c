@@ -0,0 +1,308 @@
+/*
+ * The Win32 calls of windows.h, on POSIX threads.
+ *
+ * Every handle is a struct win_handle, holding a thread, an event or
+ * a mutex. Events and mutexes are a pthread mutex and condition, so
+ * that they may be waited on with a timeout, and a mutex keeps its
+ * owner and count itself, as Win32 mutexes are recursive. A mutex
+ * still held by a thread as it exits is released, as Windows abandons
+ * it, so a wait for it then succeeds.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "windows.h"
+
+enum win_handle_type {
+	WIN_THREAD,
+	WIN_EVENT,
+	WIN_MUTEX
+};
+
+struct win_handle {
+	enum win_handle_type type;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+
+	/* threads */
+	pthread_t thread;
+	LPTHREAD_START_ROUTINE proc;
+	LPVOID arg;
+	int exited;
+	int joined;
+	int closed;  /* the handle was closed while it ran */
+
+	/* events */
+	int manual_reset;
+	int set;
+
+	/* mutexes */
+	DWORD owner;
+	int count;
+	struct win_handle *next_mutex;
+};
+
+static __thread DWORD my_thread_id = 0;
+
+/* every mutex, so those held by an exiting thread can be released */
+static struct win_handle *mutexes = NULL;
+static pthread_mutex_t mutexes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static struct win_handle *win_handle_new(enum win_handle_type type) {
+	struct win_handle *handle = (struct win_handle *) calloc(1, sizeof(struct win_handle));
+	if ( handle == NULL ) {
+		return NULL;
+	}
+	handle->type = type;
+	pthread_mutex_init(&handle->lock, NULL);
+	pthread_cond_init(&handle->changed, NULL);
+	return handle;
+}
+
+static void win_handle_free(struct win_handle *handle) {
+	struct win_handle **link;
+	if ( handle->type == WIN_MUTEX ) {
+		pthread_mutex_lock(&mutexes_lock);
+		for ( link = &mutexes; *link != handle; link = &(*link)->next_mutex ) {
+		}
+		*link = handle->next_mutex;
+		pthread_mutex_unlock(&mutexes_lock);
+	}
+	pthread_cond_destroy(&handle->changed);
+	pthread_mutex_destroy(&handle->lock);
+	free(handle);
+}
+
+/* release the mutexes the calling thread holds, as it exits */
+static void win_mutexes_abandon(void) {
+	struct win_handle *mutex;
+	DWORD me = GetCurrentThreadId();
+	pthread_mutex_lock(&mutexes_lock);
+	for ( mutex = mutexes; mutex != NULL; mutex = mutex->next_mutex ) {
+		pthread_mutex_lock(&mutex->lock);
+		if ( mutex->count > 0 && mutex->owner == me ) {
+			mutex->count = 0;
+			mutex->owner = 0;
+			pthread_cond_signal(&mutex->changed);
+		}
+		pthread_mutex_unlock(&mutex->lock);
+	}
+	pthread_mutex_unlock(&mutexes_lock);
+}
+
+static void *win_thread_start(void *arg) {
+	struct win_handle *handle = (struct win_handle *) arg;
+	int closed;
+
+	handle->proc(handle->arg);
+	win_mutexes_abandon();
+
+	pthread_mutex_lock(&handle->lock);
+	handle->exited = 1;
+	closed = handle->closed;
+	pthread_cond_broadcast(&handle->changed);
+	pthread_mutex_unlock(&handle->lock);
+
+	/* nothing else refers to the handle once it is closed */
+	if ( closed ) {
+		win_handle_free(handle);
+	}
+	return NULL;
+}
+
+HANDLE CreateThread(void *security, size_t stack_size, LPTHREAD_START_ROUTINE proc,
+		    LPVOID arg, DWORD flags, DWORD *id) {
+	struct win_handle *handle = win_handle_new(WIN_THREAD);
+	if ( handle == NULL ) {
+		return NULL;
+	}
+	handle->proc = proc;
+	handle->arg = arg;
+	if ( pthread_create(&handle->thread, NULL, win_thread_start, handle) != 0 ) {
+		win_handle_free(handle);
+		return NULL;
+	}
+	if ( id != NULL ) {
+		*id = (DWORD) handle->thread;
+	}
+	return handle;
+}
+
+DWORD GetCurrentThreadId(void) {
+	if ( my_thread_id == 0 ) {
+		my_thread_id = (DWORD) syscall(SYS_gettid);
+	}
+	return my_thread_id;
+}
+
+DWORD GetCurrentProcessId(void) {
+	return (DWORD) getpid();
+}
+
+BOOL SwitchToThread(void) {
+	return sched_yield() == 0;
+}
+
+void Sleep(DWORD milliseconds) {
+	struct timespec delay;
+	delay.tv_sec = milliseconds / 1000;
+	delay.tv_nsec = (milliseconds % 1000) * 1000000;
+	while ( nanosleep(&delay, &delay) != 0 && errno == EINTR ) {
+	}
+}
+
+HANDLE CreateEvent(void *security, BOOL manual_reset, BOOL initial_state, const char *name) {
+	struct win_handle *handle = win_handle_new(WIN_EVENT);
+	if ( handle == NULL ) {
+		return NULL;
+	}
+	handle->manual_reset = manual_reset;
+	handle->set = initial_state;
+	return handle;
+}
+
+BOOL SetEvent(HANDLE event) {
+	struct win_handle *handle = (struct win_handle *) event;
+	pthread_mutex_lock(&handle->lock);
+	handle->set = 1;
+	if ( handle->manual_reset ) {
+		pthread_cond_broadcast(&handle->changed);
+	} else {
+		pthread_cond_signal(&handle->changed);
+	}
+	pthread_mutex_unlock(&handle->lock);
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE event) {
+	struct win_handle *handle = (struct win_handle *) event;
+	pthread_mutex_lock(&handle->lock);
+	handle->set = 0;
+	pthread_mutex_unlock(&handle->lock);
+	return TRUE;
+}
+
+HANDLE CreateMutex(void *security, BOOL initial_owner, const char *name) {
+	struct win_handle *handle = win_handle_new(WIN_MUTEX);
+	if ( handle == NULL ) {
+		return NULL;
+	}
+	if ( initial_owner ) {
+		handle->owner = GetCurrentThreadId();
+		handle->count = 1;
+	}
+	pthread_mutex_lock(&mutexes_lock);
+	handle->next_mutex = mutexes;
+	mutexes = handle;
+	pthread_mutex_unlock(&mutexes_lock);
+	return handle;
+}
+
+BOOL ReleaseMutex(HANDLE mutex) {
+	struct win_handle *handle = (struct win_handle *) mutex;
+	BOOL released = FALSE;
+	pthread_mutex_lock(&handle->lock);
+	if ( handle->count > 0 && handle->owner == GetCurrentThreadId() ) {
+		if ( --handle->count == 0 ) {
+			handle->owner = 0;
+			pthread_cond_signal(&handle->changed);
+		}
+		released = TRUE;
+	}
+	pthread_mutex_unlock(&handle->lock);
+	return released;
+}
+
+/* can the caller take the handle now? if so, take it */
+static int win_handle_take(struct win_handle *handle) {
+	switch ( handle->type ) {
+	case WIN_THREAD:
+		return handle->exited;
+	case WIN_EVENT:
+		if ( !handle->set ) {
+			return 0;
+		}
+		if ( !handle->manual_reset ) {
+			handle->set = 0;
+		}
+		return 1;
+	case WIN_MUTEX:
+		if ( handle->count > 0 && handle->owner != GetCurrentThreadId() ) {
+			return 0;
+		}
+		handle->owner = GetCurrentThreadId();
+		handle->count++;
+		return 1;
+	}
+	return 0;
+}
+
+DWORD WaitForSingleObject(HANDLE object, DWORD milliseconds) {
+	struct win_handle *handle = (struct win_handle *) object;
+	struct timespec deadline;
+	DWORD result = WAIT_OBJECT_0;
+
+	if ( milliseconds != INFINITE ) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += milliseconds / 1000;
+		deadline.tv_nsec += (milliseconds % 1000) * 1000000;
+		if ( deadline.tv_nsec >= 1000000000 ) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&handle->lock);
+	while ( !win_handle_take(handle) ) {
+		if ( milliseconds == INFINITE ) {
+			pthread_cond_wait(&handle->changed, &handle->lock);
+		} else if ( pthread_cond_timedwait(&handle->changed, &handle->lock, &deadline) == ETIMEDOUT ) {
+			result = WAIT_TIMEOUT;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&handle->lock);
+
+	/* reap the thread, now that it has returned */
+	if ( result == WAIT_OBJECT_0 && handle->type == WIN_THREAD && !handle->joined ) {
+		pthread_join(handle->thread, NULL);
+		handle->joined = 1;
+	}
+	return result;
+}
+
+BOOL CloseHandle(HANDLE object) {
+	struct win_handle *handle = (struct win_handle *) object;
+	pthread_t thread;
+
+	if ( handle == NULL ) {
+		return FALSE;
+	}
+	if ( handle->type == WIN_THREAD && !handle->joined ) {
+		pthread_mutex_lock(&handle->lock);
+		if ( !handle->exited ) {
+			/* still running - it frees the handle when it exits */
+			handle->closed = 1;
+			thread = handle->thread;
+			pthread_mutex_unlock(&handle->lock);
+			pthread_detach(thread);
+			return TRUE;
+		}
+		pthread_mutex_unlock(&handle->lock);
+		pthread_join(handle->thread, NULL);
+	}
+	win_handle_free(handle);
+	return TRUE;
+}
+
+DWORD GetLastError(void) {
+	return (DWORD) errno;
+}
@@ -0,0 +1,119 @@
+/*
+ * The part of the Win32 API the minisystem uses, for building it on
+ * Linux - threads, events, mutexes, waits and interlocked operations,
+ * on POSIX threads and gcc atomics. Makefile.linux puts this directory
+ * on the include path, so <windows.h> finds this file, and links
+ * windows.c with the system objects.
+ *
+ * Only the behaviour the minisystem relies on is provided: mutexes
+ * are recursive, may only be released by their owner and are released
+ * if it exits holding them, events are auto- or manual-reset, and
+ * waiting on a thread waits for it to exit.
+ */
+#ifndef __LINUX_WINDOWS_H_
+#define __LINUX_WINDOWS_H_
+
+#include <stddef.h>
+
+#define WINAPI
+#define __fastcall
+
+/* thread local storage, written __declspec(thread) */
+#define __declspec(spec) __declspec_##spec
+#define __declspec_thread __thread
+
+typedef int BOOL;
+typedef int LONG;
+typedef unsigned int DWORD;
+typedef void *LPVOID;
+typedef void *HANDLE;
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+
+
+/* *******
+ * Threads *
+ ******* */
+
+/* start proc(arg) on a new thread. only the proc and arg are used;
+   the thread's id is stored through id, if not NULL */
+HANDLE CreateThread(void *security, size_t stack_size, LPTHREAD_START_ROUTINE proc,
+		    LPVOID arg, DWORD flags, DWORD *id);
+
+/* the calling thread's id, as the kernel knows it */
+DWORD GetCurrentThreadId(void);
+
+DWORD GetCurrentProcessId(void);
+
+BOOL SwitchToThread(void);
+
+void Sleep(DWORD milliseconds);
+
+
+/* *****************
+ * Events and Mutexes *
+ ***************** */
+
+/* an event, auto-reset unless manual_reset, set to begin with if
+   initial_state. names are ignored */
+HANDLE CreateEvent(void *security, BOOL manual_reset, BOOL initial_state, const char *name);
+
+BOOL SetEvent(HANDLE event);
+
+BOOL ResetEvent(HANDLE event);
+
+/* a mutex, held by the caller to begin with if initial_owner. names
+   are ignored */
+HANDLE CreateMutex(void *security, BOOL initial_owner, const char *name);
+
+/* fails, returning FALSE, unless the caller holds the mutex */
+BOOL ReleaseMutex(HANDLE mutex);
+
+/* wait up to milliseconds (or INFINITE) for a thread to exit, an
+   event to be set or a mutex to be free - and take it, if it is an
+   auto-reset event or a mutex. returns WAIT_OBJECT_0 or WAIT_TIMEOUT */
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+
+/* free the handle. a thread keeps running, detached */
+BOOL CloseHandle(HANDLE handle);
+
+
+/* **********
+ * Errors *
+ ********** */
+
+/* the last error, from errno */
+DWORD GetLastError(void);
+
+
+/* **********************
+ * Interlocked Operations *
+ ********************** */
+
+static __inline LONG InterlockedExchange(volatile LONG *target, LONG value) {
+	/* xchg on x86, so a full barrier despite the name */
+	return __sync_lock_test_and_set(target, value);
+}
+
+static __inline LONG InterlockedCompareExchange(volatile LONG *target, LONG exchange, LONG comparand) {
+	return __sync_val_compare_and_swap(target, comparand, exchange);
+}
+
+static __inline LONG InterlockedIncrement(volatile LONG *target) {
+	return __sync_add_and_fetch(target, 1);
+}
+
+static __inline LONG InterlockedDecrement(volatile LONG *target) {
+	return __sync_sub_and_fetch(target, 1);
+}
+
+#endif __LINUX_WINDOWS_H_
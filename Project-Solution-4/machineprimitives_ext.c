@@ -0,0 +1,163 @@
+/*
+ * The primitives of machineprimitives_ext.h, for Windows and Linux.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "machineprimitives_ext.h"
+#include "defs.h"
+
+#define STACK_GROWS_DOWN        1
+#define STACKSIZE               (256 * 1024)  /* as in machineprimitives.c */
+#define STACKGUARD              1     /* guard pages below a stack */
+
+#ifdef _WIN32
+
+#define STACKALIGN              03
+
+unsigned __int64 currentTimeNanos() {
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  /* split, so the scaling cannot overflow */
+  return (counter.QuadPart / frequency.QuadPart) * 1000000000
+    + (counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+}
+
+/* the size of a page, for stack guards */
+static size_t stack_page_size(void) {
+    static size_t page_size = 0;
+    if (!page_size) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        page_size = info.dwPageSize;
+    }
+    return page_size;
+}
+
+/*
+ * Allocate a new stack of at least size bytes, with guard pages
+ * below it which fault on any access.
+ */
+void
+minithread_allocate_stack_size(stack_pointer_t *stackbase, stack_pointer_t *stacktop, size_t size)
+{
+    size_t page = stack_page_size();
+    size_t guard = STACKGUARD * page;
+    DWORD old_protect;
+
+    if (size == 0)
+      size = STACKSIZE;
+    size = (size + page - 1) & ~(page - 1);
+
+    *stackbase = (stack_pointer_t) VirtualAlloc(NULL, guard + size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!*stackbase)  {
+	return;
+    }
+    if (!VirtualProtect(*stackbase, guard, PAGE_NOACCESS, &old_protect)) {
+      VirtualFree(*stackbase, 0, MEM_RELEASE);
+      *stackbase = NULL;
+      return;
+    }
+
+    if (STACK_GROWS_DOWN)
+      /* Stacks grow down, from the top of the allocation towards the
+	 guard. Word align (turn off low 2 bits by anding with ~3). */
+      *stacktop = (stack_pointer_t) ((long)((char*)*stackbase + guard + size - 1) & ~STACKALIGN);
+    else {
+      /* Word align (turn off low 2 bits by anding with ~3) */
+      *stacktop = (stack_pointer_t)(((long)*stackbase + guard + 3)&~STACKALIGN);
+    }
+}
+
+/* 
+ * Free a stack from minithread_allocate_stack_size.
+ */
+void
+minithread_free_stack_size(stack_pointer_t stackbase, size_t size)
+{
+    /* releasing the whole reservation needs no size */
+    VirtualFree(stackbase, 0, MEM_RELEASE);
+}
+
+/*
+ * swap_pointer
+ * 
+ * swap, for pointers - which are the size of an int here
+ */
+void* swap_pointer(void** x, void* newval) {
+  return (void*)swap((int*)x, (int)newval);
+}
+
+#else /* Linux */
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define STACKALIGN              15    /* as the x86-64 ABI requires */
+
+unsigned __int64 currentTimeNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned __int64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Allocate a new stack of at least size bytes, with guard pages
+ * below it which fault on any access.
+ */
+void
+minithread_allocate_stack_size(stack_pointer_t *stackbase, stack_pointer_t *stacktop, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t guard = STACKGUARD * page;
+    void *base;
+
+    if (size == 0)
+      size = STACKSIZE;
+    size = (size + page - 1) & ~(page - 1);
+
+    *stackbase = NULL;
+    base = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED)  {
+	return;
+    }
+    if (mprotect(base, guard, PROT_NONE) != 0) {
+      munmap(base, guard + size);
+      return;
+    }
+    *stackbase = (stack_pointer_t) base;
+
+    /* Stacks grow down, from the top of the allocation towards the
+       guard. */
+    *stacktop = (stack_pointer_t) ((unsigned long)((char*)base + guard + size) & ~STACKALIGN);
+}
+
+/* 
+ * Free a stack from minithread_allocate_stack_size.
+ */
+void
+minithread_free_stack_size(stack_pointer_t stackbase, size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (size == 0)
+      size = STACKSIZE;
+    size = (size + page - 1) & ~(page - 1);
+    munmap(stackbase, STACKGUARD * page + size);
+}
+
+/*
+ * swap_pointer
+ * 
+ * swap, for pointers - which are wider than an int here
+ */
+void* swap_pointer(void** x, void* newval) {
+  /* xchg on x86, so a full barrier despite the name */
+  return __sync_lock_test_and_set(x, newval);
+}
+
+#endif
@@ -0,0 +1,55 @@
+/* 
+ * Primitives added to those of machineprimitives.h, which is kept as
+ * it was handed out. These are for the pooled, guarded stacks in
+ * minithread.c, the nanosecond clock of the tickless mode and the
+ * alarms, and the lock-free queues.
+ */
+#ifndef __MACHINEPRIMITIVES_EXT_H_
+#define __MACHINEPRIMITIVES_EXT_H_
+#include "machineprimitives.h"
+
+
+/* *************************
+ * Time Utility Function *
+ ************************* */
+
+/*
+ *  Returns a monotonic time in nanoseconds, from an arbitrary start
+ */
+unsigned __int64 currentTimeNanos();
+
+
+/* *************************
+ * Stack Utility Functions *
+ ************************* */
+
+/*
+ *	Allocate a fresh stack of at least size bytes (0 for the default
+ *  size). An inaccessible guard page lies below it, so a thread which
+ *  overflows its stack faults there rather than corrupting whatever
+ *  memory follows. *stackbase is the start of the allocation, guard
+ *  included.
+ */
+extern void minithread_allocate_stack_size(stack_pointer_t *stackbase,
+					   stack_pointer_t *stacktop,
+					   size_t size);
+
+
+/*
+ *	Frees a stack from minithread_allocate_stack_size, which must be
+ *  given the same size.
+ */
+extern void minithread_free_stack_size(stack_pointer_t stackbase, size_t size);
+
+
+/* *****************************
+ * Atomic Operations Functions *
+ ***************************** */
+
+/* 
+ * swap, for a pointer-sized value.
+ */
+extern void* swap_pointer(void** x, void* newval);
+
+
+#endif __MACHINEPRIMITIVES_EXT_H_
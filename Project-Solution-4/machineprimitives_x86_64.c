@@ -0,0 +1,183 @@
+/*
+ * Minithreads x86-64/Linux Machine Dependent Code
+ *
+ * The Linux (gcc, System V x86-64 ABI) counterpart of both
+ * machineprimitives.c and machineprimitives_x86.c - Makefile.linux
+ * links this in place of those two, along with interrupts_linux.c.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "defs.h"
+#include "machineprimitives_ext.h"
+
+#define STACKSIZE               (256 * 1024)
+
+/*
+ * Used to initialize a thread's stack for the first context switch
+ * to the thread. The layout is that of the registers minithread_switch
+ * saves, lowest address first, followed by its return address - so the
+ * first switch to the thread "returns" into minithread_root, with the
+ * main and final procedures in callee saved registers.
+ */
+typedef struct initial_stack_state *initial_stack_state_t;
+struct initial_stack_state 
+{
+  void *finally_arg;          /* r15 */
+  void *finally_proc;         /* r14 */
+  void *body_arg;             /* r13 */
+  void *body_proc;            /* r12 */
+  void *rbx;
+  void *rbp;
+  void *root_proc;            /* left on stack */
+};
+
+
+unsigned __int64 currentTimeMillis() {
+  struct timespec now;
+  unsigned __int64 lt;
+  clock_gettime(CLOCK_REALTIME, &now);
+  lt = now.tv_sec;
+  lt = lt*1000;
+  lt = lt+now.tv_nsec/1000000;
+  return lt;
+}
+
+
+/*
+ * Allocate a new stack - with a guard page below it, as stacks from
+ * minithread_allocate_stack_size are.
+ */
+void
+minithread_allocate_stack(stack_pointer_t *stackbase, stack_pointer_t *stacktop)
+{
+    minithread_allocate_stack_size(stackbase, stacktop, STACKSIZE);
+}
+
+/* 
+ * Free a stack.
+ *
+ * The stack cannot be used after this call.
+ */
+void
+minithread_free_stack(stack_pointer_t stackbase)
+{
+    minithread_free_stack_size(stackbase, STACKSIZE);
+}
+
+/*
+ * See the assembly below.
+ */
+extern int minithread_root();
+
+/*
+ * Initialize a stack.
+ *	Stack frame is set up so that thread calls:
+ *		body_proc(body_arg);
+ *		finally_proc(finally_arg);
+ */
+void
+minithread_initialize_stack(
+	stack_pointer_t *stacktop,
+    proc_t body_proc,
+    arg_t body_arg,
+    proc_t finally_proc,
+    arg_t finally_arg)
+{
+    initial_stack_state_t ss;
+
+    *((char **) stacktop) -= sizeof (struct initial_stack_state);
+    ss = (initial_stack_state_t) *stacktop;
+
+    ss->body_proc = (void *) body_proc;
+    ss->body_arg = (void *) body_arg;
+    ss->finally_proc = (void *) finally_proc;
+    ss->finally_arg = (void *) finally_arg;
+    ss->rbx = NULL;
+    ss->rbp = NULL;
+
+    ss->root_proc = (void *) minithread_root;
+}
+
+
+/* atomic_test_and_set - returns 0 if we set, 1 if not (think: l == 1 
+   => locked, and we return the old value, so we get 0 if we managed to
+   lock l).
+*/
+int atomic_test_and_set(tas_lock_t *l) {
+  return __sync_val_compare_and_swap(l, 0, 1);
+}
+
+/*
+ * swap
+ * 
+ * atomically stores newval in *x, returns old value in *x
+ */
+int swap(int* x, int newval) {
+  /* xchg on x86, so a full barrier despite the name */
+  return __sync_lock_test_and_set(x, newval);
+}
+
+/*
+ * compare and swap
+ * 
+ * compare the value at *x to oldval, swap with
+ * newval if successful
+ */
+int compare_and_swap(int* x, int oldval, int newval) {
+  return __sync_val_compare_and_swap(x, oldval, newval);
+}
+
+/*
+ * atomic_clear
+ *
+ */
+void atomic_clear(tas_lock_t *l) {
+  __sync_lock_release(l);
+}
+
+
+/*
+ * minithread_root - entered by the first switch to a thread, with
+ * body_proc, body_arg, finally_proc and finally_arg in r12 - r15
+ *
+ * minithread_switch - save the callee saved registers on the old
+ * stack, switch stacks, re-enable interrupts and restore the new
+ * thread's registers. the two arguments are in rdi and rsi.
+ */
+__asm__(
+  "	.text\n"
+  "	.globl minithread_root\n"
+  "	.type minithread_root, @function\n"
+  "minithread_root:\n"
+  "	andq $-16, %rsp\n"		/* align for the calls */
+  "	movq %r13, %rdi\n"		/* arg to the main proc */
+  "	call *%r12\n"			/* call main proc */
+  "	movq %r15, %rdi\n"		/* arg to the clean-up proc */
+  "	call *%r14\n"			/* call the clean-up */
+  "	call abort\n"			/* should never get here */
+  "	.size minithread_root, .-minithread_root\n"
+  "\n"
+  "	.globl minithread_switch\n"
+  "	.type minithread_switch, @function\n"
+  "minithread_switch:\n"
+  "	pushq %rbp\n"			/* save the callee saved registers */
+  "	pushq %rbx\n"
+  "	pushq %r12\n"
+  "	pushq %r13\n"
+  "	pushq %r14\n"
+  "	pushq %r15\n"
+  "	movq %rsp, (%rdi)\n"		/* pass back the old thread's sp */
+  "	movq (%rsi), %rsp\n"		/* load new thread's sp */
+  "	movl $1, interrupt_level(%rip)\n"	/* re-enable interrupts */
+  "	popq %r15\n"			/* restore the new thread's registers */
+  "	popq %r14\n"
+  "	popq %r13\n"
+  "	popq %r12\n"
+  "	popq %rbx\n"
+  "	popq %rbp\n"
+  "	ret\n"
+  "	.size minithread_switch, .-minithread_switch\n"
+);
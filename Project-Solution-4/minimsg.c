@@ -7,6 +7,7 @@
  * INCLUDES
  */
 #include "defs.h"
+#include "machineprimitives.h"
 #include "minimsg_private.h"
 #include "minithread_private.h"
 #include "network.h"
@@ -14,6 +15,7 @@
 #include "synch.h"
 #include "alarm.h"
 #include "directory.h"
+#include "trace.h"
 
 
 
@@ -23,11 +25,29 @@
  */
 
 #define MINIMSG_ACK_TIMEOUT (500)
+#define MINIMSG_ACK_TIMEOUT_SLACK (50)
 #define MINIMSG_MAX_TRIES (5)
 
 typedef char minimsg_data_buf;
 
 
+/* wire format version - bump whenever the packed
+ * header layout below changes, so that mismatched
+ * peers drop each other's packets instead of
+ * misparsing them
+ */
+#define MINIMSG_WIRE_VERSION (1)
+
+/* longest encoding of a 32 bit varint (7 bits per byte)
+ */
+#define MINIMSG_VARINT_MAX (5)
+
+/* longest packed header: system id byte, version / type
+ * byte and up to four varint ids (to, from, this_id, reply_to)
+ */
+#define MINIMSG_WIRE_HEADER_MAX (2 + 4 * MINIMSG_VARINT_MAX)
+
+
 /* net packet type */
 typedef enum minimsg_net_type minimsg_net_type_t;
 enum minimsg_net_type {
@@ -57,27 +77,41 @@ struct minimsg_header {
 };
 
 
-/* network control packet structure
+/* decoded network packet - the headers are unpacked
+ * from the wire format, body points into the received
+ * buffer (and so is only valid in the interrupt handler).
+ *
+ * on the wire, a packet is laid out as:
+ *   byte 0    system id (group id)
+ *   byte 1    wire version (high nibble) | net type (low nibble)
+ *   varint    to
+ *   varint    from
+ *   varint    this_id (data packets only)
+ *   varint    reply_to
+ *   ...       body (data packets only)
+ * varints are little endian base 128, and the body length
+ * is whatever remains of the packet after the header.
  */
-typedef struct minimsg_net_ack *minimsg_net_ack_t;
-struct minimsg_net_ack {
+typedef struct minimsg_net_packet *minimsg_net_packet_t;
+struct minimsg_net_packet {
 	struct minimsg_net_header net_header;
 	struct minimsg_header header;
+	minimsg_data_t body;
 };
 
 
-/* msg structure - this is designed so that
- * it can be used locally and as the data portion
- * of a packet. when used locally, simply ignore
- * the net_header. when using as packet, remember
- * that the packet length is not the same as the
- * body length (which is the value stored in the
- * header).
+/* msg structure - the headers are kept unpacked for
+ * local use. when the msg is sent over the network,
+ * the packed header is written into the end of wire,
+ * immediately before body, so that the header and body
+ * form one contiguous packet without copying the body.
  */
 typedef struct minimsg_msg *minimsg_msg_t;
 struct minimsg_msg {
+	mpsc_link_t arrived_link; /* on its mailbox's msg_arrived */
 	struct minimsg_net_header net_header;
 	struct minimsg_header header;
+	minimsg_data_buf wire[MINIMSG_WIRE_HEADER_MAX];
 	minimsg_data_buf body[MAX_MSG_SIZE];
 };
 
@@ -87,17 +121,28 @@ struct minimsg_msg {
 struct minimsg {
 	minimsg_port_t default_id;
 	directory_t post_office;
+	char replaying;
+	queue_t replay_boxes; /* mailboxes created for the replay */
+	semaphore_t replay_drained; /* V'd by each drain thread as it ends */
 };
 
 
-/* mailbox data structure
+/* mailbox data structure - msgs are delivered to msg_arrived
+ * without locking, from any thread, and receivers take them in
+ * turn, holding receiving, as only one may pop at a time. a
+ * receiver finding none sets sleeping and waits on msg_available,
+ * and only a deliver which clears sleeping Vs it, so delivering
+ * to a mailbox being kept up with takes no lock at all.
  */
 typedef struct minimsg_mailbox* minimsg_mailbox_t;
 struct minimsg_mailbox {
 	minimsg_port_t port;
 	directory_t correspondents;
-	queue_t msg_arrived;
+	mpsc_queue_t msg_arrived;
 	semaphore_t msg_available;
+	mutex_t receiving;
+	int sleeping;
+	int replay_received; /* by its drain thread, while replaying */
 };
 
 
@@ -110,7 +155,8 @@ typedef struct minimsg_corresp* minimsg_corresp_t;
 struct minimsg_corresp {
 	minimsg_mailbox_t parent;
 	minimsg_port_t contact;
-	network_address_t remote;
+	network_address_t remote; /* zero until known */
+	network_handle_t remote_handle; /* remote interned, if it could be */
 	minimsg_msgid_t last_rcvd;
 	minimsg_msgid_t last_sent;
 	minimsg_msg_t pending;
@@ -131,6 +177,14 @@ minimsg_msg_t minimsg_msg_create(minimsg_port_t from, minimsg_port_t to, int msg
 int minimsg_msg_extract(minimsg_msg_t msg, minimsg_data_t buffer, int *buffer_len_p, minimsg_port_t *from_p, minimsg_msgid_t *id_p);
 int minimsg_msg_free(minimsg_msg_t msg);
 int minimsg_msg_iterate_free(any_t val_cur, any_t val);
+minimsg_msg_t minimsg_msg_from_packet(minimsg_net_packet_t packet);
+
+/* wire format */
+int minimsg_wire_put_varint(char *buf, unsigned int value);
+int minimsg_wire_get_varint(char *buf, char *end, unsigned int *value_p);
+int minimsg_wire_encode_header(minimsg_net_header_t net_header, minimsg_header_t header, char *buf);
+int minimsg_wire_pack(minimsg_msg_t msg, char **packet_p);
+int minimsg_wire_decode(char *buf, int size, minimsg_net_packet_t packet);
 
 /* minimsg layer */
 minimsg_mailbox_t minimsg_get_mbox(minimsg_port_t port);
@@ -139,9 +193,11 @@ minimsg_corresp_t minimsg_get_port_corresp(minimsg_port_t this_port, minimsg_por
 
 /* mbox layer */
 minimsg_mailbox_t minimsg_mbox_create(void);
+minimsg_mailbox_t minimsg_mbox_create_port(minimsg_port_t port);
 int minimsg_mbox_free(minimsg_mailbox_t mbox);
 int minimsg_mbox_iterate_free(key_t key_cur, any_t val_cur, key_t key, any_t val);
 int minimsg_mbox_deliver_msg(minimsg_mailbox_t box, minimsg_msg_t msg);
+minimsg_msg_t minimsg_mbox_receive_msg(minimsg_mailbox_t box);
 minimsg_corresp_t minimsg_mbox_get_corresp(minimsg_mailbox_t box, minimsg_port_t other_port);
 
 /* corresp layer */
@@ -154,11 +210,18 @@ int minimsg_corresp_deliver_msg(minimsg_corresp_t corresp, minimsg_msg_t msg);
 
 /* net layer */
 void minimsg_net_packet_handler(void *int_arg);
-void minimsg_net_ack_handler(minimsg_net_ack_t packet, network_address_t addr);
-void minimsg_net_data_handler(minimsg_msg_t packet, network_address_t addr);
+void minimsg_net_ack_handler(minimsg_net_packet_t packet, network_address_t addr, network_handle_t handle);
+void minimsg_net_data_handler(minimsg_net_packet_t packet, network_address_t addr, network_handle_t handle);
 void minimsg_net_timeout_handler(arg_t timeout_arg);
 int minimsg_net_send_to_corresp(minimsg_corresp_t corresp);
-int minimsg_net_send_ack(network_address_t addr, minimsg_port_t replying_to, minimsg_msgid_t concerning, minimsg_port_t me);
+int minimsg_net_send_ack(network_address_t addr, network_handle_t handle, minimsg_port_t replying_to, minimsg_msgid_t concerning, minimsg_port_t me);
+int minimsg_net_send(network_address_t addr, network_handle_t handle, int packet_len, char *packet);
+
+/* replay */
+int minimsg_replay_drain(arg_t arg);
+int minimsg_replay_drain_start(minimsg_mailbox_t box);
+void minimsg_replay_port(minimsg_t msg_system, minimsg_port_t port);
+int minimsg_replay_iterate_end(any_t val_cur, any_t val);
 
 
 
@@ -176,6 +239,9 @@ minimsg_t minimsg_system_initialize() {
 	dbgprintf("Initializing minimsg system...\n");
 
 	msg_system->post_office = directory_new();
+	msg_system->replaying = 0;
+	msg_system->replay_boxes = NULL;
+	msg_system->replay_drained = NULL;
 
 	network_initialize(&(minimsg_net_packet_handler));
 
@@ -296,14 +362,10 @@ extern int minimsg_receive(minimsg_port_t me, minimsg_data_t msg, int *buffer_le
 		if ( box = minimsg_get_mbox(me) ) {
 			minimsg_msg_t rcv_msg;
 
-			semaphore_P(box->msg_available);
-
-			set_interrupt_level(DISABLED);
-
-			queue_dequeue(box->msg_arrived, &rcv_msg);
-
 			set_interrupt_level(old_int);
 
+			rcv_msg = minimsg_mbox_receive_msg(box);
+
 			minimsg_msg_extract(rcv_msg, msg, buffer_len_p, from_p, id_p);
 
 			if ( from_p && *from_p == MINIMSG_SYSTEM_PORT_BCAST_ID ) {
@@ -354,6 +416,78 @@ int minimsg_rpc(minimsg_port_t me, minimsg_port_t to, int msg_len, minimsg_data_
 }
 
 
+/* prepare for captured traffic to be replayed to this process
+ */
+int minimsg_replay_start(void) {
+	minimsg_t msg_system = minithread_msg_system();
+	minimsg_mailbox_t box;
+	interrupt_level_t old_int;
+
+	if ( msg_system->replaying ) {
+		return -1;
+	}
+	msg_system->replay_boxes = queue_new();
+	msg_system->replay_drained = semaphore_create();
+	semaphore_initialize(msg_system->replay_drained, 0);
+
+	old_int = set_interrupt_level(DISABLED);
+	box = minimsg_get_mbox(msg_system->default_id);
+	if ( minimsg_replay_drain_start(box) != 0 ) {
+		set_interrupt_level(old_int);
+		queue_free(msg_system->replay_boxes);
+		semaphore_destroy(msg_system->replay_drained);
+		return -1;
+	}
+	msg_system->replaying = 1;
+	set_interrupt_level(old_int);
+
+	return 0;
+}
+
+
+/* wait until every message delivered while replaying has been
+ * received, then destroy the ports created for the replay
+ */
+int minimsg_replay_stop(void) {
+	minimsg_t msg_system = minithread_msg_system();
+	minimsg_mailbox_t box;
+	int drains = 0;
+	int received;
+	interrupt_level_t old_int;
+
+	if ( !msg_system->replaying ) {
+		return -1;
+	}
+
+	/* each drain thread ends at a message of length -1, which
+	 * follows all those delivered before it */
+	old_int = set_interrupt_level(DISABLED);
+	msg_system->replaying = 0;
+	minimsg_replay_iterate_end(minimsg_get_mbox(msg_system->default_id), &drains);
+	queue_iterate(msg_system->replay_boxes, minimsg_replay_iterate_end, &drains);
+	set_interrupt_level(old_int);
+
+	while ( drains-- ) {
+		semaphore_P(msg_system->replay_drained);
+	}
+
+	received = minimsg_get_mbox(msg_system->default_id)->replay_received;
+	while ( queue_dequeue(msg_system->replay_boxes, &box) == 0 ) {
+		received += box->replay_received;
+		old_int = set_interrupt_level(DISABLED);
+		minimsg_remove_mbox(box->port);
+		set_interrupt_level(old_int);
+		minimsg_mbox_free(box);
+	}
+	queue_free(msg_system->replay_boxes);
+	msg_system->replay_boxes = NULL;
+	semaphore_destroy(msg_system->replay_drained);
+	msg_system->replay_drained = NULL;
+
+	return received;
+}
+
+
 
 
 /*
@@ -376,16 +510,16 @@ minimsg_msg_t minimsg_msg_create(minimsg_port_t from, minimsg_port_t to, int msg
 }
 
 
-minimsg_msg_t minimsg_msg_clone(minimsg_msg_t msg) {
+minimsg_msg_t minimsg_msg_from_packet(minimsg_net_packet_t packet) {
 	minimsg_msg_t new_msg = malloc(sizeof(struct minimsg_msg));
-	new_msg->net_header.system_id = msg->net_header.system_id;
-	new_msg->net_header.net_type = msg->net_header.net_type;
-	new_msg->net_header.to = msg->net_header.to;
-	new_msg->header.from = msg->header.from;
-	new_msg->header.this_id = msg->header.this_id;
-	new_msg->header.reply_to = msg->header.reply_to;
-	new_msg->header.msg_len = msg->header.msg_len;
-	memcpy(new_msg->body, msg->body, msg->header.msg_len);
+	new_msg->net_header.system_id = packet->net_header.system_id;
+	new_msg->net_header.net_type = packet->net_header.net_type;
+	new_msg->net_header.to = packet->net_header.to;
+	new_msg->header.from = packet->header.from;
+	new_msg->header.this_id = packet->header.this_id;
+	new_msg->header.reply_to = packet->header.reply_to;
+	new_msg->header.msg_len = packet->header.msg_len;
+	memcpy(new_msg->body, packet->body, packet->header.msg_len);
 	return new_msg;
 }
 
@@ -417,6 +551,116 @@ int minimsg_msg_iterate_free(any_t val_cur, any_t val) {
 
 
 
+/* begin wire format fns */
+
+int minimsg_wire_put_varint(char *buf, unsigned int value) {
+	int len = 0;
+	while ( value >= 0x80 ) {
+		buf[len++] = (char)((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (char)value;
+	return len;
+}
+
+
+int minimsg_wire_get_varint(char *buf, char *end, unsigned int *value_p) {
+	unsigned int value = 0;
+	int len = 0;
+	while ( buf + len < end && len < MINIMSG_VARINT_MAX ) {
+		unsigned char byte = (unsigned char)buf[len];
+		value |= (unsigned int)(byte & 0x7F) << (7 * len);
+		len++;
+		if ( !(byte & 0x80) ) {
+			*value_p = value;
+			return len;
+		}
+	}
+	/* truncated or overlong */
+	return -1;
+}
+
+
+int minimsg_wire_encode_header(minimsg_net_header_t net_header, minimsg_header_t header, char *buf) {
+	int len = 0;
+	buf[len++] = (char)net_header->system_id;
+	buf[len++] = (char)((MINIMSG_WIRE_VERSION << 4) | (net_header->net_type & 0x0F));
+	len += minimsg_wire_put_varint(buf + len, (unsigned int)net_header->to);
+	len += minimsg_wire_put_varint(buf + len, (unsigned int)header->from);
+	if ( net_header->net_type == MINIMSG_NET_TYPE_DATA ) {
+		len += minimsg_wire_put_varint(buf + len, (unsigned int)header->this_id);
+	}
+	len += minimsg_wire_put_varint(buf + len, (unsigned int)header->reply_to);
+	return len;
+}
+
+
+/* write the packed header for msg immediately before its body,
+ * return out the start of the packet and return its length
+ */
+int minimsg_wire_pack(minimsg_msg_t msg, char **packet_p) {
+	char header[MINIMSG_WIRE_HEADER_MAX];
+	int len = minimsg_wire_encode_header(&msg->net_header, &msg->header, header);
+	*packet_p = msg->body - len;
+	memcpy(*packet_p, header, len);
+	return len + msg->header.msg_len;
+}
+
+
+/* unpack the header of a received packet. on success
+ * return 0, on a truncated, foreign or wrong version
+ * packet return -1.
+ */
+int minimsg_wire_decode(char *buf, int size, minimsg_net_packet_t packet) {
+	char *end = buf + size;
+	char *pos = buf + 2;
+	unsigned int value;
+	int len;
+
+	if ( size < 2 || (unsigned char)buf[0] != (unsigned char)MINIMSG_GROUP_ID
+		|| ((unsigned char)buf[1] >> 4) != MINIMSG_WIRE_VERSION ) {
+		return -1;
+	}
+	packet->net_header.system_id = (unsigned char)buf[0];
+	packet->net_header.net_type = (minimsg_net_type_t)(buf[1] & 0x0F);
+
+	if ( (len = minimsg_wire_get_varint(pos, end, &value)) < 0 ) {
+		return -1;
+	}
+	packet->net_header.to = (minimsg_port_t)value;
+	pos += len;
+
+	if ( (len = minimsg_wire_get_varint(pos, end, &value)) < 0 ) {
+		return -1;
+	}
+	packet->header.from = (minimsg_port_t)value;
+	pos += len;
+
+	packet->header.this_id = 0;
+	if ( packet->net_header.net_type == MINIMSG_NET_TYPE_DATA ) {
+		if ( (len = minimsg_wire_get_varint(pos, end, &value)) < 0 ) {
+			return -1;
+		}
+		packet->header.this_id = (minimsg_msgid_t)value;
+		pos += len;
+	}
+
+	if ( (len = minimsg_wire_get_varint(pos, end, &value)) < 0 ) {
+		return -1;
+	}
+	packet->header.reply_to = (minimsg_msgid_t)value;
+	pos += len;
+
+	packet->header.msg_len = (int)(end - pos);
+	packet->body = pos;
+	if ( packet->header.msg_len > MAX_MSG_SIZE ) {
+		return -1;
+	}
+	return 0;
+}
+
+
+
 /* begin minimsg layer */
 
 minimsg_mailbox_t minimsg_get_mbox(minimsg_port_t port) {
@@ -452,13 +696,21 @@ minimsg_corresp_t minimsg_get_port_corresp(minimsg_port_t this_port, minimsg_por
 /* begin mbox layer */
 
 minimsg_mailbox_t minimsg_mbox_create(void) {
+	return minimsg_mbox_create_port(network_reserve_next_token());
+}
+
+
+minimsg_mailbox_t minimsg_mbox_create_port(minimsg_port_t port) {
 	minimsg_mailbox_t box = malloc(sizeof(struct minimsg_mailbox));
 	
-	box->port = network_reserve_next_token();
+	box->port = port;
 
-	box->msg_arrived = queue_new();
+	mpsc_queue_init(&box->msg_arrived);
 	box->msg_available = semaphore_create();
 	semaphore_initialize(box->msg_available, 0);
+	box->receiving = mutex_create();
+	box->sleeping = 0;
+	box->replay_received = 0;
 
 	box->correspondents = directory_new();
 
@@ -467,13 +719,16 @@ minimsg_mailbox_t minimsg_mbox_create(void) {
 
 
 int minimsg_mbox_free(minimsg_mailbox_t box) {
+	mpsc_link_t *link;
 
-	queue_iterate(box->msg_arrived, minimsg_msg_iterate_free, NULL);
-
-	queue_free(box->msg_arrived);
+	while ( mpsc_queue_pop(&box->msg_arrived, &link) == 0 ) {
+		minimsg_msg_free(queue_item(link, struct minimsg_msg, arrived_link));
+	}
 
 	semaphore_destroy(box->msg_available);
 
+	mutex_destroy(box->receiving);
+
 	directory_iterate(box->correspondents, &minimsg_corresp_iterate_free, 0, NULL);
 
 	directory_destroy(box->correspondents);
@@ -490,12 +745,46 @@ int minimsg_mbox_iterate_free(key_t key_cur, any_t val_cur, key_t key, any_t val
 
 
 int minimsg_mbox_deliver_msg(minimsg_mailbox_t box, minimsg_msg_t msg) {
-	queue_append(box->msg_arrived, msg);
-	semaphore_V(box->msg_available);
+	mpsc_queue_push(&box->msg_arrived, &msg->arrived_link);
+	/* only a sleeping receiver needs the V - the compare and swap
+	 * also keeps the push ahead of the look at sleeping
+	 */
+	if ( compare_and_swap(&box->sleeping, 1, 0) == 1 ) {
+		semaphore_V(box->msg_available);
+	}
 	return 0;
 }
 
 
+/* take the next message delivered to box, waiting for one if
+ * there are none
+ */
+minimsg_msg_t minimsg_mbox_receive_msg(minimsg_mailbox_t box) {
+	mpsc_link_t *link;
+
+	mutex_lock(box->receiving);
+	while ( mpsc_queue_pop(&box->msg_arrived, &link) != 0 ) {
+		/* none has arrived, or one is part way through
+		 * its push - say we will sleep, then look again,
+		 * so that any deliver either is seen here or sees
+		 * sleeping set, and wakes us once it is done
+		 */
+		swap(&box->sleeping, 1);
+		if ( mpsc_queue_pop(&box->msg_arrived, &link) == 0 ) {
+			if ( compare_and_swap(&box->sleeping, 1, 0) != 1 ) {
+				/* a deliver saw us first, so take its V */
+				semaphore_P(box->msg_available);
+			}
+			break;
+		}
+		semaphore_P(box->msg_available);
+	}
+	mutex_unlock(box->receiving);
+
+	return queue_item(link, struct minimsg_msg, arrived_link);
+}
+
+
 minimsg_corresp_t minimsg_mbox_get_corresp(minimsg_mailbox_t box, minimsg_port_t other_port) {
 	minimsg_corresp_t corresp;
 	if ( directory_get(box->correspondents, other_port, &corresp) != 0 ) {
@@ -516,10 +805,11 @@ minimsg_corresp_t minimsg_corresp_create(minimsg_mailbox_t parent, minimsg_port_
 	corresp->parent = parent;
 	corresp->contact = corresp_id;
 	network_address_zero(corresp->remote);
+	corresp->remote_handle = NETWORK_HANDLE_NONE;
 	corresp->last_rcvd = 0;
 	corresp->last_sent = 0;
 	corresp->pending = NULL;
-	corresp->pending_timeout = NULL;
+	corresp->pending_timeout = ALARM_ID_NONE;
 	corresp->waiting = queue_new();
 	corresp->rsp_arrived = queue_new();
 	corresp->rsp_available = semaphore_create();
@@ -531,7 +821,7 @@ minimsg_corresp_t minimsg_corresp_create(minimsg_mailbox_t parent, minimsg_port_
 
 int minimsg_corresp_free(minimsg_corresp_t corresp) {
 	semaphore_destroy(corresp->rsp_available);
-	if ( corresp->pending_timeout ) {
+	if ( corresp->pending_timeout != ALARM_ID_NONE ) {
 		alarm_deregister(corresp->pending_timeout);
 	}
 	minimsg_msg_free(corresp->pending);
@@ -639,34 +929,42 @@ int minimsg_corresp_deliver_msg(minimsg_corresp_t corresp, minimsg_msg_t msg) {
  * just a packet.
  */
 void minimsg_net_packet_handler(void *int_arg) {
-	if ( ((minimsg_msg_t)((network_interrupt_arg_t)int_arg)->buffer)->net_header.system_id == MINIMSG_GROUP_ID ) {
-		/* from same group */
-		if ( ((minimsg_msg_t)((network_interrupt_arg_t)int_arg)->buffer)->net_header.net_type == MINIMSG_NET_TYPE_ACK ) {
+	network_interrupt_arg_t arg = (network_interrupt_arg_t)int_arg;
+	struct minimsg_net_packet packet;
+
+	minithread_interrupt_enter();
+	TRACE_EVENT(TRACE_NET_ENTER, minithread_id(), 0);
+
+	if ( minimsg_wire_decode(arg->buffer, arg->size, &packet) == 0 ) {
+		/* from same group, same wire version */
+		if ( packet.net_header.net_type == MINIMSG_NET_TYPE_ACK ) {
 			/* control */
-			minimsg_net_ack_handler((minimsg_net_ack_t)((network_interrupt_arg_t)int_arg)->buffer,
-				((network_interrupt_arg_t)int_arg)->addr);
-		} else if ( ((minimsg_msg_t)((network_interrupt_arg_t)int_arg)->buffer)->net_header.net_type == MINIMSG_NET_TYPE_DATA ) {
+			minimsg_net_ack_handler(&packet, arg->addr, arg->handle);
+		} else if ( packet.net_header.net_type == MINIMSG_NET_TYPE_DATA ) {
 			/* data */
-			minimsg_net_data_handler((minimsg_msg_t)((network_interrupt_arg_t)int_arg)->buffer,
-				((network_interrupt_arg_t)int_arg)->addr);
+			minimsg_net_data_handler(&packet, arg->addr, arg->handle);
 		}
 	}
 	free(int_arg);
+
+	TRACE_EVENT(TRACE_NET_EXIT, minithread_id(), 0);
+	minithread_interrupt_exit();
 }
 
 
-void minimsg_net_ack_handler(minimsg_net_ack_t packet, network_address_t addr) {
+void minimsg_net_ack_handler(minimsg_net_packet_t packet, network_address_t addr, network_handle_t handle) {
 	minimsg_corresp_t corresp;
 	if ( corresp = minimsg_get_port_corresp(packet->net_header.to, packet->header.from) ) {
 		/* to port on this machine */
 	
 		/* make sure we have address */
 		network_address_copy(addr, corresp->remote);
+		corresp->remote_handle = handle;
 
 		if ( corresp->pending && corresp->pending->header.this_id == packet->header.reply_to ) {
 			/* in response to message that is still pending */
 			alarm_deregister(corresp->pending_timeout);
-			corresp->pending_timeout = NULL;
+			corresp->pending_timeout = ALARM_ID_NONE;
 			minimsg_msg_free(corresp->pending);
 			corresp->pending = NULL;
 			if ( queue_length(corresp->waiting) ) {
@@ -679,14 +977,18 @@ void minimsg_net_ack_handler(minimsg_net_ack_t packet, network_address_t addr) {
 }
 
 
-void minimsg_net_data_handler(minimsg_msg_t packet, network_address_t addr) {
+void minimsg_net_data_handler(minimsg_net_packet_t packet, network_address_t addr, network_handle_t handle) {
 	minimsg_corresp_t corresp;
+	if ( minithread_msg_system()->replaying && packet->net_header.to != MINIMSG_SYSTEM_PORT_BCAST_ID ) {
+		/* the port it was captured going to */
+		minimsg_replay_port(minithread_msg_system(), packet->net_header.to);
+	}
 	if ( corresp = minimsg_get_port_corresp(packet->net_header.to == MINIMSG_SYSTEM_PORT_BCAST_ID ? minithread_msg_system()->default_id : packet->net_header.to, packet->net_header.to == MINIMSG_SYSTEM_PORT_BCAST_ID ? packet->net_header.to : packet->header.from) ) {
 		/* to port on this machine */
 		dbgprintf("RCV: %d\n", *((int*)packet->body));
 			
 		/* send ack */
-		minimsg_net_send_ack(addr, packet->header.from, packet->header.this_id, packet->net_header.to);
+		minimsg_net_send_ack(addr, handle, packet->header.from, packet->header.this_id, packet->net_header.to);
 
 		if ( packet->net_header.to == MINIMSG_SYSTEM_PORT_BCAST_ID ) {
 			packet->header.reply_to = packet->header.from;
@@ -694,12 +996,13 @@ void minimsg_net_data_handler(minimsg_msg_t packet, network_address_t addr) {
 			packet->net_header.to = minithread_msg_system()->default_id;
 		}
 
-		if ( corresp->last_rcvd < packet->header.this_id ) {
-			/* new msg */
-			minimsg_msg_t msg = minimsg_msg_clone(packet);
+		if ( corresp->last_rcvd < packet->header.this_id || minithread_msg_system()->replaying ) {
+			/* new msg, or one replayed again */
+			minimsg_msg_t msg = minimsg_msg_from_packet(packet);
 		
 			/* save address */
 			network_address_copy(addr, corresp->remote);
+			corresp->remote_handle = handle;
 
 			/* have corresp do delivery */
 			minimsg_corresp_deliver_msg(corresp, msg);
@@ -710,37 +1013,123 @@ void minimsg_net_data_handler(minimsg_msg_t packet, network_address_t addr) {
 
 void minimsg_net_timeout_handler(arg_t timeout_arg) {
 	minimsg_corresp_t corresp = (minimsg_corresp_t)timeout_arg;
-	minimsg_net_send_to_corresp(corresp);
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	/* the callback threads run with interrupts enabled, so the ack may
+	   have arrived, and freed the message, since the alarm was taken */
+	if ( corresp->pending ) {
+		minimsg_net_send_to_corresp(corresp);
+	}
+	set_interrupt_level(old_int);
 }
 
 
 int minimsg_net_send_to_corresp(minimsg_corresp_t corresp) {
+	char *packet;
+	int packet_len = minimsg_wire_pack(corresp->pending, &packet);
 	network_address_t zero;
 	network_address_zero(zero);
 	if ( network_address_same(corresp->remote, zero) || corresp->contact == MINIMSG_SYSTEM_PORT_BCAST_ID ) {
-		network_bcast_pkt(sizeof(struct minimsg_net_header) + sizeof(struct minimsg_header) + corresp->pending->header.msg_len, (char*)corresp->pending);
+		network_bcast_pkt(packet_len, packet);
 	} else {
-		network_send_pkt(corresp->remote, sizeof(struct minimsg_net_header) + sizeof(struct minimsg_header) + corresp->pending->header.msg_len, (char*)corresp->pending);
+		minimsg_net_send(corresp->remote, corresp->remote_handle, packet_len, packet);
 	}
 	dbgprintf("SEND: %d\n", *((int*)corresp->pending->body));
-	alarm_register(MINIMSG_ACK_TIMEOUT, minimsg_net_timeout_handler, (arg_t)corresp, &corresp->pending_timeout);
+	/* a timeout which fired after an ack let the next message be sent
+	   resends that one - keep just one timeout for it */
+	if ( corresp->pending_timeout != ALARM_ID_NONE ) {
+		alarm_deregister(corresp->pending_timeout);
+	}
+	alarm_register_slack(MINIMSG_ACK_TIMEOUT, MINIMSG_ACK_TIMEOUT_SLACK, minimsg_net_timeout_handler, (arg_t)corresp, &corresp->pending_timeout);
 
 	return 0;
 }
 
 
-int minimsg_net_send_ack(network_address_t addr, minimsg_port_t replying_to, minimsg_msgid_t concerning, minimsg_port_t me) {
-	minimsg_net_ack_t ack = malloc(sizeof(struct minimsg_net_ack));
+int minimsg_net_send_ack(network_address_t addr, network_handle_t handle, minimsg_port_t replying_to, minimsg_msgid_t concerning, minimsg_port_t me) {
+	struct minimsg_net_header net_header;
+	struct minimsg_header header;
+	char packet[MINIMSG_WIRE_HEADER_MAX];
+	int packet_len;
 
-	ack->net_header.system_id = MINIMSG_GROUP_ID;
-	ack->net_header.net_type = MINIMSG_NET_TYPE_ACK;
-	ack->net_header.to = replying_to;
-	ack->header.from = me;
-	ack->header.reply_to = concerning;
-	
-	network_send_pkt(addr, sizeof(struct minimsg_net_ack), (char*)ack);
+	net_header.system_id = MINIMSG_GROUP_ID;
+	net_header.net_type = MINIMSG_NET_TYPE_ACK;
+	net_header.to = replying_to;
+	header.from = me;
+	header.this_id = 0;
+	header.reply_to = concerning;
+	header.msg_len = 0;
+
+	packet_len = minimsg_wire_encode_header(&net_header, &header, packet);
+	minimsg_net_send(addr, handle, packet_len, packet);
+
+	return 0;
+}
+
+
+/* send to an address by its handle, which saves looking it up, or
+ * by the address itself if it could not be interned
+ */
+int minimsg_net_send(network_address_t addr, network_handle_t handle, int packet_len, char *packet) {
+	if ( handle != NETWORK_HANDLE_NONE ) {
+		return network_send_pkt_to_handle(handle, packet_len, packet);
+	}
+	return network_send_pkt(addr, packet_len, packet);
+}
+
+
+
+/* begin replay */
+
+/* body of a drain thread - receive and discard the messages
+ * delivered to a mailbox while replaying, until one of length -1
+ */
+int minimsg_replay_drain(arg_t arg) {
+	minimsg_mailbox_t box = (minimsg_mailbox_t)arg;
+	minimsg_msg_t msg;
+
+	for ( ;; ) {
+		msg = minimsg_mbox_receive_msg(box);
+		if ( msg->header.msg_len < 0 ) {
+			minimsg_msg_free(msg);
+			semaphore_V(minithread_msg_system()->replay_drained);
+			return 0;
+		}
+		minimsg_msg_free(msg);
+		box->replay_received++;
+	}
+}
+
+
+int minimsg_replay_drain_start(minimsg_mailbox_t box) {
+	box->replay_received = 0;
+	return minithread_fork(minimsg_replay_drain, (arg_t)box) ? 0 : -1;
+}
+
+
+/* create the port, with a drain thread, if it does not exist.
+ * called with interrupts disabled
+ */
+void minimsg_replay_port(minimsg_t msg_system, minimsg_port_t port) {
+	minimsg_mailbox_t box;
+	if ( minimsg_get_mbox(port) ) {
+		return;
+	}
+	box = minimsg_mbox_create_port(port);
+	if ( minimsg_replay_drain_start(box) != 0 ) {
+		minimsg_mbox_free(box);
+		return;
+	}
+	directory_add(msg_system->post_office, port, box);
+	queue_append(msg_system->replay_boxes, box);
+}
 
-	free(ack);
 
+/* end the drain thread of a mailbox, and count it in val */
+int minimsg_replay_iterate_end(any_t val_cur, any_t val) {
+	minimsg_mailbox_t box = (minimsg_mailbox_t)val_cur;
+	minimsg_msg_t end = malloc(sizeof(struct minimsg_msg));
+	end->header.msg_len = -1;
+	minimsg_mbox_deliver_msg(box, end);
+	(*(int*)val)++;
 	return 0;
 }
@@ -81,4 +81,23 @@ extern int minimsg_receive(minimsg_port_t me, minimsg_data_t msg, int *buffer_le
 extern int minimsg_rpc(minimsg_port_t me, minimsg_port_t to, int msg_len, minimsg_data_t msg, int *buffer_len_p);
 
 
+/* prepare for captured traffic to be replayed to this process
+ * (see network_replay). until minimsg_replay_stop, a message to
+ * a port which does not exist creates it, each such port and the
+ * system port are received from by a system thread which discards
+ * what it receives, and a message is delivered even if its id was
+ * seen before, so every round of a replay is delivered in full.
+ * on success, return 0. on failure, return -1.
+ */
+extern int minimsg_replay_start(void);
+
+
+/* wait until every message delivered while replaying has been
+ * received, then destroy the ports created for the replay.
+ * return the number of messages received, or -1 if no replay
+ * was started.
+ */
+extern int minimsg_replay_stop(void);
+
+
 #endif __MINIMSG_H__
@@ -3,13 +3,16 @@
  */
 
 #include "defs.h"
-#include "machineprimitives.h"
+#include "machineprimitives_ext.h"
 #include "interrupts.h"
+#include "interrupts_private.h"
 
 #include "queue.h"
 #include "synch.h"
 #include "multilevel_queue.h"
+#include "network.h"
 #include "minithread_private.h"
+#include "trace.h"
 
 
 /* System Configuration Constants
@@ -20,8 +23,10 @@
  * the MILLISECOND define as a multiplier
  *
  * ***** ticks ***** is global variable which is declared in
- * interrupts.h and which tells how many PERIODs have elapsed
- * since the clock interrupts were started. it is your friend.
+ * interrupts.h and which tells how many clock interrupts there
+ * have been. times are measured in nanoseconds, from
+ * currentTimeNanos, so that they mean the same whether the
+ * clock is periodic or tickless (CLOCK_TICKLESS).
  */
 
 
@@ -40,15 +45,60 @@
 // define how much time (microseconds) is in a long quanta
 #define LONG_QUANTA_MS (LONG_QUANTA * PERIOD)
 
+// define how much time (nanoseconds) is in a short and a long quanta
+#define SHORT_QUANTA_NS ((__int64)SHORT_QUANTA_MS * 1000)
+#define LONG_QUANTA_NS ((__int64)LONG_QUANTA_MS * 1000)
+
 // define priority of short running thread
 #define PRIORITY_SHORT (0)
 
 // define priority of long running thread
 #define PRIORITY_LONG (1)
 
+// define how many priority levels the ready queues have (up to 1024, at no cost in schedule time)
+#define PRIORITY_LEVELS (2)
+
 // define age (in periods) at which long running thread is promoted to short
 #define PROMOTE_AGE (2 * LONG_QUANTA_SHORTS)
 
+// define the same age in nanoseconds
+#define PROMOTE_AGE_NS ((__int64)PROMOTE_AGE * PERIOD * 1000)
+
+// define whether the idle thread busy polls the network (1) or leaves it to interrupts (0)
+#define IDLE_BUSY_POLL (0)
+
+// define how long (microseconds) the idle thread busy polls before blocking until an interrupt
+#define IDLE_BUSY_POLL_SPIN (200)
+
+// define how many OS worker threads run minithreads. with 1 every minithread
+// runs on the system thread; with more, each worker has its own ready queue
+// and a worker with nothing to run steals from the others
+#define MINITHREAD_WORKERS (1)
+
+// define the stack size (bytes) of a thread created without one. stacks
+// have a guard page below them, so an overflow faults rather than
+// corrupting memory
+#define STACK_SIZE_DEFAULT (64 * 1024)
+
+// define the stack size classes: sizes up to the largest class are rounded
+// up to a power of 2, from 2^STACK_CLASS_MIN_SHIFT, and freed stacks of a
+// class are kept for reuse
+#define STACK_CLASS_MIN_SHIFT (14)
+#define STACK_CLASSES (8)
+
+// define how many freed stacks of each class are kept
+#define STACK_CACHE_DEPTH (32)
+
+// define how many thread-specific keys can be created, and how many of
+// them have their values stored in the thread itself - the values of the
+// rest are in an array allocated on first use
+#define KEYS_MAX (64)
+#define KEYS_INLINE (8)
+
+// define how many times the destructors are run over a thread's values,
+// since a destructor may set another
+#define KEY_DESTRUCTOR_PASSES (4)
+
 
 
 // Data Structures and System State
@@ -57,28 +107,101 @@ struct minithread {
 	int id;
 	stack_pointer_t sp;
 	stack_pointer_t sb;
+	stack_pointer_t st;
+	int stack_size;
 	int priority;
-	long age;
+	__int64 age;
+	proc_t proc;
+	arg_t arg;
+	int interrupt_depth;
+	queue_link_t link; // on the stopped or dead queue
+	int exit_value; // returned by proc
+	int exited;
+	int detached; // freed by the idle thread when it exits, not joined
+	minithread_t joiner; // stopped in minithread_join, waiting for this thread
+	void* specific[KEYS_INLINE]; // values of the first keys
+	void** specific_more; // values of the rest, or NULL
+	minithread_t system_next; // the next system thread, if this is one
+	int inherited; // a priority lent by a thread waiting on a mutex it holds, or -1
+	iqueue_t boosting; // the mutexes it holds which threads wait for
 };
 
-// The currently executing minithread
-minithread_t current = NULL;
-minithread_t idle = NULL;
+// A worker is an OS thread running minithreads - worker 0 is the
+// system thread, and is the only one which takes interrupts
+struct worker {
+	int index;
+	HANDLE os_thread;
+	minithread_t current;
+	minithread_t idle;
+	multilevel_queue_t ready_queue;
+	__int64 quanta_end;
+	HANDLE wake; // set to wake the worker when it sleeps, with nothing to run
+	volatile LONG sleeping;
+};
+typedef struct worker* worker_t;
+
+// All the workers, and the one running on this OS thread
+struct worker workers[MINITHREAD_WORKERS];
+__declspec(thread) worker_t this_worker = NULL;
+
+// Threads interrupted on worker 0, which must return from
+// the interrupt there, so are never stolen
+multilevel_queue_t pinned_queue;
+
+// Set while the other workers should keep running
+char workers_up;
+
+// Set from waking a sleeping worker until it is awake, so that a
+// burst of threads made ready wakes one worker, not all of them
+volatile LONG worker_waking;
+
+// Set while the idle thread waits, with the deadline it waits for
+// (or -1), which is only changed with interrupts disabled. only
+// what would end the wait sooner wakes it
+volatile LONG idle_sleeping;
+__int64 idle_deadline;
+
+// With several workers, the OS thread id of the worker holding the
+// kernel lock, or 0
+volatile LONG kernel_lock_owner;
+
+// The number of threads created and not yet freed
+int thread_count;
+
+// A freed stack kept for reuse - the entry is stored at the top of the
+// stack itself
+struct stack_cache_entry {
+	stack_pointer_t base;
+	stack_pointer_t top;
+	struct stack_cache_entry* next;
+};
 
-// The ready queue of threads
-multilevel_queue_t ready_queue;
+// The freed stacks of each size class
+struct stack_cache {
+	struct stack_cache_entry* first;
+	int count;
+} stack_cache[STACK_CLASSES];
 
 // the stopped queue
-queue_t stop_queue;
+iqueue_t stop_queue;
 
 // A queue of threads which have died, and need to be freed
-queue_t dead_queue;
+iqueue_t dead_queue;
+
+// Joinable threads which have died and given up their stacks, but
+// have not been joined yet
+iqueue_t exited_queue;
 
 // The id of the last created thread
 int last_id;
 
-// the ticks at which the current quanta ends
-long current_quanta_end;
+// Threads created by the system itself, which are not counted in
+// thread_count, and are freed with the system
+minithread_t system_threads;
+
+// The number of keys created, and their destructors
+int key_count;
+void (*key_destructors[KEYS_MAX])(void*);
 
 minimsg_t msg_system;
 
@@ -103,11 +226,24 @@ alarm_t alarm_system;
  * (definitions at bottom of file)
  */
 int minithread_idle(void);
+int WINAPI minithread_worker(void* arg);
+int minithread_begin(arg_t arg);
+void minithread_switched(void);
 void minithread_awaken_callback(arg_t arg);
 void minithread_clock_handler(void *arg);
+int minithread_ready(minithread_t thread, int priority);
+int minithread_has_ready(void);
+void minithread_wake_workers(void);
+minithread_t minithread_steal(worker_t thief);
 int minithread_schedule(void);
+int minithread_switch_to(minithread_t next);
 int minithread_age(multilevel_queue_t queue);
+int minithread_stack_class(int* size_p);
+int minithread_stack_get(minithread_t thread, int size);
+void minithread_stack_put(minithread_t thread);
+void minithread_stack_cache_free(void);
 int minithread_free(minithread_t thread);
+void minithread_key_destruct(minithread_t thread);
 int minithread_cleanup(arg_t arg);
 int minithread_system_cleanup(void);
 
@@ -133,6 +269,20 @@ minithread_t minithread_fork(proc_t proc, arg_t arg) {
 }
 
 
+/*
+ *	Create and schedule a new thread, as minithread_fork, which
+ *  is kept after it exits until it is joined.
+ */
+minithread_t minithread_fork_joinable(proc_t proc, arg_t arg) {
+	minithread_t new_thread = minithread_create(proc, arg);
+	if (new_thread == NULL)
+		return NULL;
+	new_thread->detached = 0;
+	minithread_start(new_thread);
+	return new_thread;
+}
+
+
 /*
  *	Create a new thread, but do not schedule it for execution.
  *  After start is called on the thread it will be added to
@@ -142,16 +292,44 @@ minithread_t minithread_fork(proc_t proc, arg_t arg) {
  *  argument.
  */
 minithread_t minithread_create(proc_t proc, arg_t arg) {
+	return minithread_create_ex(proc, arg, 0);
+}
+
+
+/*
+ *	Create a new thread, as minithread_create, with a stack of
+ *  stack_size bytes - 0 for the default size.
+ */
+minithread_t minithread_create_ex(proc_t proc, arg_t arg, int stack_size) {
 	minithread_t new_thread = (minithread_t)malloc(sizeof(struct minithread));
-	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	interrupt_level_t old_int;
 	if (new_thread == NULL)
 		return NULL;
+	old_int = set_interrupt_level(DISABLED);
+	if ( minithread_stack_get(new_thread, stack_size) != 0 ) {
+		set_interrupt_level(old_int);
+		free(new_thread);
+		return NULL;
+	}
 	new_thread->id = ++last_id;
 	new_thread->priority = PRIORITY_SHORT;
-	minithread_allocate_stack(&(new_thread->sb), &(new_thread->sp));
-	minithread_initialize_stack(&(new_thread->sp), proc, arg, minithread_cleanup, NULL);
+	new_thread->proc = proc;
+	new_thread->arg = arg;
+	new_thread->interrupt_depth = 0;
+	new_thread->exit_value = 0;
+	new_thread->exited = 0;
+	new_thread->detached = 1;
+	new_thread->joiner = NULL;
+	memset(new_thread->specific, 0, sizeof(new_thread->specific));
+	new_thread->specific_more = NULL;
+	new_thread->system_next = NULL;
+	new_thread->inherited = -1;
+	iqueue_init(&(new_thread->boosting));
+	iqueue_link_init(&(new_thread->link));
+	minithread_initialize_stack(&(new_thread->sp), minithread_begin, (arg_t)new_thread, minithread_cleanup, NULL);
 	if ( proc ) {
-		queue_append(stop_queue, new_thread);
+		iqueue_append(&stop_queue, &(new_thread->link));
+		thread_count++;
 	}
 	set_interrupt_level(old_int);
 	return new_thread;
@@ -162,7 +340,9 @@ minithread_t minithread_create(proc_t proc, arg_t arg) {
  *	Return handle (minithread_t) of calling thread.
  */
 minithread_t minithread_self() {
-	return current;
+	// a thread only changes worker at a switch it makes itself, or,
+	// if preempted, comes back to the same worker
+	return this_worker->current;
 }
 
 
@@ -170,7 +350,7 @@ minithread_t minithread_self() {
  *  Return thread identifier of calling thread.
  */
 int minithread_id() {
-	return current->id;
+	return minithread_self()->id;
 }
 
 
@@ -185,8 +365,10 @@ int minithread_id() {
  */
 int minithread_stop() {
 	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	current->priority = PRIORITY_SHORT;
-	queue_append(stop_queue, current);
+	minithread_t self = this_worker->current;
+	self->priority = PRIORITY_SHORT;
+	iqueue_append(&stop_queue, &(self->link));
+	TRACE_EVENT(TRACE_STOP, self->id, 0);
 	minithread_schedule();
 	return 0;
 }
@@ -197,25 +379,150 @@ int minithread_stop() {
  */
 int minithread_start(minithread_t thread) {
 	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	if ( 0 == queue_delete(stop_queue, thread) )
+	if ( 0 == iqueue_delete(&stop_queue, &(thread->link)) )
 	{
-		thread->age = ticks;
-		multilevel_queue_enqueue(ready_queue, current->priority, thread);
+		thread->age = currentTimeNanos();
+		TRACE_EVENT(TRACE_START, thread->id, 0);
+		minithread_ready(thread, this_worker->current->priority);
+	}
+	set_interrupt_level(old_int);
+	return 0;
+}
+
+
+/*
+ *	Wait for thread to exit, and free it. If exit_value_p
+ *  is not NULL, the value thread's proc returned is stored there.
+ */
+int minithread_join(minithread_t thread, int* exit_value_p) {
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	minithread_t self = this_worker->current;
+	if ( thread == NULL || thread == self || thread->detached || thread->joiner ) {
+		set_interrupt_level(old_int);
+		return -1;
+	}
+
+	thread->joiner = self;
+	while ( !thread->exited ) {
+		// the thread switches straight to us when it exits
+		minithread_stop();
+		set_interrupt_level(DISABLED);
+	}
+
+	// exited threads are switched out with interrupts disabled, so it is
+	// no longer running - free it here unless the idle thread already has
+	// its stack
+	if ( 0 == iqueue_delete(&dead_queue, &(thread->link)) ) {
+		thread_count--;
+	} else {
+		iqueue_delete(&exited_queue, &(thread->link));
+	}
+	if ( exit_value_p ) {
+		*exit_value_p = thread->exit_value;
+	}
+	set_interrupt_level(old_int);
+	minithread_free(thread);
+	return 0;
+}
+
+
+/*
+ *	Let thread be freed as soon as it exits, rather than
+ *  waiting to be joined.
+ */
+int minithread_detach(minithread_t thread) {
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	if ( thread == NULL || thread->detached || thread->joiner ) {
+		set_interrupt_level(old_int);
+		return -1;
+	}
+
+	thread->detached = 1;
+	if ( thread->exited ) {
+		// nothing will join it now, so free it
+		if ( 0 == iqueue_delete(&dead_queue, &(thread->link)) ) {
+			thread_count--;
+		} else {
+			iqueue_delete(&exited_queue, &(thread->link));
+		}
+		set_interrupt_level(old_int);
+		minithread_free(thread);
+		return 0;
+	}
+	set_interrupt_level(old_int);
+	return 0;
+}
+
+
+/*
+ *	Create a key for thread-specific values, which are NULL
+ *  until set.
+ */
+int minithread_key_create(minithread_key_t* key_p, void (*destructor)(void*)) {
+	interrupt_level_t old_int;
+	if ( key_p == NULL ) {
+		return -1;
+	}
+	old_int = set_interrupt_level(DISABLED);
+	if ( key_count == KEYS_MAX ) {
+		set_interrupt_level(old_int);
+		return -1;
 	}
+	key_destructors[key_count] = destructor;
+	*key_p = key_count++;
 	set_interrupt_level(old_int);
 	return 0;
 }
 
 
+/*
+ *	Return the calling thread's value for key.
+ */
+void* minithread_getspecific(minithread_key_t key) {
+	minithread_t self = minithread_self();
+	if ( key >= 0 && key < KEYS_INLINE ) {
+		return self->specific[key];
+	}
+	if ( key < 0 || key >= key_count || self->specific_more == NULL ) {
+		return NULL;
+	}
+	return self->specific_more[key - KEYS_INLINE];
+}
+
+
+/*
+ *	Set the calling thread's value for key.
+ */
+int minithread_setspecific(minithread_key_t key, void* value) {
+	minithread_t self = minithread_self();
+	if ( key < 0 || key >= key_count ) {
+		return -1;
+	}
+	if ( key < KEYS_INLINE ) {
+		self->specific[key] = value;
+		return 0;
+	}
+	if ( self->specific_more == NULL ) {
+		self->specific_more = (void**)calloc(KEYS_MAX - KEYS_INLINE, sizeof(void*));
+		if ( self->specific_more == NULL ) {
+			return -1;
+		}
+	}
+	self->specific_more[key - KEYS_INLINE] = value;
+	return 0;
+}
+
+
 /*
  *	Forces the caller to relinquish the processor and be put to the end of
  *	the ready queue.  Allows another thread to run.
  */
 int minithread_yield() {
 	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	current->priority = PRIORITY_SHORT;
-	current->age = ticks;
-	multilevel_queue_enqueue(ready_queue, current->priority, current);
+	minithread_t self = this_worker->current;
+	self->priority = PRIORITY_SHORT;
+	self->age = currentTimeNanos();
+	minithread_ready(self, self->priority);
 	minithread_schedule();
 	return 0;
 }
@@ -247,7 +554,7 @@ int minithread_unlock_and_stop(tas_lock_t *lock) {
  */
 int minithread_sleep_with_timeout(int delay) {
 	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	alarm_register(delay, minithread_awaken_callback, (arg_t)current, NULL);
+	alarm_register(delay, minithread_awaken_callback, (arg_t)this_worker->current, NULL);
 	minithread_stop();
 	set_interrupt_level(old_int);
 	return 0;
@@ -261,19 +568,51 @@ int minithread_sleep_with_timeout(int delay) {
  *	as arguments.
  */
 int minithread_system_initialize(proc_t mainproc, arg_t mainarg) {
+	int i;
+	DWORD id;
+
 	dbgprintf("Initializing minisystem...\n");
-	ready_queue = multilevel_queue_new(2, 0);
-	stop_queue = queue_new();
-	dead_queue = queue_new();
 
-	if (!ready_queue || !stop_queue || !dead_queue ) {
+	// interrupts stay disabled until the first switch
+	set_interrupt_level(DISABLED);
+
+	for ( i = 0; i < MINITHREAD_WORKERS; i++ ) {
+		workers[i].index = i;
+		workers[i].os_thread = NULL;
+		workers[i].current = workers[i].idle = NULL;
+		workers[i].ready_queue = multilevel_queue_new(PRIORITY_LEVELS, MQ_LEVEL_ASCEND);
+		workers[i].quanta_end = 0;
+		workers[i].wake = NULL;
+		workers[i].sleeping = 0;
+		if ( i > 0 ) {
+			workers[i].wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+		}
+		if ( !workers[i].ready_queue ) {
+			return 0;
+		}
+	}
+	worker_waking = 0;
+	idle_sleeping = 0;
+	idle_deadline = -1;
+	pinned_queue = multilevel_queue_new(PRIORITY_LEVELS, MQ_LEVEL_ASCEND);
+	iqueue_init(&stop_queue);
+	iqueue_init(&dead_queue);
+	iqueue_init(&exited_queue);
+
+	if ( !pinned_queue ) {
 		return 0;
 	}
 
 	last_id = 0;
-	current_quanta_end = 0;
-
-	current = idle = minithread_create(NULL, NULL);
+	thread_count = 0;
+	system_threads = NULL;
+	key_count = 0;
+
+	// the system thread is worker 0. interrupts have not been
+	// started yet
+	this_worker = &workers[0];
+	TRACE_WORKER_INITIALIZE(0);
+	workers[0].current = workers[0].idle = minithread_create(NULL, NULL);
 	minithread_fork(mainproc, mainarg);
 
 	// initialize alarm subsystem
@@ -286,12 +625,29 @@ int minithread_system_initialize(proc_t mainproc, arg_t mainarg) {
 	// initialize message passing subsystem
 	msg_system = minimsg_system_initialize();
 
+	// start the other workers, which steal from worker 0 to begin with
+	workers_up = 1;
+	for ( i = 1; i < MINITHREAD_WORKERS; i++ ) {
+		workers[i].os_thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)minithread_worker, &workers[i], 0, &id);
+		assert(workers[i].os_thread != NULL);
+	}
+
 	// schedule will call switch, which will enable interrupts
 	minithread_schedule();
 
 	// begin idle thread body
 	minithread_idle();
 
+	// no threads are left, so the other workers are idle - stop them
+	workers_up = 0;
+	for ( i = 1; i < MINITHREAD_WORKERS; i++ ) {
+		SetEvent(workers[i].wake);
+		WaitForSingleObject(workers[i].os_thread, INFINITE);
+		CloseHandle(workers[i].os_thread);
+		CloseHandle(workers[i].wake);
+	}
+	TRACE_EXPORT(TRACE_FILE);
+
 	// system is shutting down now
 	set_interrupt_level(DISABLED);
 
@@ -323,31 +679,142 @@ int minithread_system_initialize(proc_t mainproc, arg_t mainarg) {
  * Idle / System thread body
  */
 int minithread_idle(void) {
-	int i;
-	while ( multilevel_queue_length(ready_queue) || queue_length(stop_queue) || queue_length(dead_queue) || alarm_has_remaining() ) {
-			while ( alarm_has_ready() ) {
-				alarm_fire_next();
+	queue_link_t *kill_link;
+	minithread_t dead;
+	interrupt_level_t old_int;
+	__int64 deadline;
+	int reaped;
+
+	while ( thread_count || alarm_has_remaining() ) {
+			// due alarms are fired by the alarm callback threads
+			alarm_dispatch();
+			// join and detach take threads off the dead queue too, so it is
+			// only checked with interrupts disabled
+			reaped = 0;
+			old_int = set_interrupt_level(DISABLED);
+			while ( iqueue_dequeue(&dead_queue, &kill_link) == 0 ) {
+				thread_count--;
+				reaped++;
+				dead = queue_item(kill_link, struct minithread, link);
+				if ( dead->detached ) {
+					set_interrupt_level(old_int);
+					minithread_free(dead);
+				} else {
+					// keep it for minithread_join, but not its stack
+					minithread_stack_put(dead);
+					dead->sb = NULL;
+					iqueue_append(&exited_queue, &(dead->link));
+					set_interrupt_level(old_int);
+				}
+				old_int = set_interrupt_level(DISABLED);
 			}
-			while ( queue_length(dead_queue) ) {
-				minithread_t kill_thread;
-				interrupt_level_t old_int = set_interrupt_level(DISABLED);
-				queue_dequeue(dead_queue, &kill_thread);
-				set_interrupt_level(old_int);
-				minithread_free(kill_thread);
+			set_interrupt_level(old_int);
+			if ( reaped ) {
+				// the last thread may have been reaped
+				continue;
 			}
-			if ( multilevel_queue_length(ready_queue) ) {
-				interrupt_level_t old_int = set_interrupt_level(DISABLED);
+			if ( minithread_has_ready() ) {
+				old_int = set_interrupt_level(DISABLED);
 				minithread_schedule();
+				continue;
 			}
-			i = 0;
-			while ( i < 100000 ) {
-				i++;
+#if IDLE_BUSY_POLL
+			// spin on the socket rather than waiting for a network interrupt
+			if ( network_busy_poll(IDLE_BUSY_POLL_SPIN) ) {
+				continue;
+			}
+#endif
+			// nothing to do until an interrupt makes a thread ready or the
+			// next alarm is due. the checks are made again with interrupts
+			// disabled, as anything which would wake us is done, so a change
+			// since those above is either seen here or sees idle_sleeping.
+			// an interrupt which arrived since has already set the wake, so
+			// the wait returns at once
+			old_int = set_interrupt_level(DISABLED);
+			if ( minithread_has_ready() || iqueue_length(&dead_queue) ) {
+				set_interrupt_level(old_int);
+				continue;
 			}
+			if ( !alarm_has_ready() ) {
+				deadline = alarm_next_deadline();
+			} else if ( !alarm_has_waiting() ) {
+				// alarms are due but every callback thread is busy - the
+				// first to finish wakes us
+				deadline = -1;
+			} else {
+				set_interrupt_level(old_int);
+				continue;
+			}
+			idle_deadline = deadline;
+			InterlockedExchange(&idle_sleeping, 1);
+			set_interrupt_level(old_int);
+			interrupt_wait(deadline);
+			InterlockedExchange(&idle_sleeping, 0);
 	}
 	return 0;
 }
 
 
+/*
+ * Worker thread body - each worker other than the system
+ * thread runs minithreads from here until shutdown
+ */
+int WINAPI minithread_worker(void* arg) {
+	interrupt_level_t old_int;
+
+	this_worker = (worker_t)arg;
+	this_worker->current = this_worker->idle = minithread_create(NULL, NULL);
+
+	old_int = set_interrupt_level(DISABLED);
+	TRACE_WORKER_INITIALIZE(this_worker->index);
+	set_interrupt_level(old_int);
+
+	while ( workers_up ) {
+		if ( minithread_has_ready() ) {
+			set_interrupt_level(DISABLED);
+			minithread_schedule();
+		} else {
+			// sleep until a thread is made ready. minithread_wake_workers
+			// looks for sleepers after queueing the thread, so one made
+			// ready after this check still wakes us
+			InterlockedExchange(&(this_worker->sleeping), 1);
+			if ( !minithread_has_ready() && workers_up ) {
+				WaitForSingleObject(this_worker->wake, INFINITE);
+				// the next thread made ready may wake another worker
+				InterlockedExchange(&worker_waking, 0);
+			}
+			InterlockedExchange(&(this_worker->sleeping), 0);
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Thread Begin - every thread starts here, on whichever
+ * worker first switched to it
+ */
+int minithread_begin(arg_t arg) {
+	minithread_t thread = (minithread_t)arg;
+	minithread_switched();
+	thread->exit_value = thread->proc(thread->arg);
+	return thread->exit_value;
+}
+
+
+/*
+ * Called by a thread as soon as it is switched to. the switch
+ * itself re-enables interrupts; with several workers this also
+ * hands back the kernel lock the switching worker held
+ */
+void minithread_switched(void) {
+	if ( MINITHREAD_WORKERS > 1 ) {
+		set_interrupt_level(ENABLED);
+	}
+}
+
+
 /*
  * Thread Awaken Callback - for sleep with timeout
  */
@@ -357,38 +824,161 @@ void minithread_awaken_callback(arg_t arg) {
 
 
 /*
- * Clock Interrupt Handler
+ * Clock Interrupt Handler - hands due alarms to the alarm callback
+ * threads, and preempts the running thread when its quantum is
+ * over, or so that a callback thread can run
  */
 void minithread_clock_handler(void *arg) {
-	if ( ticks >= current_quanta_end ) {
-		current->priority = PRIORITY_LONG;
-		current->age = ticks;
-		multilevel_queue_enqueue(ready_queue, current->priority, current);
+	// only the system thread, worker 0, is ever interrupted
+	minithread_t self = this_worker->current;
+	__int64 now = currentTimeNanos();
+	int dispatched = alarm_dispatch();
+	if ( self != this_worker->idle && (now >= this_worker->quanta_end || dispatched) ) {
+		minithread_interrupt_enter();
+		if ( now >= this_worker->quanta_end ) {
+			self->priority = PRIORITY_LONG;
+			self->age = now;
+		}
+		minithread_ready(self, self->priority);
 		minithread_schedule();
+		minithread_interrupt_exit();
+	} else {
+		// a tickless clock only interrupts when programmed to
+		minithread_clock_program();
+	}
+}
+
+
+/*
+ * Thread Ready - put the thread on a ready queue. a thread with
+ * an interrupt frame on its stack has to return from the interrupt
+ * on the system thread, so it is pinned to worker 0 until then
+ */
+int minithread_ready(minithread_t thread, int priority) {
+	int ret;
+	if ( thread->inherited != -1 && thread->inherited < priority ) {
+		priority = thread->inherited;
+	}
+	if ( MINITHREAD_WORKERS > 1 && thread->interrupt_depth ) {
+		ret = multilevel_queue_enqueue(pinned_queue, priority, thread);
+		minithread_wake_idle();
+		return ret;
+	}
+	ret = multilevel_queue_enqueue(this_worker->ready_queue, priority, thread);
+	minithread_wake_workers();
+	return ret;
+}
+
+
+/*
+ * Wake Workers - wake a sleeping worker, other than the system
+ * thread, to steal a thread just made ready
+ */
+void minithread_wake_workers(void) {
+	int i;
+	// a worker being woken already will steal the thread, or wake
+	// another worker for the next
+	if ( MINITHREAD_WORKERS == 1 || InterlockedCompareExchange(&worker_waking, 1, 0) != 0 ) {
+		return;
 	}
+	for ( i = 1; i < MINITHREAD_WORKERS; i++ ) {
+		// the exchange is also a barrier, so the worker sees the thread
+		// queued if it is checking again before it sleeps
+		if ( InterlockedCompareExchange(&(workers[i].sleeping), 0, 1) == 1 ) {
+			SetEvent(workers[i].wake);
+			return;
+		}
+	}
+	InterlockedExchange(&worker_waking, 0);
 }
 
 
 /*
- * Scheduler function
+ * Has Ready - whether this worker would find a thread to run,
+ * either of its own or by stealing one
+ */
+int minithread_has_ready(void) {
+	int i;
+	if ( this_worker->index == 0 && multilevel_queue_length(pinned_queue) ) {
+		return 1;
+	}
+	for ( i = 0; i < MINITHREAD_WORKERS; i++ ) {
+		if ( multilevel_queue_length(workers[i].ready_queue) ) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Steal - take the next ready thread from another worker, trying
+ * them in turn starting with the one after the thief, so that
+ * thieves spread across victims
+ */
+minithread_t minithread_steal(worker_t thief) {
+	minithread_t thread = NULL;
+	int i;
+	for ( i = 1; i < MINITHREAD_WORKERS; i++ ) {
+		worker_t victim = &workers[(thief->index + i) % MINITHREAD_WORKERS];
+		if ( multilevel_queue_length(victim->ready_queue) > 0 ) {
+			multilevel_queue_dequeue(victim->ready_queue, PRIORITY_SHORT, (any_t*)&thread);
+			return thread;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ * Scheduler function - called with interrupts disabled, which with
+ * several workers means holding the kernel lock, so no other
+ * worker can pick up the old thread until the switch is done
  */
 int minithread_schedule(void) {
-	minithread_t old = current;
-	if ( alarm_has_ready() && old != idle ) {
-		current = idle;
-	} else if(multilevel_queue_length(ready_queue)>0) {
-		minithread_age(ready_queue);
-		multilevel_queue_dequeue(ready_queue, PRIORITY_SHORT, &current);
+	worker_t worker = this_worker;
+	minithread_t next = NULL;
+
+	if ( worker->index == 0 && multilevel_queue_length(pinned_queue) > 0 ) {
+		minithread_age(pinned_queue);
+		multilevel_queue_dequeue(pinned_queue, PRIORITY_SHORT, (any_t*)&next);
+	} else if ( multilevel_queue_length(worker->ready_queue) > 0 ) {
+		minithread_age(worker->ready_queue);
+		multilevel_queue_dequeue(worker->ready_queue, PRIORITY_SHORT, (any_t*)&next);
 	} else {
-		current = idle;
+		next = minithread_steal(worker);
+	}
+
+	if ( next == NULL ) {
+		next = worker->idle;
 	}
+	return minithread_switch_to(next);
+}
+
+
+/*
+ * Switch to next, which must not be on any queue - called with
+ * interrupts disabled
+ */
+int minithread_switch_to(minithread_t next) {
+	worker_t worker = this_worker;
+	minithread_t old = worker->current;
+
+	worker->current = next;
 
-	if ( current->priority == PRIORITY_SHORT ) {
-		current_quanta_end = ticks + SHORT_QUANTA;
+	if ( next->priority == PRIORITY_SHORT ) {
+		worker->quanta_end = currentTimeNanos() + SHORT_QUANTA_NS;
 	} else {
-		current_quanta_end = ticks + LONG_QUANTA;
+		worker->quanta_end = currentTimeNanos() + LONG_QUANTA_NS;
 	}
-	minithread_switch(&(old->sp), &(current->sp));
+	if ( worker->index == 0 ) {
+		minithread_clock_program();
+	}
+	TRACE_EVENT(TRACE_SWITCH, old->id, next->id);
+	minithread_switch(&(old->sp), &(next->sp));
+
+	// running as old again, perhaps on another worker
+	minithread_switched();
 	return 0;
 }
 
@@ -402,8 +992,9 @@ int minithread_schedule(void) {
  */
 int minithread_age(multilevel_queue_t queue) {
 	minithread_t thread = NULL;
+	__int64 now = currentTimeNanos();
 	int ret = multilevel_queue_peak(queue, PRIORITY_LONG, (any_t*)&thread);
-	while( ret != -1 && thread && ((ticks - thread->age) >= PROMOTE_AGE) ) {
+	while( ret != -1 && thread && ((now - thread->age) >= PROMOTE_AGE_NS) ) {
 		if ( multilevel_queue_dequeue(queue, PRIORITY_LONG, (any_t*)&thread) != -1 ) {
 			// reset priority but age stays the same
 			thread->priority = PRIORITY_SHORT;
@@ -415,27 +1006,170 @@ int minithread_age(multilevel_queue_t queue) {
 }
 
 
+/*
+ * Stack Class - the size class of a stack of *size_p bytes, which
+ * is rounded up to the class size, or -1 if it is too big for one
+ */
+int minithread_stack_class(int* size_p) {
+	int class_size = 1 << STACK_CLASS_MIN_SHIFT;
+	int i;
+	for ( i = 0; i < STACK_CLASSES; i++, class_size <<= 1 ) {
+		if ( *size_p <= class_size ) {
+			*size_p = class_size;
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/*
+ * Stack Get - give the thread a stack of (at least) size bytes,
+ * reusing a freed one when there is one. called with interrupts
+ * disabled. returns 0 on success, -1 on failure
+ */
+int minithread_stack_get(minithread_t thread, int size) {
+	int class_index;
+	struct stack_cache_entry* entry;
+
+	if ( size <= 0 ) {
+		size = STACK_SIZE_DEFAULT;
+	}
+	class_index = minithread_stack_class(&size);
+	thread->stack_size = size;
+
+	if ( class_index != -1 && stack_cache[class_index].first ) {
+		entry = stack_cache[class_index].first;
+		stack_cache[class_index].first = entry->next;
+		stack_cache[class_index].count--;
+		thread->sb = entry->base;
+		thread->st = entry->top;
+	} else {
+		minithread_allocate_stack_size(&(thread->sb), &(thread->st), size);
+		if ( !thread->sb ) {
+			return -1;
+		}
+	}
+	thread->sp = thread->st;
+	return 0;
+}
+
+
+/*
+ * Stack Put - release a dead thread's stack, keeping it for reuse
+ * if its class has room
+ */
+void minithread_stack_put(minithread_t thread) {
+	int size = thread->stack_size;
+	int class_index = minithread_stack_class(&size);
+	struct stack_cache_entry* entry;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+
+	if ( class_index != -1 && stack_cache[class_index].count < STACK_CACHE_DEPTH ) {
+		entry = (struct stack_cache_entry*)((char*)thread->st - sizeof(struct stack_cache_entry));
+		entry->base = thread->sb;
+		entry->top = thread->st;
+		entry->next = stack_cache[class_index].first;
+		stack_cache[class_index].first = entry;
+		stack_cache[class_index].count++;
+	} else {
+		minithread_free_stack_size(thread->sb, thread->stack_size);
+	}
+	set_interrupt_level(old_int);
+}
+
+
+/*
+ * Stack Cache Free - release every stack kept for reuse
+ */
+void minithread_stack_cache_free(void) {
+	struct stack_cache_entry* entry;
+	int class_size = 1 << STACK_CLASS_MIN_SHIFT;
+	int i;
+	for ( i = 0; i < STACK_CLASSES; i++, class_size <<= 1 ) {
+		while ( stack_cache[i].first ) {
+			entry = stack_cache[i].first;
+			stack_cache[i].first = entry->next;
+			minithread_free_stack_size(entry->base, class_size);
+		}
+		stack_cache[i].count = 0;
+	}
+}
+
+
 /*
  * Free memory for the argument thread.
  */
 int minithread_free(minithread_t thread) {
 	if ( thread->sb ) {
-		minithread_free_stack(thread->sb);
+		minithread_stack_put(thread);
+	}
+	if ( thread->specific_more ) {
+		free(thread->specific_more);
 	}
 	free(thread);
 	return 0;
 }
 
 
+/*
+ * Key Destruct - run the destructors of the thread's non-NULL
+ * values, each called with the value, which is cleared first
+ */
+void minithread_key_destruct(minithread_t thread) {
+	int pass;
+	int key;
+	int found = 1;
+	void** value_p;
+	void* value;
+
+	for ( pass = 0; found && pass < KEY_DESTRUCTOR_PASSES; pass++ ) {
+		found = 0;
+		for ( key = 0; key < key_count; key++ ) {
+			if ( key < KEYS_INLINE ) {
+				value_p = &(thread->specific[key]);
+			} else if ( thread->specific_more ) {
+				value_p = &(thread->specific_more[key - KEYS_INLINE]);
+			} else {
+				break;
+			}
+			value = *value_p;
+			if ( value && key_destructors[key] ) {
+				*value_p = NULL;
+				key_destructors[key](value);
+				found = 1;
+			}
+		}
+	}
+}
+
+
 /*
  * Called at the end of a thread's execution
  * Place the dead thread on the dead_threads queue
  * and give control to the next thread
  */
 int minithread_cleanup(arg_t arg) {
-	interrupt_level_t old_int = set_interrupt_level(DISABLED);
-	queue_append(dead_queue, current);
-	minithread_schedule();
+	interrupt_level_t old_int;
+	minithread_t self;
+	minithread_t joiner;
+
+	// destructors may block, so run them before exiting for good
+	minithread_key_destruct(minithread_self());
+
+	old_int = set_interrupt_level(DISABLED);
+	self = this_worker->current;
+	joiner = self->joiner;
+	self->exited = 1;
+	iqueue_append(&dead_queue, &(self->link));
+	if ( joiner && 0 == iqueue_delete(&stop_queue, &(joiner->link)) ) {
+		// hand the processor straight to the joiner, which frees us
+		TRACE_EVENT(TRACE_START, joiner->id, 0);
+		minithread_switch_to(joiner);
+	} else {
+		minithread_wake_idle();
+		minithread_schedule();
+	}
 	return 0;
 }
 
@@ -444,10 +1178,25 @@ int minithread_cleanup(arg_t arg) {
  * Cleanup all system state.
  */
 int minithread_system_cleanup(void) {
-	multilevel_queue_free(ready_queue);
-	queue_free(stop_queue);
-	queue_free(dead_queue);
-	minithread_free(idle);
+	int i;
+	for ( i = 0; i < MINITHREAD_WORKERS; i++ ) {
+		multilevel_queue_free(workers[i].ready_queue);
+		minithread_free(workers[i].idle);
+	}
+	multilevel_queue_free(pinned_queue);
+	while ( system_threads ) {
+		minithread_t thread = system_threads;
+		system_threads = thread->system_next;
+		iqueue_delete(&stop_queue, &(thread->link));
+		minithread_free(thread);
+	}
+	// threads which exited but were never joined
+	while ( iqueue_length(&exited_queue) ) {
+		queue_link_t *link;
+		iqueue_dequeue(&exited_queue, &link);
+		minithread_free(queue_item(link, struct minithread, link));
+	}
+	minithread_stack_cache_free();
 	dbgprintf("...minisystem cleaned up and shut down.\n");
 	return 0;
 }
@@ -463,3 +1212,111 @@ minimsg_t minithread_msg_system(void) {
 alarm_t minithread_alarm_system(void) {
 	return alarm_system;
 }
+
+void minithread_inherit_priority(minithread_t thread, minithread_t from) {
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	int priority = from->inherited != -1 && from->inherited < from->priority ? from->inherited : from->priority;
+	int i;
+
+	if ( thread->inherited == -1 || priority < thread->inherited ) {
+		thread->inherited = priority;
+		// if it is waiting to run, move it up its queue - this searches,
+		// but only when a thread blocks behind a lower priority one
+		if ( priority < thread->priority ) {
+			for ( i = 0; i < MINITHREAD_WORKERS; i++ ) {
+				if ( multilevel_queue_delete(workers[i].ready_queue, thread) == 0 ) {
+					multilevel_queue_enqueue(workers[i].ready_queue, priority, thread);
+					break;
+				}
+			}
+			if ( i == MINITHREAD_WORKERS && multilevel_queue_delete(pinned_queue, thread) == 0 ) {
+				multilevel_queue_enqueue(pinned_queue, priority, thread);
+			}
+		}
+	}
+	set_interrupt_level(old_int);
+}
+
+void minithread_restore_priority(minithread_t thread) {
+	thread->inherited = -1;
+}
+
+iqueue_t *minithread_boosting(minithread_t thread) {
+	return &(thread->boosting);
+}
+
+minithread_t minithread_create_system(proc_t proc, arg_t arg) {
+	minithread_t thread = minithread_create(proc, arg);
+	interrupt_level_t old_int;
+	if ( thread ) {
+		old_int = set_interrupt_level(DISABLED);
+		thread_count--;
+		thread->system_next = system_threads;
+		system_threads = thread;
+		set_interrupt_level(old_int);
+	}
+	return thread;
+}
+
+void minithread_interrupt_enter(void) {
+	this_worker->current->interrupt_depth++;
+}
+
+void minithread_interrupt_exit(void) {
+	this_worker->current->interrupt_depth--;
+}
+
+void minithread_clock_program(void) {
+#if CLOCK_TICKLESS
+	// the idle thread waits for alarms itself, so only a running
+	// thread needs the clock
+	worker_t system_worker = &workers[0];
+	__int64 deadline = -1;
+	if ( system_worker->current != system_worker->idle ) {
+		deadline = alarm_next_deadline();
+		if ( deadline == -1 || system_worker->quanta_end < deadline ) {
+			deadline = system_worker->quanta_end;
+		}
+	}
+	minithread_clock_set_deadline(deadline);
+#endif
+}
+
+void minithread_wake_idle(void) {
+	// on worker 0 the idle thread is not running, and checks again
+	// before it next waits
+	if ( this_worker->index != 0 && InterlockedCompareExchange(&idle_sleeping, 0, 1) == 1 ) {
+		interrupt_wake();
+	}
+}
+
+void minithread_wake_idle_by(__int64 deadline) {
+	if ( this_worker->index != 0 && idle_sleeping
+		&& (idle_deadline == -1 || deadline < idle_deadline) ) {
+		minithread_wake_idle();
+	}
+}
+
+
+/*
+ * The kernel lock - taken by set_interrupt_level as it disables
+ * interrupts, with more than one worker
+ */
+int minithread_kernel_locking(void) {
+	return MINITHREAD_WORKERS > 1;
+}
+
+void minithread_kernel_lock(void) {
+	LONG me = (LONG)GetCurrentThreadId();
+	while ( InterlockedCompareExchange(&kernel_lock_owner, me, 0) != 0 ) {
+		SwitchToThread();
+	}
+}
+
+void minithread_kernel_unlock(void) {
+	InterlockedExchange(&kernel_lock_owner, 0);
+}
+
+unsigned long minithread_kernel_lock_holder(void) {
+	return (unsigned long)kernel_lock_owner;
+}
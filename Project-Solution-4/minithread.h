@@ -18,27 +18,47 @@ typedef int (*proc_t)(arg_t);
 /* generic lock type */
 typedef int tas_lock_t;
 
+/* key for thread-specific values */
+typedef int minithread_key_t;
+
 
 /*
  *	Create and schedule a new thread of control. When the
  *  scheduler chooses the thread, it will start executing
  *  the function refered to by proc, with it being called
- *  with arg as the single argument.
+ *  with arg as the single argument. The thread is detached - it
+ *  is freed as soon as it exits, and cannot be joined.
  */	
 extern minithread_t minithread_fork(proc_t proc, arg_t arg);
 
 
+/*
+ *	Create and schedule a new thread, as minithread_fork, which
+ *  can be joined: when it exits it gives up its stack but keeps
+ *  its handle until it is joined or detached.
+ */
+extern minithread_t minithread_fork_joinable(proc_t proc, arg_t arg);
+
+
 /*
  *	Create a new thread, but do not schedule it for execution.
  *  After start is called on the thread it will be added to
  *  the scheduler. After this, when the scheduler chooses the
  *  the thread, it will start executing the function refered
  *  to by proc, with it being called with arg as the single
- *  argument.
+ *  argument. Like minithread_fork, the thread is detached.
  */
 extern minithread_t minithread_create(proc_t proc, arg_t arg);
 
 
+/*
+ *	Create a new thread, as minithread_create, but with a stack
+ *  of (at least) stack_size bytes, or the default size if it
+ *  is 0. Returns NULL if the stack cannot be allocated.
+ */
+extern minithread_t minithread_create_ex(proc_t proc, arg_t arg, int stack_size);
+
+
 /*
  *	Return handle (minithread_t) of calling thread.
  */
@@ -69,6 +89,51 @@ extern int minithread_stop();
 extern int minithread_start(minithread_t thread);
 
 
+/*
+ *	Wait for thread to exit, then free it. If exit_value_p is
+ *  not NULL, the value thread's proc returned is stored there.
+ *  Only threads made with minithread_fork_joinable can be joined,
+ *  by only one other thread, and not once detached. Any which are
+ *  never joined are freed when the system shuts down.
+ *  On success, return 0. On failure, return -1.
+ */
+extern int minithread_join(minithread_t thread, int* exit_value_p);
+
+
+/*
+ *	Let thread be freed as soon as it exits - it can no longer
+ *  be joined.
+ *  On success, return 0. On failure, return -1.
+ */
+extern int minithread_detach(minithread_t thread);
+
+
+/*
+ *	Create a key for thread-specific values. Every thread's
+ *  value for a new key is NULL. When a thread exits, destructor,
+ *  if not NULL, is called with each non-NULL value it has for
+ *  the key. The first keys' values are stored in the thread
+ *  itself, so are the quickest to get and set.
+ *  On success, return 0 and store the key in key_p. On failure,
+ *  return -1.
+ */
+extern int minithread_key_create(minithread_key_t* key_p, void (*destructor)(void*));
+
+
+/*
+ *	Return the calling thread's value for key, or NULL if it
+ *  has none.
+ */
+extern void* minithread_getspecific(minithread_key_t key);
+
+
+/*
+ *	Set the calling thread's value for key.
+ *  On success, return 0. On failure, return -1.
+ */
+extern int minithread_setspecific(minithread_key_t key, void* value);
+
+
 /*
  *	Forces the caller to relinquish the processor and be put to the end of
  *	the ready queue.  Allows another thread to run.
@@ -8,6 +8,7 @@
 
 
 #include "minithread.h"
+#include "queue.h"
 #include "minimsg_private.h"
 #include "alarm_private.h"
 
@@ -16,5 +17,63 @@ minimsg_t minithread_msg_system(void);
 
 alarm_t minithread_alarm_system(void);
 
+/* create a thread, as minithread_create does, which is part of the
+ * system: it does not keep the system running, and is freed when the
+ * system shuts down, so its proc should never return
+ */
+minithread_t minithread_create_system(proc_t proc, arg_t arg);
+
+/* priority inheritance: lend thread the priority of from, which is
+ * about to wait for it, if that is higher, until restored. a thread
+ * only has one priority lent at a time, the highest, so restoring
+ * takes back all of it - the mutexes the thread still holds, which
+ * it keeps on its boosting queue, then lend theirs again
+ */
+void minithread_inherit_priority(minithread_t thread, minithread_t from);
+
+void minithread_restore_priority(minithread_t thread);
+
+iqueue_t *minithread_boosting(minithread_t thread);
+
+/* bracket an interrupt handler, so that the interrupted thread
+ * is only resumed on the system thread until it has returned
+ */
+void minithread_interrupt_enter(void);
+
+void minithread_interrupt_exit(void);
+
+/* wake the idle thread, which may be waiting for an interrupt or an
+ * alarm, after giving it something to do from another worker. it is
+ * only woken if it is waiting. should be called with interrupts
+ * disabled, as the change it should see was made
+ */
+void minithread_wake_idle(void);
+
+/* wake the idle thread, as minithread_wake_idle does, if it is
+ * waiting for an alarm due later than deadline, in nanoseconds
+ */
+void minithread_wake_idle_by(__int64 deadline);
+
+/* the kernel lock: with more than one worker, set_interrupt_level
+ * takes it when disabling interrupts and releases it when enabling
+ * them, so only one worker is ever in a critical section. with one
+ * worker minithread_kernel_locking returns 0, and there is no lock.
+ * minithread_kernel_lock_holder returns the OS thread id holding it,
+ * or 0
+ */
+int minithread_kernel_locking(void);
+
+void minithread_kernel_lock(void);
+
+void minithread_kernel_unlock(void);
+
+unsigned long minithread_kernel_lock_holder(void);
+
+/* in tickless mode, set the clock to interrupt when it is next needed:
+ * at the end of the system thread's quantum, or when the next alarm
+ * is due. called with interrupts disabled
+ */
+void minithread_clock_program(void);
+
 
 #endif __MINITHREAD_PRIVATE_H__
@@ -1,9 +1,21 @@
 /*
  * multilevel_queue.c - implements our multilevel queue ADT
+ *
+ * each level is a doubly linked list, and a two level bitmap records
+ * which levels are occupied: bit i of occupied[w] is set when level
+ * w*32+i is non-empty, and bit w of summary when occupied[w] is non-zero.
+ * finding the highest occupied level at or below a given one is then
+ * at most two find-first-set instructions, however many levels there
+ * are. list nodes are kept on a free list once used, so a queue in
+ * steady state never calls malloc.
  */
 
 #include "defs.h"
-#include "queue.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#pragma intrinsic(_BitScanForward)
+#endif
 
 /*
  * TYPE DEFINITIONS
@@ -23,13 +35,38 @@ typedef void *any_t;
 typedef int (*PFany)(any_t, any_t);
 
 
+/* the number of levels one bitmap word covers, and so the most levels
+   a queue can have */
+#define MQ_WORD_BITS (32)
+#define MQ_MAX_LEVELS (MQ_WORD_BITS * MQ_WORD_BITS)
+
+/*
+ * mq_node holds one item on a level
+ */
+struct mq_node {
+	any_t item;
+	struct mq_node *prev;
+	struct mq_node *next;
+};
+
+struct mq_level {
+	struct mq_node *first;
+	struct mq_node *last;
+};
+
 /*
  * multilevel_queue holds all of the state associated
- * with an instance of our ADT
+ * with an instance of our ADT. levels[0] is the level dequeued from
+ * first - level 0 for MQ_LEVEL_ASCEND, level num-1 for MQ_LEVEL_DESCEND
+ * (see mq_index) - so the bitmap is always searched upwards.
  */
 struct multilevel_queue {
-	queue_t *levels;
+	struct mq_level *levels;
+	unsigned int *occupied;
+	unsigned int summary;
+	struct mq_node *free_nodes;
 	int num;
+	int order;
 	int size;
 };
 typedef struct multilevel_queue *multilevel_queue_t;
@@ -48,6 +85,90 @@ typedef enum multilevel_queue_order multilevel_queue_order_t;
 
 
 
+/*
+ * HELPER FUNCTIONS
+ */
+
+/* index of the lowest set bit of a non-zero word */
+static int mq_first_set(unsigned int bits) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return (int) index;
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+/* the bits of a word at and above bit */
+static unsigned int mq_mask_from(int bit) {
+	return bit >= MQ_WORD_BITS ? 0 : (~0u << bit);
+}
+
+/* map a level, as the caller numbers them, to its index in levels,
+   or -1 if there is no such level */
+static int mq_index(multilevel_queue_t obj, int level) {
+	if ( level < 0 || level >= obj->num ) {
+		return -1;
+	}
+	return obj->order == MQ_LEVEL_DESCEND ? obj->num - 1 - level : level;
+}
+
+/* the first occupied index at or after index, or -1 */
+static int mq_first_occupied(multilevel_queue_t obj, int index) {
+	int word = index / MQ_WORD_BITS;
+	unsigned int bits = obj->occupied[word] & mq_mask_from(index % MQ_WORD_BITS);
+
+	if ( !bits ) {
+		bits = obj->summary & mq_mask_from(word + 1);
+		if ( !bits ) {
+			return -1;
+		}
+		word = mq_first_set(bits);
+		bits = obj->occupied[word];
+	}
+	return word * MQ_WORD_BITS + mq_first_set(bits);
+}
+
+/* take a node off its level, updating the bitmap if it empties */
+static void mq_unlink(multilevel_queue_t obj, int index, struct mq_node *node) {
+	struct mq_level *level = &obj->levels[index];
+	int word = index / MQ_WORD_BITS;
+
+	if ( node->prev ) {
+		node->prev->next = node->next;
+	} else {
+		level->first = node->next;
+	}
+	if ( node->next ) {
+		node->next->prev = node->prev;
+	} else {
+		level->last = node->prev;
+	}
+
+	if ( !level->first ) {
+		obj->occupied[word] &= ~(1u << (index % MQ_WORD_BITS));
+		if ( !obj->occupied[word] ) {
+			obj->summary &= ~(1u << word);
+		}
+	}
+
+	node->next = obj->free_nodes;
+	obj->free_nodes = node;
+	obj->size--;
+}
+
+static void mq_free_list(struct mq_node *node) {
+	struct mq_node *next;
+	while ( node ) {
+		next = node->next;
+		free(node);
+		node = next;
+	}
+}
+
+
+
 /*
  * FUNCTION DECLARATIONS
  */
@@ -61,14 +182,30 @@ typedef enum multilevel_queue_order multilevel_queue_order_t;
  * On failure return NULL.
  */
 multilevel_queue_t multilevel_queue_new(int num_levels, multilevel_queue_order_t order) {
-	int i;
-	multilevel_queue_t ret = malloc(sizeof(struct multilevel_queue));
+	multilevel_queue_t ret;
+	int words = (num_levels + MQ_WORD_BITS - 1) / MQ_WORD_BITS;
+
+	if ( num_levels <= 0 || num_levels > MQ_MAX_LEVELS ) {
+		return NULL;
+	}
+
+	ret = malloc(sizeof(struct multilevel_queue));
+	if ( !ret ) {
+		return NULL;
+	}
+	ret->levels = calloc(num_levels, sizeof(struct mq_level));
+	ret->occupied = calloc(words, sizeof(unsigned int));
+	if ( !ret->levels || !ret->occupied ) {
+		free(ret->levels);
+		free(ret->occupied);
+		free(ret);
+		return NULL;
+	}
+	ret->summary = 0;
+	ret->free_nodes = NULL;
 	ret->num = num_levels;
+	ret->order = order;
 	ret->size = 0;
-	ret->levels = malloc(sizeof(queue_t)*num_levels);
-	for(i=0;i<num_levels;i++) {
-		ret->levels[i] = queue_new();
-	}
 	return ret;
 }
 
@@ -82,7 +219,36 @@ multilevel_queue_t multilevel_queue_new(int num_levels, multilevel_queue_order_t
  * should left as it was before this call.
  */
 int multilevel_queue_enqueue(multilevel_queue_t obj, int level, any_t item) {
-	queue_append(obj->levels[level], item);
+	struct mq_node *node;
+	struct mq_level *list;
+	int index;
+
+	if ( !obj || (index = mq_index(obj, level)) == -1 ) {
+		return -1;
+	}
+
+	if ( obj->free_nodes ) {
+		node = obj->free_nodes;
+		obj->free_nodes = node->next;
+	} else {
+		node = malloc(sizeof(struct mq_node));
+		if ( !node ) {
+			return -1;
+		}
+	}
+
+	list = &obj->levels[index];
+	node->item = item;
+	node->next = NULL;
+	node->prev = list->last;
+	if ( list->last ) {
+		list->last->next = node;
+	} else {
+		list->first = node;
+		obj->occupied[index / MQ_WORD_BITS] |= 1u << (index % MQ_WORD_BITS);
+		obj->summary |= 1u << (index / MQ_WORD_BITS);
+	}
+	list->last = node;
 	obj->size++;
 	return 0;
 }
@@ -104,17 +270,21 @@ int multilevel_queue_enqueue(multilevel_queue_t obj, int level, any_t item) {
  * the term return value.
  */
 int multilevel_queue_dequeue(multilevel_queue_t obj, int level, any_t* item_p) {
-	any_t item = NULL;
-	int ret = queue_dequeue(obj->levels[level], &item);
-	while ( level < (obj->num - 1)&& -1 == ret ) {
-		level++;
-		ret = queue_dequeue(obj->levels[level], &item);
-	}	
-	if ( ret != -1 ) {
-		*item_p = item;
+	struct mq_node *node;
+	int index;
+
+	*item_p = NULL;
+	if ( !obj || obj->size == 0 || (index = mq_index(obj, level)) == -1 ) {
+		return -1;
 	}
-	obj->size--;
-	return ret;
+	if ( (index = mq_first_occupied(obj, index)) == -1 ) {
+		return -1;
+	}
+
+	node = obj->levels[index].first;
+	*item_p = node->item;
+	mq_unlink(obj, index, node);
+	return 0;
 }
 
 
@@ -128,17 +298,18 @@ int multilevel_queue_dequeue(multilevel_queue_t obj, int level, any_t* item_p) {
  * empty.
  */
 int multilevel_queue_peak(multilevel_queue_t obj, int level, any_t* item_p) {
-	any_t item = NULL;
-	int ret = queue_dequeue(obj->levels[level], &item);
-	while ( (level < (obj->num - 1)) && -1 == ret ) {
-		level++;
-		ret = queue_dequeue(obj->levels[level], &item);
-	}	
-	if ( ret != -1 ) {
-		queue_prepend(obj->levels[level], item);
-		*item_p = item;
+	int index;
+
+	*item_p = NULL;
+	if ( !obj || obj->size == 0 || (index = mq_index(obj, level)) == -1 ) {
+		return -1;
 	}
-	return ret;
+	if ( (index = mq_first_occupied(obj, index)) == -1 ) {
+		return -1;
+	}
+
+	*item_p = obj->levels[index].first->item;
+	return 0;
 }
 
 /*
@@ -157,6 +328,23 @@ int multilevel_queue_peak(multilevel_queue_t obj, int level, any_t* item_p) {
  * whose fields are modified by iter_func.
  */
 int multilevel_queue_iterate(multilevel_queue_t obj, PFany iter_func, any_t item) {
+	struct mq_node *node;
+	int index;
+
+	if ( !obj || !iter_func || obj->size == 0 ) {
+		return -1;
+	}
+
+	/* items are visited in the order they would be dequeued */
+	index = mq_first_occupied(obj, 0);
+	while ( index != -1 ) {
+		for ( node = obj->levels[index].first; node; node = node->next ) {
+			if ( (*iter_func)(node->item, item) == -1 ) {
+				return -1;
+			}
+		}
+		index = index + 1 < obj->num ? mq_first_occupied(obj, index + 1) : -1;
+	}
 	return 0;
 }
 
@@ -168,10 +356,16 @@ int multilevel_queue_iterate(multilevel_queue_t obj, PFany iter_func, any_t item
  */
 int multilevel_queue_free(multilevel_queue_t obj) {
 	int i;
-	for(i=0;i<obj->num;i++) {
-		queue_free(obj->levels[i]);
+
+	if ( !obj ) {
+		return -1;
+	}
+	for ( i = 0; i < obj->num; i++ ) {
+		mq_free_list(obj->levels[i].first);
 	}
+	mq_free_list(obj->free_nodes);
 	free(obj->levels);
+	free(obj->occupied);
 	free(obj);
 	return 0;
 }
@@ -183,6 +377,9 @@ int multilevel_queue_free(multilevel_queue_t obj) {
  * Otherwise, return -1 (failure).
  */
 int multilevel_queue_length(multilevel_queue_t obj) {
+	if ( !obj ) {
+		return -1;
+	}
 	return obj->size;
 }
 
@@ -193,6 +390,23 @@ int multilevel_queue_length(multilevel_queue_t obj) {
  * Otherwise, return -1 (failure)
  */
 int multilevel_queue_delete(multilevel_queue_t obj, any_t item) {
-	return 0;
-}
+	struct mq_node *node;
+	int index;
 
+	if ( !obj || obj->size == 0 ) {
+		return -1;
+	}
+
+	/* only occupied levels are searched */
+	index = mq_first_occupied(obj, 0);
+	while ( index != -1 ) {
+		for ( node = obj->levels[index].first; node; node = node->next ) {
+			if ( node->item == item ) {
+				mq_unlink(obj, index, node);
+				return 0;
+			}
+		}
+		index = index + 1 < obj->num ? mq_first_occupied(obj, index + 1) : -1;
+	}
+	return -1;
+}
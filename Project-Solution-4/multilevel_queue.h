@@ -58,7 +58,8 @@ typedef enum multilevel_queue_order multilevel_queue_order_t;
  * Create a new multilevel queue data structure which should be initialized
  * and will contain no entries. num_levels tells how many levels the queue 
  * will have order tells how integer values will be mapped to levels in
- * this multilevel queue.
+ * this multilevel queue. A queue may have up to 1024 levels; enqueue,
+ * dequeue and peak take constant time however many it has.
  * On success return a pointer to the new multilevel_queue.
  * On failure return NULL.
  */
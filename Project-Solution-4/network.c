@@ -8,27 +8,121 @@
 
 /* INCLUDES */
 
+#ifdef _WIN32
+#include <winsock2.h>
 #include <windows.h>
-#include <winsock.h>
 #include <winerror.h>
+#else
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "defs.h"
 #include "network.h"
-#include "machineprimitives.h"
+#include "machineprimitives_ext.h"
 #include "interrupts_private.h"
 #include "minimsg_private.h"
 
 
 
+/* CONSTANT DEFINES */
+#define NETWORK_PORT_START (41500 + MINIMSG_GROUP_ID)
+#define NETWORK_SIMULATE_ERROR (1)
+#define NETWORK_ERROR_LOSS (.1)
+#define NETWORK_BCAST_ADDRESS "132.236.227.255"
+
+/* every datagram starts with a single frame byte, holding the
+ * wire version in the high nibble and the frame type in the
+ * low nibble. frames of any other version are dropped.
+ */
+#define NETWORK_WIRE_VERSION (1)
+#define NETWORK_FRAME_SIZE (1)
+#define NETWORK_FRAME(type) ((char)((NETWORK_WIRE_VERSION << 4) | (type)))
+#define NETWORK_FRAME_VERSION(frame) (((unsigned char)(frame)) >> 4)
+#define NETWORK_FRAME_TYPE(frame) ((frame) & 0x0F)
+
+/* forwarded broadcasts carry the original sender's 4 byte
+ * address and 2 byte port (both in network order) after the data
+ */
+#define NETWORK_FORWARD_SIZE (4 + 2)
+
+/* capture files are pcap, with a linux cooked (sll) link
+ * header in front of a synthesized ipv4 / udp header, so the
+ * direction and both addresses of each datagram are recorded
+ */
+#define PCAP_MAGIC (0xa1b2c3d4)
+#define PCAP_VERSION_MAJOR (2)
+#define PCAP_VERSION_MINOR (4)
+#define PCAP_LINKTYPE_LINUX_SLL (113)
+#define SLL_HEADER_SIZE (16)
+#define SLL_PACKET_HOST (0)
+#define SLL_PACKET_OUTGOING (4)
+#define IP_HEADER_SIZE (20)
+#define UDP_HEADER_SIZE (8)
+#define CAPTURE_HEADER_SIZE (SLL_HEADER_SIZE + IP_HEADER_SIZE + UDP_HEADER_SIZE)
+
+/* interned addresses are kept in a fixed table, so an entry never
+ * moves once handed out, and found through an open addressed hash
+ * of handles kept at most half full
+ */
+#define NETWORK_ADDRESS_TABLE_SIZE (1024)
+#define NETWORK_ADDRESS_HASH_SIZE (2 * NETWORK_ADDRESS_TABLE_SIZE)
+#define NETWORK_ADDRESS_HASH(addr) ((unsigned int)((addr)[0] * 31 + (addr)[1]) % NETWORK_ADDRESS_HASH_SIZE)
+#define NETWORK_HOSTNAME_MAX (64)
+
+/* the most buffers a datagram is gathered from */
+#define NETWORK_BUFS_MAX (3)
+
+#ifndef _WIN32
+/* BSD sockets: a socket is a file descriptor, errors are in errno,
+ * and datagrams are gathered and scattered through iovecs, filled
+ * from buffers laid out as winsock's
+ */
+typedef int SOCKET;
+typedef struct {
+	unsigned long len;
+	char *buf;
+} WSABUF;
+#define closesocket close
+#define ioctlsocket ioctl
+#define WSAGetLastError() (errno)
+#define WSAEADDRINUSE EADDRINUSE
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define WSAEINTR EINTR
+#define WSAESHUTDOWN ESHUTDOWN
+/* a port unreachable reply, to an earlier datagram */
+#define WSAECONNRESET ECONNREFUSED
+#endif
+
+
 /* DATA STRUCTURE DEFINITIONS */
 
 struct address_info {
 	SOCKET sock;
 	struct sockaddr_in sin;
-	char pkt[MAX_NETWORK_PKT_SIZE];
+};
+
+/* frame types, carried in the low nibble of the frame byte
+ * which leads every datagram
+ */
+enum network_frame_type {
+	NETWORK_FRAME_DEREGISTER,	/* virtual interface leaving default port */
+	NETWORK_FRAME_REGISTER,		/* virtual interface joining default port */
+	NETWORK_FRAME_BCAST,		/* broadcast */
+	NETWORK_FRAME_DIRECT,		/* point to point */
+	NETWORK_FRAME_FORWARDED		/* broadcast forwarded by default port, origin appended */
 };
 
 struct subport_node {
@@ -36,13 +130,38 @@ struct subport_node {
 	struct subport_node* next;
 };
 
+/* an interned address, along with its ready made sockaddr
+ */
+struct address_entry {
+	network_address_t addr;
+	struct sockaddr_in sin;
+};
+
+/* a resolved host name - only the ip is kept, since the
+ * port to use may change
+ */
+struct hostname_node {
+	char name[NETWORK_HOSTNAME_MAX];
+	unsigned long iaddr;
+	struct hostname_node* next;
+};
 
-/* CONSTANT DEFINES */
-#define NETWORK_PORT_START (41500 + MINIMSG_GROUP_ID)
-#define NETWORK_SIMULATE_ERROR (1)
-#define NETWORK_ERROR_LOSS (.1)
-#define NETWORK_BCAST_ADDRESS "132.236.227.255"
+struct pcap_file_header {
+	unsigned int magic;
+	unsigned short version_major;
+	unsigned short version_minor;
+	int thiszone;
+	unsigned int sigfigs;
+	unsigned int snaplen;
+	unsigned int linktype;
+};
 
+struct pcap_record_header {
+	unsigned int ts_sec;
+	unsigned int ts_usec;
+	unsigned int incl_len;
+	unsigned int orig_len;
+};
 
 
 /* STATIC INSTANCE DATA */
@@ -55,24 +174,44 @@ char network_up;
 static HANDLE network_poll_done = NULL;
 static HANDLE subports_done = NULL;
 struct subport_node *registered_subports;
+#ifdef _WIN32
 WSADATA winsock_version_data;
+#endif
 struct address_info if_info;
 static tas_lock_t initialized = 0;
 static network_address_t broadcast_addr = { 0 };
+static struct sockaddr_in broadcast_sin;
 static network_address_t my_addr;
 static int process_id;
 static int last_id; 
+static interrupt_handler_t registered_handler = NULL;
+static FILE *capture_file = NULL;
+static HANDLE capture_mutex = NULL;
+static char replaying = 0;
+static HANDLE poll_handoff = NULL;
+static HANDLE receive_mutex = NULL;
+static struct address_entry address_table[NETWORK_ADDRESS_TABLE_SIZE];
+static volatile LONG address_hash[NETWORK_ADDRESS_HASH_SIZE];
+/* read without the lock, so only set once the entry is filled in */
+static volatile LONG address_count = 0;
+static HANDLE address_mutex = NULL;
+static struct hostname_node* hostname_cache = NULL;
 
 
 /* INTERNAL FUNCTION DECLARATIONS */
 
-int send_pkt(network_address_t dest_address, int data_len, char *data);
+int send_pkt(struct sockaddr_in* sin, char broadcast, int data_len, char *data);
 int sockaddr_to_network_address(struct sockaddr_in* sin, network_address_t addr);
 int network_address_to_sockaddr(network_address_t addr, struct sockaddr_in* sin);
 int network_set_udp_ports(unsigned short myportnum, unsigned short otherportnum);
 int network_set_synthetic_params(double loss);
+int network_sendto_bufs(SOCKET s, WSABUF* bufs, int count, struct sockaddr_in* to);
+int network_recvfrom_bufs(SOCKET s, WSABUF* bufs, int count, struct sockaddr_in* from, int* fromlen);
+int network_receive(SOCKET s, network_interrupt_arg_t* packet_p);
 int WINAPI network_poll(void* arg);
 int start_network_poll(interrupt_handler_t, SOCKET*);
+int network_capture_record(int direction, struct sockaddr_in* from, struct sockaddr_in* to, WSABUF* bufs, int count);
+int network_cache_hostname(char* hostname, unsigned long iaddr);
 
 
 
@@ -85,19 +224,23 @@ int start_network_poll(interrupt_handler_t, SOCKET*);
  */
 int network_initialize(interrupt_handler_t network_handler) {
 	int arg = 1;
+	u_long nonblocking;
 	int ret = 0;
 	char name[32];
 	char hostname[64];
 	struct sockaddr_in msin;
 
+#ifdef _WIN32
 	/* initialise the NT socket library, inexplicably required by NT */
 	assert(WSAStartup(MAKEWORD(2, 0), &winsock_version_data) == 0);
+#endif
 
 	if (atomic_test_and_set(&initialized)) {
 		return -1;
 	}
 	network_up = 1;
 	registered_subports = NULL;
+	address_mutex = CreateMutex(NULL, FALSE, NULL);
 
 	memset(&if_info, 0, sizeof(if_info));
 
@@ -136,14 +279,14 @@ int network_initialize(interrupt_handler_t network_handler) {
 	if ( NETWORK_PORT_START != my_udp_port ) {
 		/* not the default port, so register ourself with default */
 		struct sockaddr_in sin;
+		char frame = NETWORK_FRAME(NETWORK_FRAME_REGISTER);
 		sin.sin_port = htons(other_udp_port);
 		sin.sin_family = if_info.sin.sin_family;
 		sin.sin_addr.s_addr = if_info.sin.sin_addr.s_addr;
 		/* broadcast to default */
 		sockaddr_to_network_address(&sin, broadcast_addr);
 
-		if_info.pkt[0] = 1;
-		sendto(if_info.sock, if_info.pkt, 1, 0, (struct sockaddr*)&sin, sizeof(sin));
+		sendto(if_info.sock, &frame, NETWORK_FRAME_SIZE, 0, (struct sockaddr*)&sin, sizeof(sin));
 	} else {
 		/* i am default, broadcast to myself */
 		network_address_copy(my_addr, broadcast_addr);
@@ -153,12 +296,21 @@ int network_initialize(interrupt_handler_t network_handler) {
 		/* actually, in the lab, so broadcast to everyone */
 		network_translate_hostname(NETWORK_BCAST_ADDRESS, broadcast_addr);
 	}
+	network_address_to_sockaddr(broadcast_addr, &broadcast_sin);
 
 	/* set for fast reuse */
 	assert(setsockopt(if_info.sock, SOL_SOCKET, SO_REUSEADDR, (char *) &arg, sizeof(int)) == 0);
 
 	/* initialize broadcast */
 	assert(setsockopt(if_info.sock, SOL_SOCKET, SO_BROADCAST, (char *) &arg, sizeof(int)) == 0);
+
+	/* non-blocking, so the receive thread and busy polling can share it */
+	nonblocking = 1;
+	assert(ioctlsocket(if_info.sock, FIONBIO, &nonblocking) == 0);
+
+	/* signalled except while the idle thread is busy polling */
+	poll_handoff = CreateEvent(NULL, TRUE, TRUE, NULL);
+	receive_mutex = CreateMutex(NULL, FALSE, NULL);
 		
 	sprintf_s(name, 32, "npm %d", GetCurrentProcessId());
 	network_poll_done = CreateMutex(NULL, FALSE, NULL);
@@ -192,12 +344,12 @@ int network_cleanup(void) {
 	if ( NETWORK_PORT_START != my_udp_port ) {
 		/* not the default port, so deregister ourself with default */
 		struct sockaddr_in sin;
+		char frame = NETWORK_FRAME(NETWORK_FRAME_DEREGISTER);
 		sin.sin_port = htons(other_udp_port);
 		sin.sin_family = if_info.sin.sin_family;
 		sin.sin_addr.s_addr = if_info.sin.sin_addr.s_addr;
 
-		if_info.pkt[0] = 0;
-		sendto(if_info.sock, if_info.pkt, 1, 0, (struct sockaddr*)&sin, sizeof(sin));
+		sendto(if_info.sock, &frame, NETWORK_FRAME_SIZE, 0, (struct sockaddr*)&sin, sizeof(sin));
 	} else if ( registered_subports != NULL ) {
 		/* this is default port, so have to keep forwarding broadcasts
 		 * 'til all other virtual network interfaces on this machine close down
@@ -209,6 +361,9 @@ int network_cleanup(void) {
 	shutdown(if_info.sock, 2);
 
 	closesocket(if_info.sock);
+
+	/* make sure the receive thread is not left parked */
+	SetEvent(poll_handoff);
 	
 	/* wait until the polling loop exits so we know
 	 * that no more interrupts will be sent.
@@ -216,8 +371,25 @@ int network_cleanup(void) {
 	WaitOnObject(network_poll_done);
 	ReleaseMutex(network_poll_done);
 
+	CloseHandle(poll_handoff);
+	CloseHandle(receive_mutex);
+
 	deregister_interrupt(NETWORK_INTERRUPT_TYPE);
 
+	network_capture_stop();
+
+	/* forget interned addresses and cached names */
+	WaitOnObject(address_mutex);
+	InterlockedExchange(&address_count, 0);
+	memset((void*)address_hash, 0, sizeof(address_hash));
+	ReleaseMutex(address_mutex);
+	CloseHandle(address_mutex);
+	while ( hostname_cache ) {
+		struct hostname_node* next = hostname_cache->next;
+		free(hostname_cache);
+		hostname_cache = next;
+	}
+
 	atomic_clear(&initialized);
 
 	return 0;
@@ -229,7 +401,8 @@ int network_cleanup(void) {
  */
 int network_reserve_next_token(void) {
 	if ( !process_id ) {
-		process_id = if_info.sin.sin_addr.S_un.S_un_b.s_b4 * 2000 + (my_udp_port - other_udp_port) * 200 + 2;
+		/* the last byte of the address, which is in network order */
+		process_id = ((unsigned char*)&(if_info.sin.sin_addr.s_addr))[3] * 2000 + (my_udp_port - other_udp_port) * 200 + 2;
 		last_id = process_id;
 	} else {
 		last_id++;
@@ -250,7 +423,7 @@ int network_bcast_pkt(int data_len, char* data) {
 		}
 	}
 
-	return send_pkt(broadcast_addr, data_len, data);
+	return send_pkt(&broadcast_sin, 1, data_len, data);
 }
 
 
@@ -259,6 +432,8 @@ int network_bcast_pkt(int data_len, char* data) {
  * successfully send the data or -1 otherwise.
  */
 int network_send_pkt(network_address_t dest_address, int data_len, char *data) {
+	struct sockaddr_in sin;
+
 	if (synthetic_network) {
 		if( rand() < (loss_rate * RAND_MAX) ) {
 			dbgprintf("Packet dropped.\n");
@@ -266,7 +441,28 @@ int network_send_pkt(network_address_t dest_address, int data_len, char *data) {
 		}
 	}
 
-	return send_pkt(dest_address, data_len, data);
+	network_address_to_sockaddr(dest_address, &sin);
+	return send_pkt(&sin, 0, data_len, data);
+}
+
+
+/* sends raw data to the destination with the given handle.
+ * it returns the number of bytes sent if it was able to
+ * successfully send the data or -1 otherwise.
+ */
+int network_send_pkt_to_handle(network_handle_t dest_handle, int data_len, char *data) {
+	if ( dest_handle <= NETWORK_HANDLE_NONE || dest_handle > address_count ) {
+		return -1;
+	}
+
+	if (synthetic_network) {
+		if( rand() < (loss_rate * RAND_MAX) ) {
+			dbgprintf("Packet dropped.\n");
+			return (data_len);
+		}
+	}
+
+	return send_pkt(&address_table[dest_handle - 1].sin, 0, data_len, data);
 }
 
 
@@ -275,23 +471,32 @@ int network_send_pkt(network_address_t dest_address, int data_len, char *data) {
  */
 int network_translate_hostname(char* hostname, network_address_t address) {
 	struct hostent* host;
+	struct hostname_node* node;
 	unsigned long iaddr;
 
 	if( isalpha(hostname[0]) ) {
-		host = gethostbyname(hostname);
-		if (host == NULL) {
-			return -1;
+		/* resolving a name may go out to the network, so look in the cache first */
+		node = hostname_cache;
+		while ( node && strcmp(node->name, hostname) != 0 ) {
+			node = node->next;
+		}
+		if ( node ) {
+			iaddr = node->iaddr;
 		} else {
-			address[0] = (long) *((int *) host->h_addr);
-			address[1] = (long) htons(other_udp_port);
-			return 0;
+			host = gethostbyname(hostname);
+			if (host == NULL) {
+				return -1;
+			}
+			iaddr = (long) *((int *) host->h_addr);
+			network_cache_hostname(hostname, iaddr);
 		}
 	} else {
 		iaddr = inet_addr(hostname);
-		address[0] = iaddr;
-		address[1] = (long) htons(other_udp_port);
-		return 0;
 	}
+
+	address[0] = iaddr;
+	address[1] = (long) htons(other_udp_port);
+	return 0;
 }
 
 
@@ -331,6 +536,63 @@ int network_address_same(network_address_t a, network_address_t b) {
 }
 
 
+/* Intern an address, returning its handle.
+ */
+network_handle_t network_address_intern(network_address_t addr) {
+	unsigned int slot = NETWORK_ADDRESS_HASH(addr);
+	network_handle_t handle;
+
+	/* already interned - entries never change once published, so no lock */
+	while ( (handle = address_hash[slot]) != NETWORK_HANDLE_NONE ) {
+		if ( network_address_same(address_table[handle - 1].addr, addr) ) {
+			return handle;
+		}
+		slot = (slot + 1) % NETWORK_ADDRESS_HASH_SIZE;
+	}
+
+	WaitOnObject(address_mutex);
+
+	/* someone may have added it since, carry on probing from the empty slot */
+	while ( (handle = address_hash[slot]) != NETWORK_HANDLE_NONE ) {
+		if ( network_address_same(address_table[handle - 1].addr, addr) ) {
+			ReleaseMutex(address_mutex);
+			return handle;
+		}
+		slot = (slot + 1) % NETWORK_ADDRESS_HASH_SIZE;
+	}
+
+	if ( address_count == NETWORK_ADDRESS_TABLE_SIZE ) {
+		/* table full */
+		ReleaseMutex(address_mutex);
+		return NETWORK_HANDLE_NONE;
+	}
+
+	handle = address_count + 1;
+	network_address_copy(addr, address_table[handle - 1].addr);
+	network_address_to_sockaddr(addr, &address_table[handle - 1].sin);
+
+	/* publish only once the entry is filled in */
+	InterlockedExchange(&address_count, handle);
+	InterlockedExchange(&address_hash[slot], handle);
+
+	ReleaseMutex(address_mutex);
+
+	return handle;
+}
+
+
+/* Copy the address with the given handle into addr.
+ */
+int network_handle_to_address(network_handle_t handle, network_address_t addr) {
+	if ( handle <= NETWORK_HANDLE_NONE || handle > address_count ) {
+		return -1;
+	}
+
+	network_address_copy(address_table[handle - 1].addr, addr);
+	return 0;
+}
+
+
 /* Print an address
  */
 int network_address_print(network_address_t address) {
@@ -359,46 +621,257 @@ int network_address_print(network_address_t address) {
 }
 
 
+/* Start recording every datagram sent or received by this
+ * interface to the file filename, in pcap format.
+ */
+int network_capture_start(char* filename) {
+	struct pcap_file_header header;
+	FILE *file;
 
-/* INTERNAL FUNCTION IMPLEMENTATIONS */
+	if ( !capture_mutex ) {
+		capture_mutex = CreateMutex(NULL, FALSE, NULL);
+	}
 
-int send_pkt(network_address_t dest_address, int data_len, char *data) {
-	int cc;
-	struct sockaddr_in sin;
-	char* bufp;
-	int sz;
+	if ( fopen_s(&file, filename, "wb") != 0 ) {
+		return -1;
+	}
+
+	header.magic = PCAP_MAGIC;
+	header.version_major = PCAP_VERSION_MAJOR;
+	header.version_minor = PCAP_VERSION_MINOR;
+	header.thiszone = 0;
+	header.sigfigs = 0;
+	header.snaplen = CAPTURE_HEADER_SIZE + NETWORK_FRAME_SIZE + MAX_NETWORK_PKT_SIZE;
+	header.linktype = PCAP_LINKTYPE_LINUX_SLL;
+	fwrite(&header, sizeof(header), 1, file);
+
+	WaitOnObject(capture_mutex);
+	if ( capture_file ) {
+		fclose(capture_file);
+	}
+	capture_file = file;
+	ReleaseMutex(capture_mutex);
 
+	return 0;
+}
+
+
+/* Stop recording and close the capture file.
+ */
+int network_capture_stop(void) {
+	if ( !capture_mutex ) {
+		return -1;
+	}
 
-	/* sanity checks */
-	if ( data_len < 0 || data_len > MAX_NETWORK_PKT_SIZE ) {
+	WaitOnObject(capture_mutex);
+	if ( capture_file ) {
+		fclose(capture_file);
+		capture_file = NULL;
+	}
+	ReleaseMutex(capture_mutex);
+
+	return 0;
+}
+
+
+/* Replay the datagrams received in the capture file filename,
+ * rounds times over, by handing each one to the network interrupt
+ * handler as fast as possible.
+ */
+int network_replay(char* filename, int rounds) {
+	FILE *file;
+	char *capture;
+	long capture_len;
+	int delivered = 0;
+	int round;
+
+	if ( !registered_handler || fopen_s(&file, filename, "rb") != 0 ) {
+		return -1;
+	}
+
+	/* load the whole capture up front, so disk reads are not timed */
+	fseek(file, 0, SEEK_END);
+	capture_len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if ( capture_len < 0 ) {
+		fclose(file);
+		return -1;
+	}
+	capture = malloc(capture_len);
+	if ( !capture || fread(capture, 1, capture_len, file) != (size_t)capture_len
+		|| capture_len < sizeof(struct pcap_file_header)
+		|| ((struct pcap_file_header*)capture)->magic != PCAP_MAGIC
+		|| ((struct pcap_file_header*)capture)->linktype != PCAP_LINKTYPE_LINUX_SLL ) {
+		fclose(file);
+		free(capture);
+		return -1;
+	}
+	fclose(file);
+
+	replaying = 1;
+
+	for ( round = 0; round < rounds && delivered >= 0; round++ ) {
+		char *pos = capture + sizeof(struct pcap_file_header);
+		char *end = capture + capture_len;
+
+		while ( pos + sizeof(struct pcap_record_header) <= end ) {
+			struct pcap_record_header *record = (struct pcap_record_header*)pos;
+			unsigned char *frame = (unsigned char*)(pos + sizeof(struct pcap_record_header));
+			unsigned char *ip = frame + SLL_HEADER_SIZE;
+			unsigned char *data;
+			int data_len;
+			struct sockaddr_in addr;
+			network_interrupt_arg_t packet;
+			interrupt_level_t old_int;
+
+			pos = (char*)frame + record->incl_len;
+			if ( pos > end || record->incl_len < CAPTURE_HEADER_SIZE + NETWORK_FRAME_SIZE ) {
+				continue;
+			}
+
+			/* only datagrams received by the capturing interface */
+			if ( ((frame[0] << 8) | frame[1]) != SLL_PACKET_HOST ) {
+				continue;
+			}
+
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = if_info.sin.sin_family;
+			memcpy(&(addr.sin_addr.s_addr), ip + 12, 4);
+			memcpy(&(addr.sin_port), ip + IP_HEADER_SIZE, 2);
+
+			data = ip + IP_HEADER_SIZE + UDP_HEADER_SIZE;
+			data_len = record->incl_len - CAPTURE_HEADER_SIZE;
+
+			if ( NETWORK_FRAME_VERSION(data[0]) != NETWORK_WIRE_VERSION ) {
+				continue;
+			}
+			switch ( NETWORK_FRAME_TYPE(data[0]) ) {
+			case NETWORK_FRAME_DIRECT:
+			case NETWORK_FRAME_BCAST:
+				data_len -= NETWORK_FRAME_SIZE;
+				break;
+			case NETWORK_FRAME_FORWARDED:
+				data_len -= NETWORK_FRAME_SIZE + NETWORK_FORWARD_SIZE;
+				if ( data_len < 0 ) {
+					continue;
+				}
+				memcpy(&(addr.sin_addr.s_addr), data + NETWORK_FRAME_SIZE + data_len, 4);
+				memcpy(&(addr.sin_port), data + NETWORK_FRAME_SIZE + data_len + 4, 2);
+				break;
+			default:
+				/* control frames are not passed up */
+				continue;
+			}
+			if ( data_len > MAX_NETWORK_PKT_SIZE ) {
+				/* not from us, or truncated - it would not fit */
+				continue;
+			}
+			data += NETWORK_FRAME_SIZE;
+
+			/* the handler frees this, just as for a real interrupt */
+			packet = (network_interrupt_arg_t) malloc(sizeof(struct network_interrupt_arg));
+			if ( !packet ) {
+				delivered = -1;
+				break;
+			}
+			memcpy(packet->buffer, data, data_len);
+			packet->size = data_len;
+			sockaddr_to_network_address(&addr, packet->addr);
+			packet->handle = network_address_intern(packet->addr);
+
+			old_int = set_interrupt_level(DISABLED);
+			registered_handler(packet);
+			set_interrupt_level(old_int);
+
+			delivered++;
+		}
+	}
+
+	replaying = 0;
+
+	free(capture);
+
+	return delivered;
+}
+
+
+/* Busy poll the network from the idle thread for up to spin
+ * microseconds.
+ */
+int network_busy_poll(int spin) {
+	unsigned __int64 deadline;
+	network_interrupt_arg_t packet;
+	int received;
+	int delivered = 0;
+
+	if ( !network_up || !registered_handler ) {
 		return 0;
 	}
 
-	/*
-	 * put data in packet
-	 */
-	bufp = if_info.pkt;
+	deadline = currentTimeNanos() + (unsigned __int64)spin * 1000;
 
-	memcpy(bufp, data, data_len);
-	sz = data_len;
+	/* park the receive thread while we own the socket */
+	ResetEvent(poll_handoff);
 
-	bufp += sz;
-	if ( dest_address == broadcast_addr ) {
-		bufp[0] = 2;
-		sz += 1;
-	} else {
-		bufp[0] = 3;
-		sz += 1;
+	do {
+		WaitOnObject(receive_mutex);
+		received = network_receive(if_info.sock, &packet);
+		ReleaseMutex(receive_mutex);
+		if ( received ) {
+			/* deliver directly - no need to go through send_interrupt */
+			interrupt_level_t old_int = set_interrupt_level(DISABLED);
+			registered_handler(packet);
+			set_interrupt_level(old_int);
+			delivered++;
+			break;
+		}
+	} while ( currentTimeNanos() < deadline );
+
+	/* fall back to blocking delivery */
+	SetEvent(poll_handoff);
+
+	return delivered;
+}
+
+
+
+/* INTERNAL FUNCTION IMPLEMENTATIONS */
+
+/*
+ * send one datagram, gathered from the frame byte and the caller's
+ * data, so the data is never copied into a staging buffer. all
+ * state is on the caller's stack, so any number of senders (including
+ * the network poll thread forwarding broadcasts) may send at once.
+ */
+int send_pkt(struct sockaddr_in* sin, char broadcast, int data_len, char *data) {
+	char frame;
+	WSABUF bufs[2];
+	int sent;
+
+
+	/* sanity checks - leave room for a forwarding trailer */
+	if ( data_len < 0 || data_len > MAX_NETWORK_PKT_SIZE - NETWORK_FORWARD_SIZE ) {
+		return 0;
 	}
 
+	/* replayed traffic must not provoke real responses */
+	if ( replaying ) {
+		return data_len;
+	}
+
+	bufs[0].buf = &frame;
+	bufs[0].len = NETWORK_FRAME_SIZE;
+	bufs[1].buf = data;
+	bufs[1].len = data_len;
+
 	/* if broadcast, send to any registered subports
 	 */
-	if ( dest_address == broadcast_addr && registered_subports ) {
+	if ( broadcast && registered_subports ) {
 		struct subport_node *temp = registered_subports;
 		struct sockaddr_in local_addr;
 
 		/* address will be correct, no need to put in body */
-		bufp[0] = 3;
+		frame = NETWORK_FRAME(NETWORK_FRAME_DIRECT);
 
 		/* set up dest address struct */
 		local_addr.sin_family = if_info.sin.sin_family;
@@ -406,18 +879,93 @@ int send_pkt(network_address_t dest_address, int data_len, char *data) {
 
 		while ( temp ) {
 			local_addr.sin_port = temp->port_num;
-			sendto(if_info.sock, if_info.pkt, sz, 0, (struct sockaddr*)&local_addr, sizeof(local_addr));
+			network_sendto_bufs(if_info.sock, bufs, 2, &local_addr);
+			network_capture_record(SLL_PACKET_OUTGOING, &if_info.sin, &local_addr, bufs, 2);
 			temp = temp->next;
 		}
+	}
 
-		/* reset this for others */
-		bufp[0] = 2;
+	if ( broadcast ) {
+		frame = NETWORK_FRAME(NETWORK_FRAME_BCAST);
+	} else {
+		frame = NETWORK_FRAME(NETWORK_FRAME_DIRECT);
 	}
 
-	network_address_to_sockaddr(dest_address, &sin);
-	cc = sendto(if_info.sock, if_info.pkt, sz, 0, (struct sockaddr *) &sin, sizeof(sin));
+	sent = network_sendto_bufs(if_info.sock, bufs, 2, sin);
+	if ( sent < 0 ) {
+		return -1;
+	}
+
+	network_capture_record(SLL_PACKET_OUTGOING, &if_info.sin, sin, bufs, 2);
 
-	return cc;
+	/* report data bytes, not including frame byte */
+	return sent - NETWORK_FRAME_SIZE;
+}
+
+
+/*
+ * send one datagram to the address to, gathered from count buffers.
+ * returns the number of bytes sent, or -1 on error.
+ */
+int network_sendto_bufs(SOCKET s, WSABUF* bufs, int count, struct sockaddr_in* to) {
+#ifdef _WIN32
+	DWORD sent;
+
+	if ( WSASendTo(s, bufs, count, &sent, 0, (struct sockaddr*)to, sizeof(*to), NULL, NULL) != 0 ) {
+		return -1;
+	}
+	return (int)sent;
+#else
+	struct iovec iov[NETWORK_BUFS_MAX];
+	struct msghdr msg;
+	int i;
+
+	for ( i = 0; i < count; i++ ) {
+		iov[i].iov_base = bufs[i].buf;
+		iov[i].iov_len = bufs[i].len;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = to;
+	msg.msg_namelen = sizeof(*to);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	return (int)sendmsg(s, &msg, 0);
+#endif
+}
+
+
+/*
+ * receive one datagram, scattered over count buffers, along with
+ * the address it is from, and that address's length. returns the
+ * number of bytes received, or -1 on error (in WSAGetLastError).
+ */
+int network_recvfrom_bufs(SOCKET s, WSABUF* bufs, int count, struct sockaddr_in* from, int* fromlen) {
+#ifdef _WIN32
+	DWORD received, flags = 0;
+
+	if ( WSARecvFrom(s, bufs, count, &received, &flags, (struct sockaddr *)from, fromlen, NULL, NULL) != 0 ) {
+		return -1;
+	}
+	return (int)received;
+#else
+	struct iovec iov[NETWORK_BUFS_MAX];
+	struct msghdr msg;
+	int received;
+	int i;
+
+	for ( i = 0; i < count; i++ ) {
+		iov[i].iov_base = bufs[i].buf;
+		iov[i].iov_len = bufs[i].len;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = from;
+	msg.msg_namelen = *fromlen;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	received = (int)recvmsg(s, &msg, 0);
+	*fromlen = (int)msg.msg_namelen;
+	return received;
+#endif
 }
 
 
@@ -437,6 +985,34 @@ int network_address_to_sockaddr(network_address_t addr, struct sockaddr_in* sin)
 }
 
 
+/*
+ * remember the ip a host name resolved to. nodes are only ever
+ * pushed on the front, fully built, so readers need no lock.
+ */
+int network_cache_hostname(char* hostname, unsigned long iaddr) {
+	struct hostname_node* node;
+	interrupt_level_t old_int;
+
+	if ( strlen(hostname) >= NETWORK_HOSTNAME_MAX ) {
+		return -1;
+	}
+
+	node = (struct hostname_node*) malloc(sizeof(struct hostname_node));
+	if ( node == NULL ) {
+		return -1;
+	}
+	strcpy_s(node->name, NETWORK_HOSTNAME_MAX, hostname);
+	node->iaddr = iaddr;
+
+	old_int = set_interrupt_level(DISABLED);
+	node->next = hostname_cache;
+	hostname_cache = node;
+	set_interrupt_level(old_int);
+
+	return 0;
+}
+
+
 int network_set_udp_ports(unsigned short myportnum, unsigned short otherportnum) {
 	my_udp_port = myportnum;
 	other_udp_port = otherportnum;
@@ -451,6 +1027,170 @@ int network_set_synthetic_params(double loss) {
 }
 
 
+/*
+ * receive one datagram from the (non-blocking) socket s. control
+ * frames are handled and broadcasts forwarded here. if there is a
+ * packet to pass up, return 1 and return it out through packet_p
+ * (the receiver of the packet is responsible for freeing it).
+ * otherwise return 0.
+ */
+int network_receive(SOCKET s, network_interrupt_arg_t* packet_p) {
+	network_interrupt_arg_t packet;
+	struct sockaddr_in addr;
+	int fromlen = sizeof(struct sockaddr_in);
+	char frame;
+	WSABUF bufs[2];
+	int received;
+
+	/* we rely on run_user_handler to destroy this data structure */
+	packet = (network_interrupt_arg_t) malloc(sizeof(struct network_interrupt_arg));
+	assert(packet != NULL);
+
+	/* do receive - scatter the frame byte off the front so
+	 * the data lands at the start of the packet buffer
+	 */
+	bufs[0].buf = &frame;
+	bufs[0].len = NETWORK_FRAME_SIZE;
+	bufs[1].buf = packet->buffer;
+	bufs[1].len = MAX_NETWORK_PKT_SIZE;
+	received = network_recvfrom_bufs(s, bufs, 2, &addr, &fromlen);
+	if ( received >= 0 ) {
+		packet->size = received - NETWORK_FRAME_SIZE;
+		if ( packet->size < 0 ) {
+			/* empty datagram, no frame byte */
+			free(packet);
+			return 0;
+		}
+		if ( capture_file ) {
+			bufs[1].len = packet->size;
+			network_capture_record(SLL_PACKET_HOST, &addr, &if_info.sin, bufs, 2);
+		}
+	} else {
+		/* check for errors */
+		int err = WSAGetLastError();
+		if( err == WSAECONNRESET ){
+			dbgprintf("NET: Message sent to unavailable host.\n");
+			free(packet);
+			return 0;
+		} else if ( err == WSAEWOULDBLOCK || err == WSAEINTR || err == WSAESHUTDOWN || !network_up ) {
+			/* nothing waiting, blocking operation canceled, or
+			 * socket closed by network_cleanup */
+			free(packet);
+			return 0;
+		} else {
+			dbgprintf("NET: Error, %d.\n", err);
+			free(packet);
+			AbortOnCondition(1,"Crashing.");
+		}
+	}
+
+	/* make sure it's not from me, and speaks our wire version */
+	if ( (addr.sin_addr.s_addr == if_info.sin.sin_addr.s_addr &&
+		addr.sin_port == if_info.sin.sin_port) ||
+		NETWORK_FRAME_VERSION(frame) != NETWORK_WIRE_VERSION ) {
+		free(packet);
+		return 0;
+	}
+
+	switch ( NETWORK_FRAME_TYPE(frame) ) {
+	case NETWORK_FRAME_REGISTER:
+		/* virtual network interface control packet */
+		if ( addr.sin_addr.s_addr == if_info.sin.sin_addr.s_addr ) {
+			struct subport_node *new_node = malloc(sizeof(struct subport_node));
+			new_node->port_num = addr.sin_port;
+			new_node->next = registered_subports;
+			registered_subports = new_node;
+		}
+		free(packet);
+		return 0;
+
+	case NETWORK_FRAME_DEREGISTER:
+		/* virtual network interface control packet */
+		if ( addr.sin_addr.s_addr == if_info.sin.sin_addr.s_addr ) {
+			struct subport_node *temp = registered_subports, *prev = NULL;
+			while ( temp && temp->port_num != addr.sin_port ) {
+				prev = temp;
+				temp = temp->next;
+			}
+			if ( temp ) {
+				/* found it */
+				if ( prev ) {
+					prev->next = temp->next;
+				} else {
+					registered_subports = temp->next;
+				}
+				free(temp);
+			}
+			if ( !registered_subports ) {
+				ReleaseMutex(subports_done);
+			}
+		}
+		free(packet);
+		return 0;
+
+	case NETWORK_FRAME_BCAST:
+		if ( registered_subports ) {
+			/* forward this packet, with the real sender appended */
+			struct subport_node *temp = registered_subports;
+			struct sockaddr_in sin;
+			char forward_frame = NETWORK_FRAME(NETWORK_FRAME_FORWARDED);
+			char origin[NETWORK_FORWARD_SIZE];
+			WSABUF forward[3];
+
+			/* set up dest address struct */
+			sin.sin_family = if_info.sin.sin_family;
+			sin.sin_addr.s_addr = if_info.sin.sin_addr.s_addr;
+
+			memcpy(origin, &(addr.sin_addr.s_addr), sizeof(addr.sin_addr.s_addr));
+			memcpy(origin + sizeof(addr.sin_addr.s_addr), &(addr.sin_port), sizeof(addr.sin_port));
+
+			forward[0].buf = &forward_frame;
+			forward[0].len = NETWORK_FRAME_SIZE;
+			forward[1].buf = packet->buffer;
+			forward[1].len = packet->size;
+			forward[2].buf = origin;
+			forward[2].len = NETWORK_FORWARD_SIZE;
+
+			while ( temp ) {
+				sin.sin_port = temp->port_num;
+				if ( sin.sin_port != addr.sin_port ) {
+					network_sendto_bufs(if_info.sock, forward, 3, &sin);
+					network_capture_record(SLL_PACKET_OUTGOING, &if_info.sin, &sin, forward, 3);
+				}
+				temp = temp->next;
+			}
+		}
+		break;
+
+	case NETWORK_FRAME_FORWARDED:
+		/* packet has been forwarded, so fix address */
+		if ( packet->size < NETWORK_FORWARD_SIZE ) {
+			free(packet);
+			return 0;
+		}
+		packet->size -= NETWORK_FORWARD_SIZE;
+		memcpy(&(addr.sin_addr.s_addr), packet->buffer + packet->size, sizeof(addr.sin_addr.s_addr));
+		memcpy(&(addr.sin_port), packet->buffer + packet->size + sizeof(addr.sin_addr.s_addr), sizeof(addr.sin_port));
+		break;
+
+	case NETWORK_FRAME_DIRECT:
+		break;
+
+	default:
+		/* unknown frame type */
+		free(packet);
+		return 0;
+	}
+
+	assert(fromlen == sizeof(struct sockaddr_in));
+	sockaddr_to_network_address(&addr, packet->addr);
+	packet->handle = network_address_intern(packet->addr);
+
+	*packet_p = packet;
+	return 1;
+}
+
+
 /* 
  * receive incoming packets from the specified socket, translate their 
  * addresses to network_address_t type, and call the user-supplied handler
@@ -460,12 +1200,17 @@ int network_set_synthetic_params(double loss) {
  * would not be possible to return until we returned to the original stack.
  * this is inelegant, but we are constrained by ignorance of the minithread
  * struct format!
+ *
+ * the socket is non-blocking, so that the idle thread can busy poll it
+ * as well. this thread blocks in select instead, and stands aside
+ * while the idle thread is busy polling.
 */
 int WINAPI network_poll(void* arg) {
 	SOCKET* s;
 	network_interrupt_arg_t packet;
-	struct sockaddr_in addr;
-	int fromlen = sizeof(struct sockaddr_in);
+	int received;
+	fd_set readable;
+	struct timeval timeout;
 
 	s = (SOCKET *) arg;
 
@@ -473,125 +1218,27 @@ int WINAPI network_poll(void* arg) {
 	WaitOnObject(subports_done);
 
 	while ( network_up ) {
-		/* we rely on run_user_handler to destroy this data structure */
-		packet = (network_interrupt_arg_t) malloc(sizeof(struct network_interrupt_arg));
-		assert(packet != NULL);
-
-		/* do receive */
-		packet->size = recvfrom(*s, packet->buffer, MAX_NETWORK_PKT_SIZE, 0,
-								(struct sockaddr *)&addr, &fromlen);
-		/* check for errors */
-		if (packet->size <= 0) {
-			int err = WSAGetLastError();
-			if( err == 10054){
-				dbgprintf("NET: Message sent to unavailable host.\n");
-				free(packet);
-				continue;
-			} else if ( err == WSAEINTR || err == WSAESHUTDOWN ) {
-				/* blocking operation canceled */
-				free(packet);
-				continue;
-			} else {
-				dbgprintf("NET: Error, %d.\n", err);
-				free(packet);
-				AbortOnCondition(1,"Crashing.");
-			}
-		}
-
-		/* make sure it's not from me */
-		if ( addr.sin_addr.s_addr == if_info.sin.sin_addr.s_addr &&
-			addr.sin_port == if_info.sin.sin_port ) {
-			free(packet);
+		WaitOnObject(poll_handoff);
+
+		FD_ZERO(&readable);
+		FD_SET(*s, &readable);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = PERIOD;
+		if ( select((int)*s + 1, &readable, NULL, NULL, &timeout) <= 0 ) {
+			/* timed out, or socket closed by network_cleanup */
 			continue;
 		}
 
-		/* check for virtual network interface control packet */
-		if ( 1 == packet->size && addr.sin_addr.s_addr == if_info.sin.sin_addr.s_addr ) {
-			if ( 1 == packet->buffer[0] ) {
-				/* register */
-				struct subport_node *new_node = malloc(sizeof(struct subport_node));
-				new_node->port_num = addr.sin_port;
-				new_node->next = registered_subports;
-				registered_subports = new_node;
-				free(packet);
-				continue;
-			} else if ( 0 == packet->buffer[0] ) {
-				/* deregister */
-				struct subport_node *temp = registered_subports, *prev = NULL;
-				while ( temp && temp->port_num != addr.sin_port ) {
-					prev = temp;
-					temp = temp->next;
-				}
-				if ( temp ) {
-					/* found it */
-					if ( prev ) {
-						prev->next = temp->next;
-					} else {
-						registered_subports = temp->next;
-					}
-					free(temp);
-				}
-				free(packet);
-				if ( !registered_subports ) {
-					ReleaseMutex(subports_done);
-				}
-				continue;
-			}
-		}
-
-		/* if this is broadcast message */
-		else if ( 2 == packet->buffer[packet->size - 1] ) {
-			if ( registered_subports ) {
-				/* forward this packet */
-				struct subport_node *temp = registered_subports;
-				struct sockaddr_in sin;
-				int new_size;
-				char *buf;
-		
-				/* set up dest address struct */
-				sin.sin_family = if_info.sin.sin_family;
-				sin.sin_addr.s_addr = if_info.sin.sin_addr.s_addr;
-
-				/* append real address info to message */
-				buf = &(packet->buffer[packet->size - 1]);
-				memcpy(buf, &(addr.sin_addr.s_addr), sizeof(addr.sin_addr.s_addr));
-				buf += sizeof(addr.sin_addr.s_addr);
-				memcpy(buf, &(addr.sin_port), sizeof(addr.sin_port));
-				buf += sizeof(addr.sin_port);
-				buf[0] = 2;
-				new_size = packet->size + sizeof(addr.sin_addr.s_addr) + sizeof(addr.sin_port);
-
-				while ( temp ) {
-					sin.sin_port = temp->port_num;
-					if ( sin.sin_port != addr.sin_port ) {
-						sendto(if_info.sock, packet->buffer, packet->size, 0, (struct sockaddr*)&sin, sizeof(sin));
-					}
-					temp = temp->next;
-				}
-			} else if ( NETWORK_PORT_START != my_udp_port ) {
-				/* packet has been forwarded, so fix address */
-				char *buf = &(packet->buffer[packet->size - 1 - sizeof(addr.sin_port) - sizeof(addr.sin_addr.s_addr)]);
-				memcpy(&(addr.sin_addr.s_addr), buf, sizeof(addr.sin_addr.s_addr));
-				buf += sizeof(addr.sin_addr.s_addr);
-				memcpy(&(addr.sin_port), buf, sizeof(addr.sin_port));
-				packet->size -= (sizeof(addr.sin_addr.s_addr) + sizeof(addr.sin_port));
-			}
-
-			/* regardless, skip over type info */
-			packet->size--;
-		}
-
-		/* if this is normal message */
-		else if ( 3 == packet->buffer[packet->size - 1] ) {
-			/* just skip over message type info */
-			packet->size--;
+		/* the receive thread may still be finishing a select when
+		 * the idle thread starts polling, so take turns on the socket
+		 */
+		WaitOnObject(receive_mutex);
+		received = network_receive(*s, &packet);
+		ReleaseMutex(receive_mutex);
+		if ( received ) {
+			/* send arg to users' handler */
+			send_interrupt(NETWORK_INTERRUPT_TYPE, (void*)packet);
 		}
-
-		assert(fromlen == sizeof(struct sockaddr_in));
-		sockaddr_to_network_address(&addr, packet->addr);
-
-		/* send arg to users' handler */
-		send_interrupt(NETWORK_INTERRUPT_TYPE, (void*)packet);
 	}
 
 	dbgprintf("...network interrupts stopped.\n");
@@ -613,6 +1260,8 @@ int start_network_poll(interrupt_handler_t network_handler, SOCKET* s) {
 
 	dbgprintf("Starting network interrupts...\n");
 
+	registered_handler = network_handler;
+
 	register_interrupt(NETWORK_INTERRUPT_TYPE, network_handler, INTERRUPT_DEFER);
 
 	/* create network thread */
@@ -621,3 +1270,76 @@ int start_network_poll(interrupt_handler_t network_handler, SOCKET* s) {
 
 	return 0;
 }
+
+
+/*
+ * append one datagram (gathered from bufs) to the capture file,
+ * behind a cooked link header and a synthesized ipv4 / udp header.
+ * called from both the sending minithreads and the network poll
+ * thread, so the file is protected by capture_mutex.
+ */
+int network_capture_record(int direction, struct sockaddr_in* from, struct sockaddr_in* to, WSABUF* bufs, int count) {
+	struct pcap_record_header record;
+	unsigned char header[CAPTURE_HEADER_SIZE];
+	unsigned char *ip = header + SLL_HEADER_SIZE;
+	unsigned char *udp = ip + IP_HEADER_SIZE;
+	unsigned __int64 now = currentTimeMillis();
+	unsigned long checksum = 0;
+	int data_len = 0;
+	int i;
+
+	if ( !capture_file ) {
+		return 0;
+	}
+
+	for ( i = 0; i < count; i++ ) {
+		data_len += bufs[i].len;
+	}
+
+	memset(header, 0, sizeof(header));
+
+	/* cooked link header: direction, no link address, ipv4 */
+	header[1] = (unsigned char)direction;
+	header[2] = 0xFF;
+	header[3] = 0xFE;
+	header[14] = 0x08;
+
+	/* ipv4 header */
+	ip[0] = 0x45;
+	ip[2] = (unsigned char)((IP_HEADER_SIZE + UDP_HEADER_SIZE + data_len) >> 8);
+	ip[3] = (unsigned char)(IP_HEADER_SIZE + UDP_HEADER_SIZE + data_len);
+	ip[8] = 64;
+	ip[9] = 17;
+	memcpy(ip + 12, &(from->sin_addr.s_addr), 4);
+	memcpy(ip + 16, &(to->sin_addr.s_addr), 4);
+	for ( i = 0; i < IP_HEADER_SIZE; i += 2 ) {
+		checksum += (ip[i] << 8) | ip[i + 1];
+	}
+	while ( checksum >> 16 ) {
+		checksum = (checksum & 0xFFFF) + (checksum >> 16);
+	}
+	ip[10] = (unsigned char)(~checksum >> 8);
+	ip[11] = (unsigned char)(~checksum);
+
+	/* udp header, no checksum */
+	memcpy(udp, &(from->sin_port), 2);
+	memcpy(udp + 2, &(to->sin_port), 2);
+	udp[4] = (unsigned char)((UDP_HEADER_SIZE + data_len) >> 8);
+	udp[5] = (unsigned char)(UDP_HEADER_SIZE + data_len);
+
+	record.ts_sec = (unsigned int)(now / 1000);
+	record.ts_usec = (unsigned int)((now % 1000) * 1000);
+	record.incl_len = record.orig_len = CAPTURE_HEADER_SIZE + data_len;
+
+	WaitOnObject(capture_mutex);
+	if ( capture_file ) {
+		fwrite(&record, sizeof(record), 1, capture_file);
+		fwrite(header, sizeof(header), 1, capture_file);
+		for ( i = 0; i < count; i++ ) {
+			fwrite(bufs[i].buf, 1, bufs[i].len, capture_file);
+		}
+	}
+	ReleaseMutex(capture_mutex);
+
+	return 0;
+}
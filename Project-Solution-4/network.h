@@ -23,11 +23,21 @@
 typedef unsigned long network_address_t[2];
 
 
+/* a compact stand in for an interned network_address_t. handles
+ * are small positive integers, valid until network_cleanup, and
+ * two handles are equal exactly when their addresses are.
+ */
+typedef int network_handle_t;
+#define NETWORK_HANDLE_NONE (0)
+
+
 /* a structure of this type is passed as an argument to
  * the network interrupt handler. addr gives the address
  * of the sender, buffer holds the message (which will
  * contain the minimsg header as well the minimsg data),
- * and size tells how many bytes long the message is.
+ * and size tells how many bytes long the message is. handle is
+ * the interned sender address (NETWORK_HANDLE_NONE if the table
+ * of interned addresses is full).
  * it is the interrupt handler's responsibility to free this
  * memory (and your program should not try to access this
  * memory outside of the interrupt handler), so you will need
@@ -35,6 +45,7 @@ typedef unsigned long network_address_t[2];
  */
 typedef struct network_interrupt_arg {
   network_address_t addr;
+  network_handle_t handle;
   char buffer[MAX_NETWORK_PKT_SIZE];
   int size;
 } *network_interrupt_arg_t;
@@ -75,8 +86,17 @@ int network_bcast_pkt(int data_len, char* data);
 int network_send_pkt(network_address_t dest_address, int data_len, char * data);
 
 
+/* sends raw data to the destination with the given handle,
+ * without converting the address again. it returns the number
+ * of bytes sent if it was able to successfully send the data
+ * or -1 otherwise.
+ */
+int network_send_pkt_to_handle(network_handle_t dest_handle, int data_len, char * data);
+
+
 /* translate hostname into a network address object. note
  * that hostname may actually be an ip address or hostname.
+ * resolved names are cached until network_cleanup.
  */
 int network_translate_hostname(char* hostname, network_address_t address);
 
@@ -104,10 +124,59 @@ int network_address_zero(network_address_t addr);
 int network_address_same(network_address_t a, network_address_t b);
 
 
+/* Intern an address, returning its handle. Interning the same
+ * address again returns the same handle. Returns NETWORK_HANDLE_NONE
+ * if the table of interned addresses is full.
+ */
+network_handle_t network_address_intern(network_address_t addr);
+
+
+/* Copy the address with the given handle into addr.
+ * Returns 0 on success, -1 if the handle is not valid.
+ */
+int network_handle_to_address(network_handle_t handle, network_address_t addr);
+
+
 /* Print an address
  */
 int network_address_print(network_address_t address);
 
 
+/* Start recording every datagram sent or received by this
+ * interface to the file filename, in pcap format (linux cooked
+ * capture link type, so each datagram keeps its direction,
+ * timestamp and addresses). Returns 0 on success, -1 on failure.
+ */
+int network_capture_start(char* filename);
+
+
+/* Stop recording and close the capture file.
+ */
+int network_capture_stop(void);
+
+
+/* Replay the datagrams received in the capture file filename,
+ * rounds times over, by handing each one to the network interrupt
+ * handler as fast as possible. Outgoing packets are dropped while
+ * the replay runs, and records too large for a packet are skipped.
+ * Call minimsg_replay_start first, so that minimsg recreates the
+ * captured ports and delivers every round in full, rather than
+ * dropping most of it.
+ * Must be called from a minithread after network_initialize.
+ * Returns the number of packets delivered, or -1 on failure.
+ */
+int network_replay(char* filename, int rounds);
+
+
+/* Busy poll the network for up to spin microseconds, handing
+ * any packet that arrives straight to the network interrupt handler
+ * rather than through an interrupt. Returns as soon as one packet
+ * has been delivered. Returns the number of packets delivered,
+ * so 0 means the spin ran out and delivery has fallen back to
+ * the blocking receive thread. Intended for the idle thread.
+ */
+int network_busy_poll(int spin);
+
+
 
 #endif __NETWORK_H_
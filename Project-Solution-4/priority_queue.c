@@ -1,5 +1,13 @@
 /*
  * priority_queue.c - implements our priority_queue ADT
+ *
+ * the queue is a 4-ary heap kept in an array, which is shallower than
+ * a binary heap and keeps a node's children next to each other in
+ * memory. each item is given a handle when it is enqueued, which
+ * indexes a table of where its node is in the heap, so it can be
+ * deleted, or its priority changed, in O(log n) without searching.
+ * items of equal priority are kept in the order they were enqueued
+ * by a sequence number.
  */
 
 #include "defs.h"
@@ -22,22 +30,42 @@ typedef void *any_t;
 typedef int (*PFany)(any_t, any_t);
 
 
+/*
+ * priority_queue_handle_t identifies an item while it is in
+ * the queue
+ */
+typedef int priority_queue_handle_t;
+
+
+/* the number of children of a node */
+#define PQ_ARITY (4)
+
+/* the number of nodes first allocated - the array doubles when full */
+#define PQ_INITIAL_SIZE (16)
+
+
+struct prio_node {
+	__int64 prio;
+	__int64 seq;
+	any_t item;
+	priority_queue_handle_t handle;
+};
+
 /*
  * priority_queue holds all the state associated
  * with an instance of our ADT
  */
 struct priority_queue {
-	struct prio_node *first;
+	struct prio_node *heap;
 	int count;
+	int size;
+	int order;
+	__int64 next_seq;
+	int *positions;  // the heap index of each handle's node, or the next free handle
+	int free_handle;  // the first free handle, or -1
 };
 typedef struct priority_queue *priority_queue_t;
 
-struct prio_node {
-	any_t item;
-	int prio;
-	struct prio_node *next;
-};
-
 /*
  * priority_queue_order is an enumeration which is used to specify
  * whether larger values are considered higher priority or vice
@@ -51,6 +79,128 @@ typedef enum priority_queue_order priority_queue_order_t;
 
 
 
+/*
+ * HELPER FUNCTIONS
+ */
+
+/* true if node a should be dequeued before node b */
+static int pq_before(priority_queue_t obj, struct prio_node *a, struct prio_node *b) {
+	if ( a->prio != b->prio ) {
+		return obj->order == PQ_PRIORITY_DESCEND ? a->prio > b->prio : a->prio < b->prio;
+	}
+	return a->seq < b->seq;
+}
+
+/* put a node at an index of the heap, and record where its handle is */
+static void pq_place(priority_queue_t obj, int index, struct prio_node *node) {
+	obj->heap[index] = *node;
+	obj->positions[node->handle] = index;
+}
+
+/* move the node at index up until its parent comes before it */
+static void pq_sift_up(priority_queue_t obj, int index) {
+	struct prio_node node = obj->heap[index];
+	int parent;
+
+	while ( index > 0 ) {
+		parent = (index - 1) / PQ_ARITY;
+		if ( !pq_before(obj, &node, &obj->heap[parent]) ) {
+			break;
+		}
+		pq_place(obj, index, &obj->heap[parent]);
+		index = parent;
+	}
+	pq_place(obj, index, &node);
+}
+
+/* move the node at index down until it comes before all its children */
+static void pq_sift_down(priority_queue_t obj, int index) {
+	struct prio_node node = obj->heap[index];
+	int child, first, last, best;
+
+	for ( ;; ) {
+		first = index * PQ_ARITY + 1;
+		if ( first >= obj->count ) {
+			break;
+		}
+		last = first + PQ_ARITY < obj->count ? first + PQ_ARITY : obj->count;
+		best = first;
+		for ( child = first + 1; child < last; child++ ) {
+			if ( pq_before(obj, &obj->heap[child], &obj->heap[best]) ) {
+				best = child;
+			}
+		}
+		if ( !pq_before(obj, &obj->heap[best], &node) ) {
+			break;
+		}
+		pq_place(obj, index, &obj->heap[best]);
+		index = best;
+	}
+	pq_place(obj, index, &node);
+}
+
+/* take the node at index out of the heap, freeing its handle */
+static void pq_remove(priority_queue_t obj, int index) {
+	priority_queue_handle_t handle = obj->heap[index].handle;
+
+	obj->positions[handle] = obj->free_handle;
+	obj->free_handle = handle;
+
+	obj->count--;
+	if ( index == obj->count ) {
+		return;
+	}
+	// fill the hole with the last node, which may belong above or below it
+	pq_place(obj, index, &obj->heap[obj->count]);
+	if ( index > 0 && pq_before(obj, &obj->heap[index], &obj->heap[(index - 1) / PQ_ARITY]) ) {
+		pq_sift_up(obj, index);
+	} else {
+		pq_sift_down(obj, index);
+	}
+}
+
+/* the heap index of a handle's node, or -1 if it is not a handle in use */
+static int pq_index(priority_queue_t obj, priority_queue_handle_t handle) {
+	int index;
+	if ( handle < 0 || handle >= obj->size ) {
+		return -1;
+	}
+	index = obj->positions[handle];
+	if ( index < 0 || index >= obj->count || obj->heap[index].handle != handle ) {
+		return -1;
+	}
+	return index;
+}
+
+/* double the room for nodes and handles */
+static int pq_grow(priority_queue_t obj) {
+	int size = obj->size * 2;
+	struct prio_node *heap;
+	int *positions;
+	int i;
+
+	heap = realloc(obj->heap, size * sizeof(struct prio_node));
+	if ( !heap ) {
+		return -1;
+	}
+	obj->heap = heap;
+	positions = realloc(obj->positions, size * sizeof(int));
+	if ( !positions ) {
+		return -1;
+	}
+	obj->positions = positions;
+
+	// the new handles are free
+	for ( i = size - 1; i >= obj->size; i-- ) {
+		obj->positions[i] = obj->free_handle;
+		obj->free_handle = i;
+	}
+	obj->size = size;
+	return 0;
+}
+
+
+
 /*
  * FUNCTION DECLARATIONS
  */
@@ -64,46 +214,61 @@ typedef enum priority_queue_order priority_queue_order_t;
  */
 priority_queue_t priority_queue_new(priority_queue_order_t order) {
 	priority_queue_t obj = malloc(sizeof(struct priority_queue));
-	obj->first = NULL;
+	int i;
+	if ( !obj ) {
+		return NULL;
+	}
+	obj->heap = malloc(PQ_INITIAL_SIZE * sizeof(struct prio_node));
+	obj->positions = malloc(PQ_INITIAL_SIZE * sizeof(int));
+	if ( !obj->heap || !obj->positions ) {
+		free(obj->heap);
+		free(obj->positions);
+		free(obj);
+		return NULL;
+	}
 	obj->count = 0;
+	obj->size = PQ_INITIAL_SIZE;
+	obj->order = order;
+	obj->next_seq = 0;
+	obj->free_handle = -1;
+	for ( i = PQ_INITIAL_SIZE - 1; i >= 0; i-- ) {
+		obj->positions[i] = obj->free_handle;
+		obj->free_handle = i;
+	}
 	return obj;
 }
 
 
 /*
  * Enqueue an item with specified priority to a priority queue
- * (all specifed as parameters).
+ * (all specifed as parameters). If handle_p is not NULL, the
+ * item's handle is returned there.
  * On success return 0 (success).
  * On failure return -1 (failure). In this case the state of the
  * priority queue should left as it was before this call.
  */
-int priority_queue_enqueue(priority_queue_t obj, int priority, any_t item) {
-	if ( obj ) {
-		struct prio_node *new_node = malloc(sizeof(struct prio_node));
-		new_node->item = item;
-		new_node->prio = priority;
-		new_node->next = NULL;
-		if ( obj->count == 0 ) {
-			obj->first = new_node;
-		} else {
-			struct prio_node *temp = obj->first;
-			struct prio_node *prev = NULL;
-			while ( temp && temp->prio < priority ) {
-				prev = temp;
-				temp = temp->next;
-			}
-			if ( prev == NULL ) {
-				new_node->next = obj->first;
-				obj->first = new_node;
-			} else {
-				prev->next = new_node;
-				new_node->next = temp;
-			}
-		}
-		obj->count++;
-		return 0;
+int priority_queue_enqueue(priority_queue_t obj, __int64 priority, any_t item, priority_queue_handle_t *handle_p) {
+	struct prio_node node;
+	if ( !obj ) {
+		return -1;
 	}
-	return -1;
+	if ( obj->free_handle == -1 && pq_grow(obj) != 0 ) {
+		return -1;
+	}
+	node.prio = priority;
+	node.seq = obj->next_seq++;
+	node.item = item;
+	node.handle = obj->free_handle;
+	obj->free_handle = obj->positions[node.handle];
+
+	pq_place(obj, obj->count, &node);
+	obj->count++;
+	pq_sift_up(obj, obj->count - 1);
+
+	if ( handle_p ) {
+		*handle_p = node.handle;
+	}
+	return 0;
 }
 
 /*
@@ -122,12 +287,8 @@ int priority_queue_enqueue(priority_queue_t obj, int priority, any_t item) {
  */
 int priority_queue_dequeue(priority_queue_t obj, any_t* item_p) {
 	if ( obj && obj->count > 0 ) {
-		struct prio_node *temp;
-		*item_p = obj->first->item;
-		temp = obj->first;
-		obj->first = obj->first->next;
-		free(temp);
-		obj->count--;
+		*item_p = obj->heap[0].item;
+		pq_remove(obj, 0);
 		return 0;
 	}
 	*item_p = NULL;
@@ -145,7 +306,7 @@ int priority_queue_dequeue(priority_queue_t obj, any_t* item_p) {
  */
 int priority_queue_peak(priority_queue_t obj, any_t* item_p) {
 	if ( obj && obj->count > 0 ) {
-		*item_p = obj->first->item;
+		*item_p = obj->heap[0].item;
 		return 0;
 	}
 	*item_p = NULL;
@@ -162,13 +323,18 @@ int priority_queue_peak(priority_queue_t obj, any_t* item_p) {
  * the second paramter. If at any point iter_func returns -1,
  * then stop iterating and return -1 (failure).
  * Otherwise, return 0 (success).
- * At first glance this function will seem useless, but keep in mind
- * that data is a void pointer type and so can be a pointer to anything,
- * so values can returned out via it (which also affects the value received
- * by the function on the next iteration), or it can point to a larger structure
- * whose fields are modified by iter_func.
+ * The items are visited in heap order, not priority order.
  */
 int priority_queue_iterate(priority_queue_t obj, PFany iter_func, any_t item) {
+	int i;
+	if ( !obj || !iter_func || obj->count == 0 ) {
+		return -1;
+	}
+	for ( i = 0; i < obj->count; i++ ) {
+		if ( iter_func(obj->heap[i].item, item) == -1 ) {
+			return -1;
+		}
+	}
 	return 0;
 }
 
@@ -180,12 +346,8 @@ int priority_queue_iterate(priority_queue_t obj, PFany iter_func, any_t item) {
  */
 int priority_queue_free(priority_queue_t obj) {
 	if ( obj ) {
-		struct prio_node *temp;
-		while ( obj->first ) {
-			temp = obj->first;
-			obj->first = obj->first->next;
-			free(temp);
-		}
+		free(obj->heap);
+		free(obj->positions);
 		free(obj);
 		return 0;
 	}
@@ -199,6 +361,9 @@ int priority_queue_free(priority_queue_t obj) {
  * Otherwise, return -1 (failure).
  */
 int priority_queue_length(priority_queue_t obj) {
+	if ( !obj ) {
+		return -1;
+	}
 	return obj->count;
 }
 
@@ -209,23 +374,56 @@ int priority_queue_length(priority_queue_t obj) {
  * Otherwise, return -1 (failure)
  */
 int priority_queue_delete(priority_queue_t obj, any_t item) {
-	if ( obj && obj->count != 0 ) {
-		struct prio_node *temp = obj->first;
-		struct prio_node *prev = NULL;
-		while ( temp && temp->item != item ) {
-			prev = temp;
-			temp = temp->next;
-		}
-		if ( temp->item == item ) {
-			if ( prev == NULL ) {
-				obj->first = temp->next;
-			} else {
-				prev->next = temp->next;
+	int i;
+	if ( obj ) {
+		for ( i = 0; i < obj->count; i++ ) {
+			if ( obj->heap[i].item == item ) {
+				pq_remove(obj, i);
+				return 0;
 			}
-			free(temp);
-			obj->count--;
-			return 0;
 		}
 	}
 	return -1;
 }
+
+
+/*
+ * If the priority queue is valid and handle is the handle of an
+ * item in it, remove the item, returning it in item_p if that is
+ * not NULL, and return 0 (success).
+ * Otherwise, return -1 (failure)
+ */
+int priority_queue_delete_handle(priority_queue_t obj, priority_queue_handle_t handle, any_t* item_p) {
+	int index;
+	if ( !obj || (index = pq_index(obj, handle)) == -1 ) {
+		return -1;
+	}
+	if ( item_p ) {
+		*item_p = obj->heap[index].item;
+	}
+	pq_remove(obj, index);
+	return 0;
+}
+
+
+/*
+ * If the priority queue is valid and handle is the handle of an
+ * item in it, change the item's priority, and return 0 (success).
+ * The item is then dequeued after any already enqueued with the
+ * same priority.
+ * Otherwise, return -1 (failure)
+ */
+int priority_queue_change_priority(priority_queue_t obj, priority_queue_handle_t handle, __int64 priority) {
+	int index;
+	if ( !obj || (index = pq_index(obj, handle)) == -1 ) {
+		return -1;
+	}
+	obj->heap[index].prio = priority;
+	obj->heap[index].seq = obj->next_seq++;
+	if ( index > 0 && pq_before(obj, &obj->heap[index], &obj->heap[(index - 1) / PQ_ARITY]) ) {
+		pq_sift_up(obj, index);
+	} else {
+		pq_sift_down(obj, index);
+	}
+	return 0;
+}
@@ -37,6 +37,14 @@ typedef int (*PFany)(any_t, any_t);
 typedef struct priority_queue *priority_queue_t;
 
 
+/*
+ * priority_queue_handle_t identifies an item while it is in the
+ * priority queue - once it is dequeued or deleted, its handle may
+ * be given to another item.
+ */
+typedef int priority_queue_handle_t;
+
+
 /*
  * priority_queue_order is an enumeration which is used to specify
  * whether larger values are considered higher priority or vice
@@ -66,12 +74,15 @@ extern priority_queue_t priority_queue_new(priority_queue_order_t order);
 
 /*
  * Enqueue an item with specified priority to a priority queue
- * (all specifed as parameters).
+ * (all specifed as parameters). Priorities are 64 bit, so they
+ * can be times in nanoseconds. Items of equal priority are
+ * dequeued in the order they were enqueued. If handle_p is not
+ * NULL, the item's handle is returned there. Takes O(log n) time.
  * On success return 0 (success).
  * On failure return -1 (failure). In this case the state of the
  * priority queue should left as it was before this call.
  */
-extern int priority_queue_enqueue(priority_queue_t obj, int priority, any_t item);
+extern int priority_queue_enqueue(priority_queue_t obj, __int64 priority, any_t item, priority_queue_handle_t *handle_p);
 
 
 /*
@@ -116,6 +127,7 @@ extern int priority_queue_peak(priority_queue_t obj, any_t* item_p);
  * so values can returned out via it (which also affects the value received
  * by the function on the next iteration), or it can point to a larger structure
  * whose fields are modified by iter_func.
+ * The items are visited in no particular order.
  */
 extern int priority_queue_iterate(priority_queue_t obj, PFany iter_func, any_t item);
 
@@ -140,8 +152,28 @@ extern int priority_queue_length(priority_queue_t obj);
  * If the priority queue is valid and the item is in the priority queue,
  * remove the item from the priority queue, and return 0 (success).
  * Otherwise, return -1 (failure)
+ * This searches for the item - priority_queue_delete_handle does not.
  */
 extern int priority_queue_delete(priority_queue_t obj, any_t item);
 
 
+/*
+ * If the priority queue is valid and handle is the handle of an
+ * item in it, remove the item, returning it in item_p if that is
+ * not NULL, and return 0 (success). Takes O(log n) time.
+ * Otherwise, return -1 (failure)
+ */
+extern int priority_queue_delete_handle(priority_queue_t obj, priority_queue_handle_t handle, any_t* item_p);
+
+
+/*
+ * If the priority queue is valid and handle is the handle of an
+ * item in it, change the item's priority, and return 0 (success).
+ * The item is then dequeued after any already enqueued with the
+ * same priority. Takes O(log n) time.
+ * Otherwise, return -1 (failure)
+ */
+extern int priority_queue_change_priority(priority_queue_t obj, priority_queue_handle_t handle, __int64 priority);
+
+
 #endif __PRIORITY_QUEUE_H__
@@ -11,6 +11,7 @@
 
 #include "defs.h"
 
+#include "machineprimitives_ext.h"
 #include "queue.h"
 
 
@@ -235,3 +236,187 @@ int queue_delete(queue_t obj, any_t item) {
 	}
 	return -1;
 }
+
+
+
+/*
+ * INTRUSIVE QUEUE FUNCTION DEFINITIONS
+ */
+
+/*
+ * Initialize an empty intrusive queue, and return 0 (success).
+ */
+int iqueue_init(iqueue_t *obj) {
+	obj->first = obj->last = NULL;
+	obj->count = 0;
+	return 0;
+}
+
+
+/*
+ * Initialize a link which is on no queue.
+ */
+void iqueue_link_init(queue_link_t *link) {
+	link->prev = link->next = NULL;
+	link->queue = NULL;
+}
+
+
+/*
+ * Prepend a link to a queue. 
+ * Return 0 (success), or -1 (failure) if the link is already on a queue.
+ */
+int iqueue_prepend(iqueue_t *obj, queue_link_t *link) {
+	if ( obj && !link->queue ) {
+		link->prev = NULL;
+		link->next = obj->first;
+		if ( obj->first ) {
+			obj->first->prev = link;
+		} else {
+			obj->last = link;
+		}
+		obj->first = link;
+		link->queue = obj;
+		obj->count++;
+		return 0;
+	}
+	return -1;
+}
+
+
+/*
+ * Append a link to a queue. 
+ * Return 0 (success), or -1 (failure) if the link is already on a queue.
+ */
+int iqueue_append(iqueue_t *obj, queue_link_t *link) {
+	if ( obj && !link->queue ) {
+		link->next = NULL;
+		link->prev = obj->last;
+		if ( obj->last ) {
+			obj->last->next = link;
+		} else {
+			obj->first = link;
+		}
+		obj->last = link;
+		link->queue = obj;
+		obj->count++;
+		return 0;
+	}
+	return -1;
+}
+
+
+/*
+ * Dequeue the first link from the queue.
+ * Return 0 (success) and the link if the queue is nonempty,
+ * and -1 (failure) and NULL if it is empty.
+ */
+int iqueue_dequeue(iqueue_t *obj, queue_link_t **link_p) {
+	if ( obj && obj->count > 0 ) {
+		*link_p = obj->first;
+		return iqueue_delete(obj, obj->first);
+	}
+	*link_p = NULL;
+	return -1;
+}
+
+
+/*
+ * If the link is on this queue, remove it in constant time and
+ * return 0 (success). Otherwise, return -1 (failure).
+ */
+int iqueue_delete(iqueue_t *obj, queue_link_t *link) {
+	if ( obj && link->queue == obj ) {
+		if ( link->prev ) {
+			link->prev->next = link->next;
+		} else {
+			obj->first = link->next;
+		}
+		if ( link->next ) {
+			link->next->prev = link->prev;
+		} else {
+			obj->last = link->prev;
+		}
+		link->prev = link->next = NULL;
+		link->queue = NULL;
+		obj->count--;
+		return 0;
+	}
+	return -1;
+}
+
+
+/*
+ * Return the number of links on the queue.
+ */
+int iqueue_length(iqueue_t *obj) {
+	return obj->count;
+}
+
+
+
+/*
+ * MULTI-PRODUCER SINGLE-CONSUMER QUEUE FUNCTION DEFINITIONS
+ */
+
+/*
+ * Initialize an empty queue, and return 0 (success).
+ */
+int mpsc_queue_init(mpsc_queue_t *obj) {
+	obj->stub.next = NULL;
+	obj->head = obj->tail = &(obj->stub);
+	return 0;
+}
+
+
+/*
+ * Append a link to the queue. Safe to call from any thread.
+ */
+void mpsc_queue_push(mpsc_queue_t *obj, mpsc_link_t *link) {
+	mpsc_link_t *prev;
+
+	link->next = NULL;
+	// claim the end of the queue, then link the previous end to us -
+	// until then, a pop stops short at prev
+	prev = (mpsc_link_t *)swap_pointer((void **)&(obj->head), link);
+	prev->next = link;
+}
+
+
+/*
+ * Remove the first link from the queue. Only one thread may pop at
+ * a time. Return 0 (success) and the link, or -1 (failure) and NULL
+ * if the queue is empty or the next push is not yet complete.
+ */
+int mpsc_queue_pop(mpsc_queue_t *obj, mpsc_link_t **link_p) {
+	mpsc_link_t *tail = obj->tail;
+	mpsc_link_t *next = tail->next;
+
+	*link_p = NULL;
+	if ( tail == &(obj->stub) ) {
+		// skip the stub
+		if ( next == NULL ) {
+			return -1;
+		}
+		obj->tail = tail = next;
+		next = next->next;
+	}
+	if ( next ) {
+		obj->tail = next;
+		*link_p = tail;
+		return 0;
+	}
+	if ( tail != obj->head ) {
+		// a push has claimed the end, but not yet linked to it
+		return -1;
+	}
+	// tail is the last link - put the stub behind it, so it can go
+	mpsc_queue_push(obj, &(obj->stub));
+	next = tail->next;
+	if ( next ) {
+		obj->tail = next;
+		*link_p = tail;
+		return 0;
+	}
+	return -1;
+}
@@ -126,4 +126,136 @@ extern int queue_length(queue_t obj);
 extern int queue_delete(queue_t obj, any_t item);
 
 
+
+/*
+ * INTRUSIVE QUEUES
+ *
+ * a variant of the queue for items which carry their own links, so
+ * adding an item never allocates and removing a given item does not
+ * search the queue. the item embeds a queue_link_t, which is on at
+ * most one intrusive queue at a time, and queue_item recovers the
+ * item from its link.
+ */
+#include <stddef.h>
+
+typedef struct queue_link queue_link_t;
+typedef struct iqueue iqueue_t;
+
+struct queue_link {
+	queue_link_t *prev;
+	queue_link_t *next;
+	iqueue_t *queue; /* the queue the link is on, or NULL */
+};
+
+/*
+ * unlike queue_t this is the structure itself, so it can be
+ * embedded in whatever owns the queue. it must be initialized
+ * with iqueue_init before use.
+ */
+struct iqueue {
+	queue_link_t *first;
+	queue_link_t *last;
+	int count;
+};
+
+/*
+ * the item of type "type" whose queue_link_t member "member" is link
+ */
+#define queue_item(link, type, member) \
+	((type *)((char *)(link) - offsetof(type, member)))
+
+
+/*
+ * Initialize an empty intrusive queue, and return 0 (success).
+ */
+extern int iqueue_init(iqueue_t *obj);
+
+
+/*
+ * Initialize a link which is on no queue.
+ */
+extern void iqueue_link_init(queue_link_t *link);
+
+
+/*
+ * Prepend a link to a queue. 
+ * Return 0 (success), or -1 (failure) if the link is already on a queue.
+ */
+extern int iqueue_prepend(iqueue_t *obj, queue_link_t *link);
+
+
+/*
+ * Append a link to a queue. 
+ * Return 0 (success), or -1 (failure) if the link is already on a queue.
+ */
+extern int iqueue_append(iqueue_t *obj, queue_link_t *link);
+
+
+/*
+ * Dequeue the first link from the queue.
+ * Return 0 (success) and the link if the queue is nonempty,
+ * and -1 (failure) and NULL if it is empty.
+ */
+extern int iqueue_dequeue(iqueue_t *obj, queue_link_t **link_p);
+
+
+/*
+ * If the link is on this queue, remove it in constant time and
+ * return 0 (success). Otherwise, return -1 (failure).
+ */
+extern int iqueue_delete(iqueue_t *obj, queue_link_t *link);
+
+
+/*
+ * Return the number of links on the queue.
+ */
+extern int iqueue_length(iqueue_t *obj);
+
+
+
+/*
+ * MULTI-PRODUCER SINGLE-CONSUMER QUEUES
+ *
+ * a lock-free intrusive queue (after Vyukov's) which any number of
+ * threads, on any worker, may push to at once, without disabling
+ * interrupts, while one thread at a time pops. a push is one atomic
+ * exchange. the item embeds an mpsc_link_t, and queue_item recovers
+ * the item from its link.
+ */
+typedef struct mpsc_link mpsc_link_t;
+typedef struct mpsc_queue mpsc_queue_t;
+
+struct mpsc_link {
+	mpsc_link_t * volatile next;
+};
+
+struct mpsc_queue {
+	mpsc_link_t * volatile head; /* the last link pushed */
+	mpsc_link_t *tail; /* the next link to pop */
+	mpsc_link_t stub; /* on the queue when it would otherwise be empty */
+};
+
+
+/*
+ * Initialize an empty queue, and return 0 (success).
+ */
+extern int mpsc_queue_init(mpsc_queue_t *obj);
+
+
+/*
+ * Append a link to the queue. Safe to call from any thread.
+ */
+extern void mpsc_queue_push(mpsc_queue_t *obj, mpsc_link_t *link);
+
+
+/*
+ * Remove the first link from the queue. Only one thread may pop at
+ * a time. Return 0 (success) and the link, or -1 (failure) and NULL
+ * if the queue is empty, or if the next link's push is not yet
+ * complete - which a consumer counting pushes should wait out by
+ * yielding and trying again.
+ */
+extern int mpsc_queue_pop(mpsc_queue_t *obj, mpsc_link_t **link_p);
+
+
 #endif __QUEUE_H__
@@ -15,6 +15,10 @@ unsigned int start(void) {
 #ifdef WINCE
   /* for ARM processor PC is in position 9 in jmp_buf */
   return buf[10];
+#elif defined(__linux__)
+  /* glibc mangles the saved PC, and addresses are 64 bit -
+     interrupts_linux.c uses the address of this function instead */
+  return 0;
 #else
   /* for x86 processor PC is in position 6 in jmp_buf */
   return buf[5];
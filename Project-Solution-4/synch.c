@@ -1,10 +1,15 @@
 
-#include "machineprimitives.h"
+#include "machineprimitives_ext.h"
 #include "defs.h"
 
+#include "interrupts.h"
 #include "minithread.h"
+#include "minithread_private.h"
 #include "synch.h"
+#include "synch_private.h"
 #include "queue.h"
+#include "alarm_private.h"
+#include "trace.h"
 
 
 
@@ -15,14 +20,160 @@
 
 /*
  * Semaphores.
+ *
+ * a semaphore is guarded by disabling interrupts, which with several
+ * workers also takes the kernel lock. V hands its unit straight to the
+ * thread it wakes, rather than adding it to count for the thread to
+ * take once it runs, so a woken thread never has to retry, and no
+ * other thread can take the unit first.
+ *
+ * a thread waiting on several semaphores, or with a timeout, queues
+ * a group of waiters, one on each. whichever V or alarm grants the
+ * group wins, and the thread takes its other waiters off their queues
+ * itself when it wakes. the timeout is a
+ * direct alarm, fired with interrupts disabled, so it is never part
+ * way through when the thread wakes, and it does not need a free
+ * callback thread - a callback may wait with a timeout.
  */
 
+#define SEMAPHORE_ANY_INLINE (8) // semaphores waited on without allocating
+
+
 struct semaphore {
 	int count;
-	tas_lock_t lock;
-	queue_t thread_queue;
+	iqueue_t waiters;
 };
 
+
+/*
+ * Mutexes.
+ *
+ * locking an unlocked mutex, and unlocking one no thread is waiting
+ * for, is one compare_and_swap. otherwise the mutex is guarded as a
+ * semaphore is, and unlocking hands it straight to the first waiter.
+ * a thread which waits for a mutex lends its priority to the owner.
+ * the owner keeps each mutex it holds which is waited for on its
+ * boosting queue, so that unlocking one takes back only what that
+ * mutex's waiters lent.
+ */
+
+#define MUTEX_UNLOCKED (0)
+#define MUTEX_LOCKED (1)
+#define MUTEX_CONTENDED (2) // locked, and threads are waiting for it
+
+struct mutex {
+	int state;
+	minithread_t owner;
+	iqueue_t waiters;
+	queue_link_t boosting; // on the owner's boosting queue while waited for
+};
+
+
+/*
+ * Condition variables.
+ *
+ * a signalled waiter is not woken to contend for its mutex, but moved
+ * to the mutex's waiters, and woken once it has been handed the mutex.
+ */
+
+struct condvar {
+	iqueue_t waiters;
+};
+
+
+/*
+ * Reader-writer locks.
+ *
+ * state holds the number of readers, or RWLOCK_WRITER, and
+ * RWLOCK_WAITING while any thread waits. taking or releasing a lock
+ * no thread is waiting for is one compare_and_swap. once a thread
+ * waits, new readers wait behind it, so writers are not starved, and
+ * each release hands the lock on to the next writer, or all the
+ * readers next in line.
+ */
+
+#define RWLOCK_READERS (0x1fffffff)
+#define RWLOCK_WAITING (0x20000000)
+#define RWLOCK_WRITER (0x40000000)
+
+struct rwlock {
+	int state;
+	iqueue_t waiters;
+};
+
+
+// initialize a waiter for the calling thread
+void synch_waiter_init(struct synch_waiter *waiter) {
+	iqueue_link_init(&(waiter->link));
+	waiter->thread = minithread_self();
+	waiter->granted = 0;
+	waiter->write = 0;
+	waiter->mutex = NULL;
+	waiter->group = waiter;
+	waiter->index = 0;
+	waiter->which = 0;
+	waiter->value = NULL;
+	waiter->closed = 0;
+}
+
+// with interrupts disabled, block until the waiter is granted
+void synch_wait(struct synch_waiter *waiter) {
+	while ( !waiter->granted ) {
+		// stopping switches away, and interrupts are enabled again
+		// by the switch, so the grant cannot come before we stop
+		minithread_stop();
+		set_interrupt_level(DISABLED);
+	}
+}
+
+// with interrupts disabled, give a waiter what it waits for
+void synch_grant(struct synch_waiter *waiter) {
+	waiter->granted = 1;
+	minithread_start(waiter->thread);
+}
+
+// with interrupts disabled, add a waiter to a group and a queue
+void synch_group_add(struct synch_waiter *group, struct synch_waiter *waiter, int index, iqueue_t *waiters) {
+	synch_waiter_init(waiter);
+	waiter->group = group;
+	waiter->index = index;
+	iqueue_append(waiters, &(waiter->link));
+}
+
+// with interrupts disabled, take the first waiter whose group is
+// still waiting, skipping any whose thread has been granted through
+// another queue, or has timed out
+struct synch_waiter *synch_group_take(iqueue_t *waiters) {
+	queue_link_t *link;
+	struct synch_waiter *waiter;
+
+	while ( iqueue_dequeue(waiters, &link) == 0 ) {
+		waiter = queue_item(link, struct synch_waiter, link);
+		if ( !waiter->group->granted ) {
+			return waiter;
+		}
+	}
+	return NULL;
+}
+
+// with interrupts disabled, grant a waiter's group through it
+void synch_group_grant(struct synch_waiter *waiter) {
+	waiter->group->which = waiter->index;
+	synch_grant(waiter->group);
+}
+
+// with interrupts disabled, cancel the waits of a group which lost
+void synch_group_cancel(struct synch_waiter waiters[], int n) {
+	int i;
+
+	for ( i = 0; i < n; i++ ) {
+		if ( waiters[i].link.queue ) {
+			iqueue_delete(waiters[i].link.queue, &(waiters[i].link));
+		}
+	}
+}
+
+
 /*
  * semaphore_t semaphore_create()
  *	Allocate a new semaphore.
@@ -31,13 +182,8 @@ semaphore_t semaphore_create() {
 	semaphore_t sem = (semaphore_t)malloc(sizeof(struct semaphore));
 	if (sem == NULL)
 		return NULL;
-	sem->thread_queue = queue_new();
-	if (sem->thread_queue == NULL) {
-		free(sem);
-		return NULL;
-	}
+	iqueue_init(&(sem->waiters));
 	sem->count = 0;
-	sem->lock = 0;
 	return sem;
 }
 
@@ -46,7 +192,6 @@ semaphore_t semaphore_create() {
  *	Deallocate a semaphore.
  */
 int semaphore_destroy(semaphore_t sem) {
-	queue_free(sem->thread_queue);
 	free(sem);
 	return 0;
 }
@@ -61,10 +206,85 @@ int semaphore_initialize(semaphore_t sem, int count) {
 	return 0;
 }
 
-//spin on a lock until it becomes available
-void semaphore_spinlock(tas_lock_t *lock) {
-	while (atomic_test_and_set(lock))
-		minithread_yield();
+// the direct alarm ending a timed wait, fired with interrupts disabled.
+// the waiter is still on the stack, as the waiting thread deregisters
+// this before it returns
+static void semaphore_timeout(arg_t arg) {
+	struct synch_waiter *waiter = (struct synch_waiter *)arg;
+
+	if ( !waiter->granted ) {
+		waiter->which = -1;
+		synch_grant(waiter);
+	}
+}
+
+// P on whichever of n semaphores first has a unit, waiting at most ms
+// milliseconds unless ms is negative, and return the index of the
+// semaphore P'd, or -1 if none was
+static int semaphore_wait(semaphore_t sems[], int n, int ms) {
+	struct synch_waiter inline_waiters[SEMAPHORE_ANY_INLINE];
+	struct synch_waiter *waiters = inline_waiters;
+	struct synch_waiter *waiter;
+	alarm_id_t timer = ALARM_ID_NONE;
+	interrupt_level_t old_int;
+	int i;
+
+	if ( n <= 0 ) {
+		return -1;
+	}
+	if ( n > SEMAPHORE_ANY_INLINE ) {
+		waiters = (struct synch_waiter *)malloc(n * sizeof(struct synch_waiter));
+		if ( waiters == NULL ) {
+			return -1;
+		}
+	}
+	waiter = &(waiters[0]);
+
+	old_int = set_interrupt_level(DISABLED);
+	for ( i = 0; i < n; i++ ) {
+		if ( sems[i]->count > 0 ) {
+			sems[i]->count--;
+			set_interrupt_level(old_int);
+			if ( waiters != inline_waiters ) {
+				free(waiters);
+			}
+			return i;
+		}
+	}
+	if ( ms == 0 ) {
+		set_interrupt_level(old_int);
+		if ( waiters != inline_waiters ) {
+			free(waiters);
+		}
+		return -1;
+	}
+
+	// one waiter on each semaphore, all granted through the first
+	for ( i = 0; i < n; i++ ) {
+		synch_group_add(waiter, &(waiters[i]), i, &(sems[i]->waiters));
+	}
+	if ( ms > 0 ) {
+		if ( alarm_register_direct(ms, semaphore_timeout, (arg_t)waiter, &timer) != 0 ) {
+			// we could never time out, so give up now
+			waiter->which = -1;
+			waiter->granted = 1;
+		}
+	}
+	TRACE_EVENT(TRACE_SEM_BLOCK, minithread_id(), sems[0]);
+	synch_wait(waiter);
+
+	synch_group_cancel(waiters, n);
+	if ( timer != ALARM_ID_NONE ) {
+		// does nothing if it has fired
+		alarm_deregister(timer);
+	}
+	set_interrupt_level(old_int);
+
+	i = waiter->which;
+	if ( waiters != inline_waiters ) {
+		free(waiters);
+	}
+	return i;
 }
 
 /*
@@ -72,18 +292,35 @@ void semaphore_spinlock(tas_lock_t *lock) {
  *	P on the sempahore.
  */
 void semaphore_P(semaphore_t sem) {
-	//Loop until we succeed
-	semaphore_spinlock(&(sem->lock));
-	while (sem->count == 0) {
-		queue_append(sem->thread_queue, minithread_self());
-		atomic_clear(&(sem->lock));
-		minithread_stop();
-		semaphore_spinlock(&(sem->lock));
+	struct synch_waiter waiter;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+
+	// one semaphore and no timeout needs just the one waiter
+	if ( sem->count > 0 ) {
+		sem->count--;
+	} else {
+		synch_waiter_init(&waiter);
+		iqueue_append(&(sem->waiters), &(waiter.link));
+		TRACE_EVENT(TRACE_SEM_BLOCK, minithread_id(), sem);
+		synch_wait(&waiter);
 	}
+	set_interrupt_level(old_int);
+}
+
+/*
+ * semaphore_P_timed(semaphore_t sem, int ms)
+ *	P on the semaphore, giving up after ms milliseconds.
+ */
+int semaphore_P_timed(semaphore_t sem, int ms) {
+	return semaphore_wait(&sem, 1, ms) == 0 ? 0 : -1;
+}
 
-	//Got the semaphore. Decrement and break
-	sem->count--;
-	atomic_clear(&(sem->lock));
+/*
+ * semaphore_P_any(semaphore_t sems[], int n)
+ *	P on whichever of the semaphores first has a unit.
+ */
+int semaphore_P_any(semaphore_t sems[], int n) {
+	return semaphore_wait(sems, n, -1);
 }
 
 
@@ -94,13 +331,404 @@ void semaphore_P(semaphore_t sem) {
  * wake it up.
  */
 void semaphore_V(semaphore_t sem) {
-	minithread_t waiting_thread;
+	struct synch_waiter *waiter;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
 
-	semaphore_spinlock(&(sem->lock));
-	sem->count++;
-	if ( queue_length(sem->thread_queue) ) {
-		queue_dequeue(sem->thread_queue, &waiting_thread);
-		minithread_start(waiting_thread);
+	// give the unit to the first waiter still waiting
+	if ( (waiter = synch_group_take(&(sem->waiters))) != NULL ) {
+		synch_group_grant(waiter);
+	} else {
+		sem->count++;
 	}
-	atomic_clear(&(sem->lock));
+	set_interrupt_level(old_int);
+}
+
+
+// with interrupts disabled, lend the owner the priority of each thread
+// waiting for the mutex, and keep the mutex on its boosting queue
+static void mutex_boost(mutex_t mutex) {
+	queue_link_t *link;
+
+	if ( !mutex->owner || !iqueue_length(&(mutex->waiters)) ) {
+		return;
+	}
+	for ( link = mutex->waiters.first; link; link = link->next ) {
+		minithread_inherit_priority(mutex->owner, queue_item(link, struct synch_waiter, link)->thread);
+	}
+	if ( !mutex->boosting.queue ) {
+		iqueue_append(minithread_boosting(mutex->owner), &(mutex->boosting));
+	}
+}
+
+// record the thread which just took the mutex with compare_and_swap.
+// a thread which queued for it before this found no owner to lend its
+// priority to, but marked it contended first, so lend it now
+static void mutex_set_owner(mutex_t mutex, minithread_t thread) {
+	interrupt_level_t old_int;
+
+	// an interlocked write, so the read of state below cannot come first
+	swap_pointer((void **)&(mutex->owner), thread);
+	if ( mutex->state == MUTEX_CONTENDED ) {
+		old_int = set_interrupt_level(DISABLED);
+		mutex_boost(mutex);
+		set_interrupt_level(old_int);
+	}
+}
+
+// with interrupts disabled, give the mutex to the waiter's thread and
+// return 1 if it is unlocked, or queue the waiter for it and return 0
+static int mutex_take_or_queue(mutex_t mutex, struct synch_waiter *waiter) {
+	int state;
+
+	// mark it contended, so unlocking it takes the slow path,
+	// unless it has been unlocked meanwhile
+	for ( ;; ) {
+		state = mutex->state;
+		if ( state == MUTEX_UNLOCKED ) {
+			if ( compare_and_swap(&(mutex->state), MUTEX_UNLOCKED, MUTEX_LOCKED) == MUTEX_UNLOCKED ) {
+				mutex->owner = waiter->thread;
+				return 1;
+			}
+		} else if ( state == MUTEX_CONTENDED
+			|| compare_and_swap(&(mutex->state), MUTEX_LOCKED, MUTEX_CONTENDED) == MUTEX_LOCKED ) {
+			break;
+		}
+	}
+
+	iqueue_append(&(mutex->waiters), &(waiter->link));
+	// the owner is NULL for a moment after it locks, and then lends
+	// itself our priority in mutex_set_owner
+	mutex_boost(mutex);
+	return 0;
+}
+
+/*
+ * mutex_t mutex_create()
+ *	Allocate a new, unlocked mutex.
+ */
+mutex_t mutex_create() {
+	mutex_t mutex = (mutex_t)malloc(sizeof(struct mutex));
+	if (mutex == NULL)
+		return NULL;
+	mutex->state = MUTEX_UNLOCKED;
+	mutex->owner = NULL;
+	iqueue_init(&(mutex->waiters));
+	iqueue_link_init(&(mutex->boosting));
+	return mutex;
+}
+
+/*
+ * mutex_destroy(mutex_t mutex)
+ *	Deallocate a mutex.
+ */
+int mutex_destroy(mutex_t mutex) {
+	free(mutex);
+	return 0;
+}
+
+/*
+ * mutex_lock(mutex_t mutex)
+ *	Lock the mutex, waiting until it is unlocked.
+ */
+void mutex_lock(mutex_t mutex) {
+	struct synch_waiter waiter;
+	interrupt_level_t old_int;
+
+	if ( compare_and_swap(&(mutex->state), MUTEX_UNLOCKED, MUTEX_LOCKED) == MUTEX_UNLOCKED ) {
+		mutex_set_owner(mutex, minithread_self());
+		return;
+	}
+
+	old_int = set_interrupt_level(DISABLED);
+	synch_waiter_init(&waiter);
+	if ( !mutex_take_or_queue(mutex, &waiter) ) {
+		TRACE_EVENT(TRACE_SEM_BLOCK, minithread_id(), mutex);
+		// unlocking hands us the mutex
+		synch_wait(&waiter);
+	}
+	set_interrupt_level(old_int);
+}
+
+/*
+ * mutex_trylock(mutex_t mutex)
+ *	Lock the mutex if it is unlocked.
+ */
+int mutex_trylock(mutex_t mutex) {
+	if ( compare_and_swap(&(mutex->state), MUTEX_UNLOCKED, MUTEX_LOCKED) == MUTEX_UNLOCKED ) {
+		mutex_set_owner(mutex, minithread_self());
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * mutex_unlock(mutex_t mutex)
+ *	Unlock the mutex, handing it to the first thread waiting for it.
+ */
+void mutex_unlock(mutex_t mutex) {
+	queue_link_t *waiting;
+	queue_link_t *link;
+	struct synch_waiter *waiter;
+	minithread_t self;
+	interrupt_level_t old_int;
+
+	if ( mutex->state == MUTEX_LOCKED ) {
+		// a thread which queues before the compare_and_swap makes it
+		// fail, and is handed the mutex below
+		mutex->owner = NULL;
+		if ( compare_and_swap(&(mutex->state), MUTEX_LOCKED, MUTEX_UNLOCKED) == MUTEX_LOCKED ) {
+			return;
+		}
+	}
+
+	// contended - nothing else changes the state until it is handed on
+	old_int = set_interrupt_level(DISABLED);
+	self = minithread_self();
+	if ( mutex->boosting.queue ) {
+		// take back what was lent, then lend again what the waiters for
+		// the other mutexes we hold lend
+		iqueue_delete(minithread_boosting(self), &(mutex->boosting));
+		minithread_restore_priority(self);
+		for ( link = minithread_boosting(self)->first; link; link = link->next ) {
+			mutex_boost(queue_item(link, struct mutex, boosting));
+		}
+	}
+	if ( iqueue_dequeue(&(mutex->waiters), &waiting) == 0 ) {
+		waiter = queue_item(waiting, struct synch_waiter, link);
+		mutex->owner = waiter->thread;
+		if ( iqueue_length(&(mutex->waiters)) ) {
+			mutex->state = MUTEX_CONTENDED;
+			// the new owner takes on the priority of those still waiting
+			mutex_boost(mutex);
+		} else {
+			mutex->state = MUTEX_LOCKED;
+		}
+		synch_grant(waiter);
+	} else {
+		mutex->owner = NULL;
+		mutex->state = MUTEX_UNLOCKED;
+	}
+	set_interrupt_level(old_int);
+}
+
+
+// with interrupts disabled, wake the first thread waiting on a condvar
+static void condvar_wake(condvar_t condvar) {
+	queue_link_t *waiting;
+	struct synch_waiter *waiter;
+
+	if ( iqueue_dequeue(&(condvar->waiters), &waiting) == 0 ) {
+		waiter = queue_item(waiting, struct synch_waiter, link);
+		if ( mutex_take_or_queue(waiter->mutex, waiter) ) {
+			synch_grant(waiter);
+		}
+	}
+}
+
+/*
+ * condvar_t condvar_create()
+ *	Allocate a new condition variable.
+ */
+condvar_t condvar_create() {
+	condvar_t condvar = (condvar_t)malloc(sizeof(struct condvar));
+	if (condvar == NULL)
+		return NULL;
+	iqueue_init(&(condvar->waiters));
+	return condvar;
+}
+
+/*
+ * condvar_destroy(condvar_t condvar)
+ *	Deallocate a condition variable.
+ */
+int condvar_destroy(condvar_t condvar) {
+	free(condvar);
+	return 0;
+}
+
+/*
+ * condvar_wait(condvar_t condvar, mutex_t mutex)
+ *	Unlock the mutex and wait to be signalled, then lock it again.
+ */
+void condvar_wait(condvar_t condvar, mutex_t mutex) {
+	struct synch_waiter waiter;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+
+	synch_waiter_init(&waiter);
+	waiter.mutex = mutex;
+	iqueue_append(&(condvar->waiters), &(waiter.link));
+	mutex_unlock(mutex);
+	TRACE_EVENT(TRACE_SEM_BLOCK, minithread_id(), condvar);
+	// we are granted the mutex, once signalled
+	synch_wait(&waiter);
+	set_interrupt_level(old_int);
+}
+
+/*
+ * condvar_signal(condvar_t condvar)
+ *	Wake the first thread waiting on the condition variable.
+ */
+void condvar_signal(condvar_t condvar) {
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	condvar_wake(condvar);
+	set_interrupt_level(old_int);
+}
+
+/*
+ * condvar_broadcast(condvar_t condvar)
+ *	Wake every thread waiting on the condition variable.
+ */
+void condvar_broadcast(condvar_t condvar) {
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	while ( iqueue_length(&(condvar->waiters)) ) {
+		condvar_wake(condvar);
+	}
+	set_interrupt_level(old_int);
+}
+
+
+// with interrupts disabled, and the lock free with threads waiting,
+// hand it on to the next writer, or every reader next in line
+static void rwlock_hand_on(rwlock_t rwlock) {
+	queue_link_t *waiting;
+	struct synch_waiter *waiter;
+	int readers = 0;
+
+	if ( iqueue_dequeue(&(rwlock->waiters), &waiting) != 0 ) {
+		rwlock->state = 0;
+		return;
+	}
+	waiter = queue_item(waiting, struct synch_waiter, link);
+	if ( waiter->write ) {
+		rwlock->state = RWLOCK_WRITER;
+		synch_grant(waiter);
+	} else {
+		for ( ;; ) {
+			readers++;
+			synch_grant(waiter);
+			if ( !iqueue_length(&(rwlock->waiters))
+				|| queue_item(rwlock->waiters.first, struct synch_waiter, link)->write ) {
+				break;
+			}
+			iqueue_dequeue(&(rwlock->waiters), &waiting);
+			waiter = queue_item(waiting, struct synch_waiter, link);
+		}
+		rwlock->state = readers;
+	}
+	if ( iqueue_length(&(rwlock->waiters)) ) {
+		rwlock->state |= RWLOCK_WAITING;
+	}
+}
+
+// take the lock, waiting if it cannot be taken now
+static void rwlock_wait(rwlock_t rwlock, int write) {
+	struct synch_waiter waiter;
+	interrupt_level_t old_int = set_interrupt_level(DISABLED);
+	int state;
+
+	for ( ;; ) {
+		state = rwlock->state;
+		if ( !(state & RWLOCK_WAITING) && (write ? state == 0 : !(state & RWLOCK_WRITER)) ) {
+			if ( compare_and_swap(&(rwlock->state), state, write ? RWLOCK_WRITER : state + 1) == state ) {
+				set_interrupt_level(old_int);
+				return;
+			}
+		} else if ( (state & RWLOCK_WAITING)
+			|| compare_and_swap(&(rwlock->state), state, state | RWLOCK_WAITING) == state ) {
+			break;
+		}
+	}
+
+	synch_waiter_init(&waiter);
+	waiter.write = write;
+	iqueue_append(&(rwlock->waiters), &(waiter.link));
+	TRACE_EVENT(TRACE_SEM_BLOCK, minithread_id(), rwlock);
+	synch_wait(&waiter);
+	set_interrupt_level(old_int);
+}
+
+/*
+ * rwlock_t rwlock_create()
+ *	Allocate a new, unlocked reader-writer lock.
+ */
+rwlock_t rwlock_create() {
+	rwlock_t rwlock = (rwlock_t)malloc(sizeof(struct rwlock));
+	if (rwlock == NULL)
+		return NULL;
+	rwlock->state = 0;
+	iqueue_init(&(rwlock->waiters));
+	return rwlock;
+}
+
+/*
+ * rwlock_destroy(rwlock_t rwlock)
+ *	Deallocate a reader-writer lock.
+ */
+int rwlock_destroy(rwlock_t rwlock) {
+	free(rwlock);
+	return 0;
+}
+
+/*
+ * rwlock_read_lock(rwlock_t rwlock)
+ *	Take the lock to read, along with any other readers.
+ */
+void rwlock_read_lock(rwlock_t rwlock) {
+	int state = rwlock->state;
+	if ( !(state & (RWLOCK_WRITER | RWLOCK_WAITING))
+		&& compare_and_swap(&(rwlock->state), state, state + 1) == state ) {
+		return;
+	}
+	rwlock_wait(rwlock, 0);
+}
+
+/*
+ * rwlock_read_unlock(rwlock_t rwlock)
+ *	Release the lock taken to read.
+ */
+void rwlock_read_unlock(rwlock_t rwlock) {
+	interrupt_level_t old_int;
+	int state = rwlock->state;
+
+	if ( !(state & RWLOCK_WAITING)
+		&& compare_and_swap(&(rwlock->state), state, state - 1) == state ) {
+		return;
+	}
+
+	old_int = set_interrupt_level(DISABLED);
+	do {
+		state = rwlock->state;
+	} while ( compare_and_swap(&(rwlock->state), state, state - 1) != state );
+	if ( (state & RWLOCK_WAITING) && ((state - 1) & RWLOCK_READERS) == 0 ) {
+		rwlock_hand_on(rwlock);
+	}
+	set_interrupt_level(old_int);
+}
+
+/*
+ * rwlock_write_lock(rwlock_t rwlock)
+ *	Take the lock to write, alone.
+ */
+void rwlock_write_lock(rwlock_t rwlock) {
+	if ( compare_and_swap(&(rwlock->state), 0, RWLOCK_WRITER) == 0 ) {
+		return;
+	}
+	rwlock_wait(rwlock, 1);
+}
+
+/*
+ * rwlock_write_unlock(rwlock_t rwlock)
+ *	Release the lock taken to write.
+ */
+void rwlock_write_unlock(rwlock_t rwlock) {
+	interrupt_level_t old_int;
+
+	if ( compare_and_swap(&(rwlock->state), RWLOCK_WRITER, 0) == RWLOCK_WRITER ) {
+		return;
+	}
+
+	// threads are waiting, so nothing else changes the state
+	old_int = set_interrupt_level(DISABLED);
+	rwlock_hand_on(rwlock);
+	set_interrupt_level(old_int);
 }
@@ -9,6 +9,9 @@
  */
 
 typedef struct semaphore *semaphore_t;
+typedef struct mutex *mutex_t;
+typedef struct condvar *condvar_t;
+typedef struct rwlock *rwlock_t;
 
 
 /*
@@ -39,12 +42,115 @@ extern int semaphore_initialize(semaphore_t sem, int count);
  */
 extern void semaphore_P(semaphore_t sem);
 
+/*
+ *  P on the semaphore, but give up if it has not been acquired
+ *  within ms milliseconds. Return 0 if it was acquired, -1 if not.
+ *  The timeout does not need a free alarm callback thread, so an
+ *  alarm callback may wait with one.
+ */
+extern int semaphore_P_timed(semaphore_t sem, int ms);
+
+/*
+ *  P on whichever of the n semaphores first has a unit. Only one
+ *  is acquired. Return its index in sems, or -1 on failure.
+ */
+extern int semaphore_P_any(semaphore_t sems[], int n);
+
 /*
  *	V (signal) on the sempahore.
  *  This function is not returned from until the semaphore
- *  has one unit successfully released.
+ *  has one unit successfully released. If a thread is waiting
+ *  in P, the unit goes straight to it. V never blocks, so it
+ *  may be called from an interrupt handler.
  */
 extern void semaphore_V(semaphore_t sem);
 
 
+/*
+ *  Create a new, unlocked mutex. Return NULL on failure.
+ *  A mutex must be unlocked by the thread which locked it.
+ */
+extern mutex_t mutex_create();
+
+/*
+ *  Cleanup all resources consumed by this mutex.
+ *  Return 0 on success, -1 on failure.
+ */
+extern int mutex_destroy(mutex_t mutex);
+
+/*
+ *  Lock the mutex, waiting until it is unlocked. While a thread
+ *  waits, the owner runs at the waiting thread's priority, if that
+ *  is higher than its own. An owner of several mutexes runs at the
+ *  highest priority of the threads waiting for any of them.
+ */
+extern void mutex_lock(mutex_t mutex);
+
+/*
+ *  Lock the mutex if it is unlocked, without waiting.
+ *  Return 0 if it was locked, -1 if it was not.
+ */
+extern int mutex_trylock(mutex_t mutex);
+
+/*
+ *  Unlock the mutex. If a thread is waiting, the mutex goes
+ *  straight to it.
+ */
+extern void mutex_unlock(mutex_t mutex);
+
+
+/*
+ *  Create a new condition variable. Return NULL on failure.
+ */
+extern condvar_t condvar_create();
+
+/*
+ *  Cleanup all resources consumed by this condition variable.
+ *  Return 0 on success, -1 on failure.
+ */
+extern int condvar_destroy(condvar_t condvar);
+
+/*
+ *  Unlock the mutex, which the calling thread must hold, and wait
+ *  for the condition variable to be signalled. The mutex is locked
+ *  again when this returns.
+ */
+extern void condvar_wait(condvar_t condvar, mutex_t mutex);
+
+/*
+ *  Wake the thread which has waited longest on the condition variable.
+ */
+extern void condvar_signal(condvar_t condvar);
+
+/*
+ *  Wake every thread waiting on the condition variable.
+ */
+extern void condvar_broadcast(condvar_t condvar);
+
+
+/*
+ *  Create a new, unlocked reader-writer lock. Return NULL on failure.
+ */
+extern rwlock_t rwlock_create();
+
+/*
+ *  Cleanup all resources consumed by this reader-writer lock.
+ *  Return 0 on success, -1 on failure.
+ */
+extern int rwlock_destroy(rwlock_t rwlock);
+
+/*
+ *  Take the lock to read. Any number of readers may hold it at
+ *  once, but a reader waits behind a waiting writer.
+ */
+extern void rwlock_read_lock(rwlock_t rwlock);
+extern void rwlock_read_unlock(rwlock_t rwlock);
+
+/*
+ *  Take the lock to write, with no other reader or writer.
+ */
+extern void rwlock_write_lock(rwlock_t rwlock);
+extern void rwlock_write_unlock(rwlock_t rwlock);
+
+
 #endif __SYNCH_H__
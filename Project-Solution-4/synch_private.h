@@ -0,0 +1,89 @@
+/*
+ * synch_private.h - defines the data structures and utility functions
+ * used to implement the synchronization primitives which need to be
+ * shared between minisystem components.
+ *
+ * all of the functions must be called with interrupts disabled.
+ */
+
+#ifndef __SYNCH_PRIVATE_H__
+#define __SYNCH_PRIVATE_H__
+
+
+
+#include "minithread.h"
+#include "queue.h"
+#include "synch.h"
+
+
+
+/* a thread waiting in P, for a lock, or on a channel - it lives on
+ * the waiting thread's stack, so blocking never allocates. a thread
+ * waiting on several queues at once has a group of waiters, one on
+ * each queue, which all point to the first, and whichever grants that
+ * first waiter wins.
+ */
+struct synch_waiter {
+	queue_link_t link;
+	minithread_t thread;
+	int granted; // set once the thread has been given what it waits for
+	int write; // for a reader-writer lock, whether it waits to write
+	mutex_t mutex; // for a condition variable, the mutex to lock again
+	struct synch_waiter *group; // in a group, the waiter granted
+	int index; // in a group, its index among those waited on
+	int which; // in the waiter granted, the index granted, or -1 on timeout
+	void *value; // for a channel, the value sent or the buffer received into
+	int closed; // in the waiter granted, for a channel, set if it was closed
+};
+
+
+/* 
+ * initialize a waiter for the calling thread.
+ */
+void synch_waiter_init(struct synch_waiter *waiter);
+
+
+/* 
+ * block until the waiter is granted.
+ */
+void synch_wait(struct synch_waiter *waiter);
+
+
+/* 
+ * give a waiter what it waits for, and wake its thread.
+ */
+void synch_grant(struct synch_waiter *waiter);
+
+
+/* 
+ * initialize a waiter for the calling thread as the index'th of the
+ * group whose first waiter is group, and append it to waiters. the
+ * first waiter must be added first.
+ */
+void synch_group_add(struct synch_waiter *group, struct synch_waiter *waiter, int index, iqueue_t *waiters);
+
+
+/* 
+ * take the first waiter from waiters whose group has not been granted
+ * yet, or return NULL - the others are left behind by threads granted
+ * through another queue, or timed out.
+ */
+struct synch_waiter *synch_group_take(iqueue_t *waiters);
+
+
+/* 
+ * grant a waiter's group, recording the waiter's index as the one
+ * granted.
+ */
+void synch_group_grant(struct synch_waiter *waiter);
+
+
+/* 
+ * once the group's first waiter is granted, take its n waiters off
+ * any queues they are still on.
+ */
+void synch_group_cancel(struct synch_waiter waiters[], int n);
+
+
+
+#endif __SYNCH_PRIVATE_H__
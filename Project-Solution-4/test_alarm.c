@@ -25,26 +25,222 @@
 
 // Local Includes
 #include "defs.h" // this includes the the memory leak detection setup
-#include "alarm.h"
+#include "alarm_private.h"
+#include "minithread.h"
+#include "machineprimitives_ext.h"
+#include "synch.h"
 
 
-// Define utility functions here - there should be at least one utility
-// function for each problem category, but there may be more
+// alarms are due to the millisecond, and the first level of the
+// wheel holds the next 256 ticks
+#define TICK_NS (1000000)
+#define TURN_TICKS (256)
 
+#define MAX_ALARMS (16)
+#define PERIODIC_FIRINGS (5)
 
 
+// the number of failed checks
+int failures = 0;
 
+// an alarm the tests registered: when it is due, the latest tick it
+// may be due at, and how many times and when it fired
+struct record {
+	__int64 due;
+	__int64 latest;
+	__int64 interval;
+	int fired;
+	__int64 at;
+};
+struct record records[MAX_ALARMS];
 
-int main(void) {
-	// Do tests here - call utility functions as needed
+// V'd each time an alarm fires
+semaphore_t fired;
+
+
+// report a failed check - successes are silent
+void check(int cond, char *what) {
+	if ( !cond ) {
+		printf("Error Encountered: %s\n", what);
+		failures++;
+	}
+}
+
+// alarm callback - note the firing, and check a periodic alarm has
+// not fired before its next interval
+void record_fire(arg_t arg) {
+	struct record *r = (struct record *)arg;
+	r->fired++;
+	r->at = currentTimeNanos();
+	if ( r->interval ) {
+		check(r->at >= r->due + (r->fired - 1) * r->interval, "Periodic Alarm Fired Early");
+	}
+	semaphore_V(fired);
+}
+
+// register alarm i, due in delay milliseconds with slack, and return its id
+alarm_id_t expect(int i, int delay, int slack) {
+	alarm_id_t id = ALARM_ID_NONE;
+	records[i].due = currentTimeNanos() + (__int64)delay * TICK_NS;
+	records[i].interval = 0;
+	records[i].fired = 0;
+	if ( slack ) {
+		check(alarm_register_slack(delay, slack, record_fire, (arg_t)&records[i], &id) == 0, "Register With Slack Failed");
+	} else {
+		check(alarm_register(delay, record_fire, (arg_t)&records[i], &id) == 0, "Register Failed");
+	}
+	// the clock may have moved on while registering
+	records[i].latest = currentTimeNanos() + (__int64)(delay + slack + 1) * TICK_NS;
+	return id;
+}
+
+// wait for alarms 0 to n-1 to fire, and check each fired once, and
+// not before it was due
+void check_fired(int n, char *what) {
+	int i;
+	for ( i = 0; i < n; i++ ) {
+		semaphore_P(fired);
+	}
+	for ( i = 0; i < n; i++ ) {
+		check(records[i].fired == 1, "Alarm Not Fired Exactly Once");
+		check(records[i].at >= records[i].due, what);
+	}
+}
+
+// the tick the wheel's first level is at in its turn
+int turn_position(void) {
+	return (int)((currentTimeNanos() / TICK_NS) % TURN_TICKS);
+}
+
+// wait until the first level is from lo to hi ticks into its turn
+void wait_for_position(int lo, int hi) {
+	while ( turn_position() < lo || turn_position() >= hi ) {
+		minithread_yield();
+	}
+}
+
+
+// Category 1: alarm_next_deadline gives the first alarm's tick, or
+// (no later than) the start of the turn its slot is emptied in
+void test_deadline(void) {
+	alarm_id_t id;
+	__int64 deadline;
+
+	check(alarm_next_deadline() == -1, "Deadline Given With No Alarms");
+
+	// due later in this turn of the first level
+	wait_for_position(0, 150);
+	id = expect(0, 50, 0);
+	deadline = alarm_next_deadline();
+	check(deadline >= records[0].due && deadline < records[0].latest, "Deadline Not The Alarm's Tick");
+	check(alarm_deregister(id) == 0, "Deregister Failed");
+	check(alarm_deregister(id) == -1, "Deregister Of A Stale Id Succeeded");
+
+	// due in a later level, or in the next turn of the first
+	id = expect(0, 1000, 0);
+	deadline = alarm_next_deadline();
+	check(deadline > currentTimeNanos() - TICK_NS && deadline < records[0].latest, "Deadline Of A Higher Level Wrong");
+	alarm_deregister(id);
+	check(alarm_next_deadline() == -1, "Deadline Given After Deregister");
+}
 
 
+// Category 2: alarms which wrap round to the first level's earlier
+// slots, for its next turn, fire then and not this turn
+void test_wrapped(void) {
+	__int64 deadline;
+
+	wait_for_position(200, TURN_TICKS);
+	expect(0, 100, 0);
+	expect(1, 80, 0);
+	deadline = alarm_next_deadline();
+	check(deadline != -1 && deadline < records[1].latest, "Deadline Of A Wrapped Slot Too Late");
+	check_fired(2, "Wrapped Alarm Fired Early");
+}
+
+
+// Category 3: alarms due either side of the first level's turn, and
+// in the second level, are cascaded down as their turns come
+void test_cascade(void) {
+	int to_turn;
+
+	wait_for_position(100, 200);
+	to_turn = TURN_TICKS - turn_position();
+	expect(0, to_turn + TURN_TICKS + 1, 0);
+	expect(1, to_turn, 0);
+	expect(2, to_turn + TURN_TICKS, 0);
+	expect(3, to_turn - 1, 0);
+	expect(4, TURN_TICKS, 0);
+	expect(5, to_turn + 1, 0);
+	expect(6, TURN_TICKS + 1, 0);
+	expect(7, to_turn + TURN_TICKS - 1, 0);
+	check_fired(8, "Alarm Fired Early Across A Turn");
+}
 
 
+// Category 4: alarms with slack are due on a tick within their
+// window, and never fire early
+void test_slack(void) {
+	__int64 deadline;
 
+	wait_for_position(0, 100);
+	expect(0, 40, 30);
+	deadline = alarm_next_deadline();
+	check(deadline >= records[0].due && deadline < records[0].latest, "Deadline Outside The Slack Window");
+	expect(1, 45, 30);
+	expect(2, 50, 0);
+	check_fired(3, "Alarm With Slack Fired Early");
+}
+
+
+// Category 5: periodic alarms are put back each interval, and stop
+// once deregistered
+void test_periodic(void) {
+	alarm_id_t id = ALARM_ID_NONE;
+	int i;
+	int count;
+
+	check(alarm_register_periodic(0, 0, record_fire, (arg_t)&records[0], NULL) == -1, "Periodic Alarm With No Interval Registered");
+
+	records[0].due = currentTimeNanos() + 20 * TICK_NS;
+	records[0].interval = 20 * TICK_NS;
+	records[0].fired = 0;
+	check(alarm_register_periodic(20, 0, record_fire, (arg_t)&records[0], &id) == 0, "Register Periodic Failed");
+	for ( i = 0; i < PERIODIC_FIRINGS; i++ ) {
+		semaphore_P(fired);
+	}
+	check(alarm_deregister(id) == 0, "Deregister Periodic Failed");
+	count = records[0].fired;
+	check(count == PERIODIC_FIRINGS, "Periodic Alarm Fired Too Often");
+	minithread_sleep_with_timeout(60);
+	check(records[0].fired == count, "Periodic Alarm Fired After Deregister");
+	check(!alarm_has_remaining(), "Alarms Remain After The Tests");
+}
 
 
+int run_tests(arg_t arg) {
+	fired = semaphore_create();
+	semaphore_initialize(fired, 0);
+
+	test_deadline();
+	test_wrapped();
+	test_cascade();
+	test_slack();
+	test_periodic();
+
+	semaphore_destroy(fired);
+	return 0;
+}
+
+
+int main(void) {
+	printf("Running Tests on Alarm API.\n");
+	printf("Errors will be output. Successes will be silent\n\n");
+
+	// alarms are fired by the thread system's callback threads
+	minithread_system_initialize(run_tests, NULL);
 
+	printf("%d checks failed.\n", failures);
 
 	// Now print out memory leak report (this just works when
 	// running in Debug mode in Visual Studio. output can be
@@ -28,23 +28,173 @@
 #include "multilevel_queue.h"
 
 
-// Define utility functions here - there should be at least one utility
-// function for each problem category, but there may be more
+// the number of failed checks
+int failures = 0;
+
+// report a failed check - successes are silent
+void check(int cond, char *what) {
+	if ( !cond ) {
+		printf("Error Encountered: %s\n", what);
+		failures++;
+	}
+}
 
+// dequeue at or below level, and check the item found
+void check_dequeue(multilevel_queue_t q, int level, int expected, char *what) {
+	any_t item;
+	int ret = multilevel_queue_dequeue(q, level, &item);
+	if ( expected == -1 ) {
+		check(ret == -1 && item == NULL, what);
+	} else {
+		check(ret == 0 && (int)item == expected, what);
+	}
+}
 
+// iterate helper - append each item to an int array, whose first
+// element counts them, stopping (returning -1) at item 0
+int record_item(any_t item, any_t data) {
+	int *seen = (int *)data;
+	seen[++seen[0]] = (int)item;
+	return (int)item == 0 ? -1 : 0;
+}
 
 
+// Category 1: creation and invalid arguments
+void test_invalid(void) {
+	multilevel_queue_t q;
+	any_t item;
+
+	check(multilevel_queue_new(0, MQ_LEVEL_ASCEND) == NULL, "New With No Levels Succeeded");
+	check(multilevel_queue_new(1025, MQ_LEVEL_ASCEND) == NULL, "New With Too Many Levels Succeeded");
+	check(multilevel_queue_length(NULL) == -1, "Length Of NULL Queue Succeeded");
+	check(multilevel_queue_free(NULL) == -1, "Free Of NULL Queue Succeeded");
+
+	q = multilevel_queue_new(4, MQ_LEVEL_ASCEND);
+	check(q != NULL, "Create Failed");
+	check(multilevel_queue_length(q) == 0, "Brand New Queue Thinks It Has Items");
+	check(multilevel_queue_enqueue(q, -1, (any_t)1) == -1, "Enqueue Below Level 0 Succeeded");
+	check(multilevel_queue_enqueue(q, 4, (any_t)1) == -1, "Enqueue Above The Last Level Succeeded");
+	check(multilevel_queue_dequeue(q, 3, &item) == -1 && item == NULL, "Dequeue From Empty Queue Succeeded");
+	check(multilevel_queue_peak(q, 3, &item) == -1 && item == NULL, "Peak At Empty Queue Succeeded");
+	check(multilevel_queue_iterate(q, record_item, NULL) == -1, "Iterate Over Empty Queue Succeeded");
+	check(multilevel_queue_delete(q, (any_t)1) == -1, "Delete From Empty Queue Succeeded");
+	multilevel_queue_free(q);
+}
 
-int main(void) {
-	// Do tests here - call utility functions as needed
+
+// Category 2: levels are dequeued highest first, and each level FIFO,
+// in both orders
+void test_order(multilevel_queue_order_t order) {
+	multilevel_queue_t q = multilevel_queue_new(3, order);
+	int high = order == MQ_LEVEL_ASCEND ? 0 : 2;
+	int low = order == MQ_LEVEL_ASCEND ? 2 : 0;
+
+	multilevel_queue_enqueue(q, low, (any_t)1);
+	multilevel_queue_enqueue(q, 1, (any_t)2);
+	multilevel_queue_enqueue(q, high, (any_t)3);
+	multilevel_queue_enqueue(q, high, (any_t)4);
+	multilevel_queue_enqueue(q, low, (any_t)5);
+	check(multilevel_queue_length(q) == 5, "Length Wrong After Enqueues");
+	check_dequeue(q, low, 1, "Dequeue Took An Item Above The Level Given");
+	multilevel_queue_enqueue(q, low, (any_t)1);
+
+	check_dequeue(q, high, 3, "Highest Level Not Dequeued First");
+	check_dequeue(q, high, 4, "Level Not FIFO");
+	check_dequeue(q, high, 2, "Middle Level Not Dequeued Next");
+	check_dequeue(q, high, 5, "Lowest Level Not Dequeued Last");
+	check_dequeue(q, high, 1, "Lowest Level Not FIFO");
+	check_dequeue(q, high, -1, "Dequeue Found An Item In An Emptied Queue");
+	check(multilevel_queue_length(q) == 0, "Length Wrong After Dequeues");
+	multilevel_queue_free(q);
+}
 
 
+// Category 3: dequeue and peak start at the given level, and find the
+// next occupied one through the bitmap, across bitmap words
+void test_levels(void) {
+	multilevel_queue_t q = multilevel_queue_new(1024, MQ_LEVEL_ASCEND);
+	any_t item;
+
+	multilevel_queue_enqueue(q, 1023, (any_t)1023);
+	multilevel_queue_enqueue(q, 32, (any_t)32);
+	multilevel_queue_enqueue(q, 31, (any_t)31);
+	multilevel_queue_enqueue(q, 5, (any_t)5);
+
+	check(multilevel_queue_peak(q, 6, &item) == 0 && (int)item == 31, "Peak Did Not Skip To The Next Level");
+	check(multilevel_queue_length(q) == 4, "Peak Removed An Item");
+	check_dequeue(q, 6, 31, "Dequeue Did Not Skip To The Next Level In The Word");
+	check_dequeue(q, 6, 32, "Dequeue Did Not Skip To The Next Word");
+	check_dequeue(q, 33, 1023, "Dequeue Did Not Skip To The Last Word");
+	check_dequeue(q, 6, -1, "Dequeue Found An Item Above The Level Given");
+	check_dequeue(q, 0, 5, "Dequeue Missed An Item At The Level Given");
+	check_dequeue(q, 1023, -1, "Dequeue Found An Item In An Emptied Queue");
+
+	// a level emptied and refilled is found again
+	multilevel_queue_enqueue(q, 32, (any_t)7);
+	check_dequeue(q, 0, 7, "Refilled Level Not Found");
+	multilevel_queue_free(q);
+}
 
 
+// Category 4: iterate visits every item in dequeue order, and stops
+// when told to
+void test_iterate(void) {
+	multilevel_queue_t q = multilevel_queue_new(64, MQ_LEVEL_DESCEND);
+	int seen[8];
 
+	multilevel_queue_enqueue(q, 0, (any_t)4);
+	multilevel_queue_enqueue(q, 40, (any_t)2);
+	multilevel_queue_enqueue(q, 63, (any_t)1);
+	multilevel_queue_enqueue(q, 40, (any_t)3);
 
+	seen[0] = 0;
+	check(multilevel_queue_iterate(q, record_item, seen) == 0, "Iterate Returned Failure Code");
+	check(seen[0] == 4 && seen[1] == 1 && seen[2] == 2 && seen[3] == 3 && seen[4] == 4,
+		"Iterate Did Not Visit Items In Dequeue Order");
+
+	multilevel_queue_enqueue(q, 63, (any_t)0);
+	seen[0] = 0;
+	check(multilevel_queue_iterate(q, record_item, seen) == -1, "Iterate Did Not Pass On A Stop");
+	check(seen[0] == 2, "Iterate Did Not Stop When Told To");
+	multilevel_queue_free(q);
+}
+
+
+// Category 5: delete removes just the item, from any level, and an
+// emptied level is no longer found
+void test_delete(void) {
+	multilevel_queue_t q = multilevel_queue_new(40, MQ_LEVEL_ASCEND);
+
+	multilevel_queue_enqueue(q, 3, (any_t)1);
+	multilevel_queue_enqueue(q, 3, (any_t)2);
+	multilevel_queue_enqueue(q, 3, (any_t)3);
+	multilevel_queue_enqueue(q, 35, (any_t)4);
+
+	check(multilevel_queue_delete(q, (any_t)2) == 0, "Delete From The Middle Of A Level Failed");
+	check(multilevel_queue_delete(q, (any_t)2) == -1, "Delete Of A Deleted Item Succeeded");
+	check(multilevel_queue_delete(q, (any_t)9) == -1, "Delete Of An Absent Item Succeeded");
+	check(multilevel_queue_delete(q, (any_t)4) == 0, "Delete From Another Word Failed");
+	check(multilevel_queue_length(q) == 2, "Length Wrong After Deletes");
+
+	check_dequeue(q, 0, 1, "Delete Disturbed The Level");
+	check_dequeue(q, 0, 3, "Delete Broke The Level's Links");
+	check_dequeue(q, 0, -1, "Emptied Level Still Found");
+	multilevel_queue_free(q);
+}
+
+
+int main(void) {
+	printf("Running Tests on Multilevel Queue ADT.\n");
+	printf("Errors will be output. Successes will be silent\n\n");
 
+	test_invalid();
+	test_order(MQ_LEVEL_ASCEND);
+	test_order(MQ_LEVEL_DESCEND);
+	test_levels();
+	test_iterate();
+	test_delete();
 
+	printf("%d checks failed.\n", failures);
 
 	// Now print out memory leak report (this just works when
 	// running in Debug mode in Visual Studio. output can be
@@ -28,23 +28,226 @@
 #include "priority_queue.h"
 
 
-// Define utility functions here - there should be at least one utility
-// function for each problem category, but there may be more
+// the items the randomized test keeps, and the steps it takes
+#define RANDOM_ITEMS (500)
+#define RANDOM_STEPS (200000)
+#define RANDOM_PRIORITIES (40)
 
 
+// the number of failed checks
+int failures = 0;
 
+// the randomized test's generator - its own, so that it repeats
+unsigned int seed = 1;
 
+// the randomized test's model of the queue: for each item, whether it
+// is in the queue, its priority, when it was (re)prioritized, and its
+// handle
+struct model_item {
+	int present;
+	__int64 priority;
+	int stamp;
+	priority_queue_handle_t handle;
+};
+struct model_item model[RANDOM_ITEMS];
 
-int main(void) {
-	// Do tests here - call utility functions as needed
 
+// report a failed check - successes are silent
+void check(int cond, char *what) {
+	if ( !cond ) {
+		printf("Error Encountered: %s\n", what);
+		failures++;
+	}
+}
+
+// dequeue, and check the item found
+void check_dequeue(priority_queue_t q, int expected, char *what) {
+	any_t item;
+	int ret = priority_queue_dequeue(q, &item);
+	if ( expected == -1 ) {
+		check(ret == -1 && item == NULL, what);
+	} else {
+		check(ret == 0 && (int)item == expected, what);
+	}
+}
 
+// iterate helper - count the items
+int count_item(any_t item, any_t data) {
+	(*(int *)data)++;
+	return 0;
+}
 
+int next_random(void) {
+	seed = seed * 1103515245 + 12345;
+	return (int)((seed >> 8) & 0x7fffff);
+}
 
+// whether model item a is dequeued before b
+int model_before(priority_queue_order_t order, int a, int b) {
+	if ( model[a].priority != model[b].priority ) {
+		return order == PQ_PRIORITY_ASCEND ? model[a].priority < model[b].priority : model[a].priority > model[b].priority;
+	}
+	return model[a].stamp < model[b].stamp;
+}
 
 
+// Category 1: invalid arguments and the empty queue
+void test_invalid(void) {
+	priority_queue_t q = priority_queue_new(PQ_PRIORITY_ASCEND);
+	any_t item;
+	int count = 0;
+
+	check(q != NULL, "Create Failed");
+	check(priority_queue_length(NULL) == -1, "Length Of NULL Queue Succeeded");
+	check(priority_queue_free(NULL) == -1, "Free Of NULL Queue Succeeded");
+	check(priority_queue_length(q) == 0, "Brand New Queue Thinks It Has Items");
+	check_dequeue(q, -1, "Dequeue From Empty Queue Succeeded");
+	check(priority_queue_peak(q, &item) == -1 && item == NULL, "Peak At Empty Queue Succeeded");
+	check(priority_queue_iterate(q, count_item, &count) == -1, "Iterate Over Empty Queue Succeeded");
+	check(priority_queue_delete(q, (any_t)1) == -1, "Delete From Empty Queue Succeeded");
+	check(priority_queue_delete_handle(q, 0, NULL) == -1, "Delete Of An Unused Handle Succeeded");
+	check(priority_queue_delete_handle(q, -1, NULL) == -1, "Delete Of A Negative Handle Succeeded");
+	check(priority_queue_change_priority(q, 0, 1) == -1, "Change Of An Unused Handle Succeeded");
+	priority_queue_free(q);
+}
+
+
+// Category 2: priority order in both orders, and FIFO among equals
+void test_order(priority_queue_order_t order) {
+	priority_queue_t q = priority_queue_new(order);
+	__int64 high = order == PQ_PRIORITY_ASCEND ? 1 : 3;
+	__int64 low = order == PQ_PRIORITY_ASCEND ? 3 : 1;
+	any_t item;
+
+	priority_queue_enqueue(q, low, (any_t)5, NULL);
+	priority_queue_enqueue(q, 2, (any_t)3, NULL);
+	priority_queue_enqueue(q, high, (any_t)1, NULL);
+	priority_queue_enqueue(q, 2, (any_t)4, NULL);
+	priority_queue_enqueue(q, high, (any_t)2, NULL);
+	check(priority_queue_length(q) == 5, "Length Wrong After Enqueues");
+
+	check(priority_queue_peak(q, &item) == 0 && (int)item == 1, "Peak Did Not Give The Highest Priority");
+	check_dequeue(q, 1, "Highest Priority Not Dequeued First");
+	check_dequeue(q, 2, "Equal Priorities Not FIFO");
+	check_dequeue(q, 3, "Middle Priority Not Dequeued Next");
+	check_dequeue(q, 4, "Equal Middle Priorities Not FIFO");
+	check_dequeue(q, 5, "Lowest Priority Not Dequeued Last");
+	check_dequeue(q, -1, "Dequeue Found An Item In An Emptied Queue");
+	priority_queue_free(q);
+}
+
+
+// Category 3: handles delete and reprioritize their item, and are
+// refused once the item has left the queue
+void test_handles(void) {
+	priority_queue_t q = priority_queue_new(PQ_PRIORITY_ASCEND);
+	priority_queue_handle_t a, b, c;
+	any_t item;
+
+	priority_queue_enqueue(q, 10, (any_t)1, &a);
+	priority_queue_enqueue(q, 20, (any_t)2, &b);
+	priority_queue_enqueue(q, 30, (any_t)3, &c);
+
+	check(priority_queue_change_priority(q, c, 5) == 0, "Change Priority Failed");
+	check(priority_queue_change_priority(q, a, 20) == 0, "Change Priority Failed");
+	check(priority_queue_delete_handle(q, b, &item) == 0 && (int)item == 2, "Delete Handle Gave The Wrong Item");
+	check(priority_queue_delete_handle(q, b, &item) == -1, "Delete Of A Stale Handle Succeeded");
+	check(priority_queue_change_priority(q, b, 1) == -1, "Change Of A Stale Handle Succeeded");
+	check(priority_queue_length(q) == 2, "Length Wrong After Delete Handle");
+
+	check_dequeue(q, 3, "Raised Priority Not Dequeued First");
+	check(priority_queue_delete_handle(q, c, NULL) == -1, "Delete Of A Dequeued Item's Handle Succeeded");
+	check_dequeue(q, 1, "Lowered Priority Lost");
+	priority_queue_free(q);
+}
+
+
+// Category 4: a long random run of every operation, checked against
+// a model of the queue, in both orders
+void test_random(priority_queue_order_t order) {
+	priority_queue_t q = priority_queue_new(order);
+	int step, i, best, stamp = 0, length = 0, count;
+	int failed = failures;
+	any_t item;
+	priority_queue_handle_t stale;
+
+	memset(model, 0, sizeof(model));
+	for ( step = 0; step < RANDOM_STEPS; step++ ) {
+		i = next_random() % RANDOM_ITEMS;
+		switch ( next_random() % 8 ) {
+		case 0:
+		case 1:
+		case 2:
+			if ( !model[i].present ) {
+				model[i].present = 1;
+				model[i].priority = next_random() % RANDOM_PRIORITIES;
+				model[i].stamp = stamp++;
+				check(priority_queue_enqueue(q, model[i].priority, (any_t)(i + 1), &model[i].handle) == 0, "Random Enqueue Failed");
+				length++;
+			}
+			break;
+		case 3:
+			if ( model[i].present ) {
+				model[i].priority = next_random() % RANDOM_PRIORITIES;
+				model[i].stamp = stamp++;
+				check(priority_queue_change_priority(q, model[i].handle, model[i].priority) == 0, "Random Change Priority Failed");
+			}
+			break;
+		case 4:
+			if ( model[i].present ) {
+				stale = model[i].handle;
+				check(priority_queue_delete_handle(q, stale, &item) == 0 && (int)item == i + 1, "Random Delete Handle Gave The Wrong Item");
+				check(priority_queue_delete_handle(q, stale, NULL) == -1, "Random Delete Of A Stale Handle Succeeded");
+				model[i].present = 0;
+				length--;
+			}
+			break;
+		case 5:
+			if ( model[i].present ) {
+				check(priority_queue_delete(q, (any_t)(i + 1)) == 0, "Random Delete Failed");
+				model[i].present = 0;
+				length--;
+			}
+			break;
+		default:
+			best = -1;
+			for ( i = 0; i < RANDOM_ITEMS; i++ ) {
+				if ( model[i].present && (best == -1 || model_before(order, i, best)) ) {
+					best = i;
+				}
+			}
+			check_dequeue(q, best == -1 ? -1 : best + 1, "Random Dequeue Gave The Wrong Item");
+			if ( best != -1 ) {
+				model[best].present = 0;
+				length--;
+			}
+			break;
+		}
+		if ( failures > failed ) {
+			// the model and queue differ from here on
+			break;
+		}
+	}
+
+	count = 0;
+	priority_queue_iterate(q, count_item, &count);
+	check(priority_queue_length(q) == length && count == length, "Random Run Left The Wrong Number Of Items");
+	priority_queue_free(q);
+}
+
+
+int main(void) {
+	printf("Running Tests on Priority Queue ADT.\n");
+	printf("Errors will be output. Successes will be silent\n\n");
 
+	test_invalid();
+	test_order(PQ_PRIORITY_ASCEND);
+	test_order(PQ_PRIORITY_DESCEND);
+	test_handles();
+	test_random(PQ_PRIORITY_ASCEND);
+	test_random(PQ_PRIORITY_DESCEND);
 
+	printf("%d checks failed.\n", failures);
 
 	// Now print out memory leak report (this just works when
 	// running in Debug mode in Visual Studio. output can be
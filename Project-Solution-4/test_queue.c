@@ -36,11 +36,21 @@
 #include "defs.h"
 
 
+// an item for the multi-producer single-consumer queue
+struct mpsc_item {
+	mpsc_link_t link;
+	int value;
+};
+
+
 int main(void) {
 	queue_t q = NULL;
 	int i;
 	int ret;
 	char *error;
+	mpsc_queue_t mq;
+	struct mpsc_item items[NUM_APPENDS];
+	mpsc_link_t *link;
 
 	// malloc and fill in error string
 	error = malloc(ERR_STRN_LEN*sizeof(char));
@@ -170,6 +180,75 @@ int main(void) {
 		printf("Length Thinks It Used a NULL Pointer as a Queue");
 	}
 
+	// now the multi-producer single-consumer queue, which
+	// can only be pushed to and popped from
+	mpsc_queue_init(&mq);
+	for (i = 0; i < NUM_APPENDS; i++) {
+		items[i].value = i;
+	}
+
+	// shouldn't be able to pop
+	link = &(items[0].link);
+	ret = mpsc_queue_pop(&mq, &link);
+	if ( ret != -1 ) {
+		printf(error, "Pop Thinks It Popped Something From An Empty MPSC Queue");
+	} else if ( link != NULL ) {
+		printf(error, "Pop Failed but Did Not Return NULL in Link");
+	}
+
+	// push them all, and they should pop in the same order
+	for (i = 0; i < NUM_APPENDS; i++) {
+		mpsc_queue_push(&mq, &(items[i].link));
+	}
+	for (i = 0; i < NUM_APPENDS; i++) {
+		ret = mpsc_queue_pop(&mq, &link);
+		if ( ret == -1 ) {
+			printf(error, "Pop Returned Failure Code");
+			break;
+		} else if ( queue_item(link, struct mpsc_item, link)->value != i ) {
+			printf(error, "Pop Returned Wrong Item");
+		}
+	}
+	if ( mpsc_queue_pop(&mq, &link) != -1 ) {
+		printf(error, "Pop Found An Item After All Were Popped");
+	}
+
+	// popping the last item puts the stub back on the queue,
+	// so make sure it can go round again
+	for (i = 0; i < 3; i++) {
+		mpsc_queue_push(&mq, &(items[i].link));
+		ret = mpsc_queue_pop(&mq, &link);
+		if ( ret == -1 ) {
+			printf(error, "Pop Of A Lone Item Returned Failure Code");
+		} else if ( link != &(items[i].link) ) {
+			printf(error, "Pop Of A Lone Item Returned Wrong Item");
+		}
+	}
+
+	// a push part done - it has claimed the end of the queue, as
+	// a push's exchange does, but not linked the last item to it
+	mpsc_queue_push(&mq, &(items[0].link));
+	items[1].link.next = NULL;
+	mq.head = &(items[1].link);
+	ret = mpsc_queue_pop(&mq, &link);
+	if ( ret != -1 ) {
+		printf(error, "Pop Did Not Wait For An Unfinished Push");
+	}
+
+	// now finish it, and both should pop
+	items[0].link.next = &(items[1].link);
+	for (i = 0; i < 2; i++) {
+		ret = mpsc_queue_pop(&mq, &link);
+		if ( ret == -1 ) {
+			printf(error, "Pop After A Finished Push Returned Failure Code");
+		} else if ( link != &(items[i].link) ) {
+			printf(error, "Pop After A Finished Push Returned Wrong Item");
+		}
+	}
+	if ( mpsc_queue_pop(&mq, &link) != -1 ) {
+		printf(error, "Pop Found An Item After All Were Popped");
+	}
+
 	// don't forget to free the string
 	free(error);
 	error = NULL;
@@ -1,4 +1,216 @@
 /*
  * This file should contain a single comprehensive
  * test suite for the synchronization API.
- */
\ No newline at end of file
+ */
+
+
+// Platform Includes
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Local Includes
+#include "defs.h" // this includes the the memory leak detection setup
+#include "minithread.h"
+#include "synch.h"
+
+
+// how long to sleep for the threads forked to reach where they wait
+#define SETTLE_MS (20)
+
+#define MAX_ORDER (8)
+
+
+// the number of failed checks
+int failures = 0;
+
+// the lock the forked threads use, and the order they took it in
+mutex_t mutex;
+condvar_t condvar;
+rwlock_t rwlock;
+int order[MAX_ORDER];
+int order_count;
+
+// the number of forked threads which have started, and which hold
+// the mutex
+int started;
+int inside;
+
+
+// report a failed check - successes are silent
+void check(int cond, char *what) {
+	if ( !cond ) {
+		printf("Error Encountered: %s\n", what);
+		failures++;
+	}
+}
+
+// note that thread id took the lock
+void record(int id) {
+	if ( order_count < MAX_ORDER ) {
+		order[order_count] = id;
+	}
+	order_count++;
+}
+
+// fork a thread, and wait for it to block where it waits
+void fork_and_settle(proc_t proc, int id) {
+	int before = started;
+	minithread_fork(proc, (arg_t)id);
+	while ( started == before ) {
+		minithread_yield();
+	}
+	minithread_sleep_with_timeout(SETTLE_MS);
+}
+
+
+// Category 1: mutexes exclude, and unlocking hands the mutex to the
+// first thread waiting for it, so the unlocker cannot take it back
+int mutex_locker(arg_t arg) {
+	started++;
+	mutex_lock(mutex);
+	inside++;
+	check(inside == 1, "Two Threads Hold The Mutex");
+	record((int)arg);
+	minithread_yield();
+	inside--;
+	mutex_unlock(mutex);
+	return 0;
+}
+
+void test_mutex(void) {
+	mutex = mutex_create();
+	order_count = 0;
+
+	check(mutex_trylock(mutex) == 0, "Trylock Of An Unlocked Mutex Failed");
+	check(mutex_trylock(mutex) == -1, "Trylock Of A Locked Mutex Succeeded");
+	inside = 1;
+	fork_and_settle(mutex_locker, 1);
+	fork_and_settle(mutex_locker, 2);
+	check(order_count == 0, "Mutex Taken While Locked");
+
+	inside = 0;
+	mutex_unlock(mutex);
+	check(mutex_trylock(mutex) == -1, "Unlock Did Not Hand The Mutex To A Waiter");
+	mutex_lock(mutex);
+	check(order_count == 2 && order[0] == 1 && order[1] == 2, "Mutex Not Handed On In Order");
+	mutex_unlock(mutex);
+	mutex_destroy(mutex);
+}
+
+
+// Category 2: a signalled thread is moved to the mutex's waiters, and
+// returns from condvar_wait holding the mutex, in the order signalled
+int condvar_waiter(arg_t arg) {
+	mutex_lock(mutex);
+	started++;
+	condvar_wait(condvar, mutex);
+	inside++;
+	check(inside == 1, "Condvar Wait Returned Without The Mutex");
+	record((int)arg);
+	minithread_yield();
+	inside--;
+	mutex_unlock(mutex);
+	return 0;
+}
+
+void test_condvar(void) {
+	mutex = mutex_create();
+	condvar = condvar_create();
+	order_count = 0;
+	inside = 0;
+
+	// signalling with nothing waiting is not remembered
+	condvar_signal(condvar);
+	fork_and_settle(condvar_waiter, 1);
+	fork_and_settle(condvar_waiter, 2);
+	fork_and_settle(condvar_waiter, 3);
+	check(order_count == 0, "Condvar Wait Returned Before A Signal");
+
+	mutex_lock(mutex);
+	condvar_signal(condvar);
+	condvar_broadcast(condvar);
+	minithread_sleep_with_timeout(SETTLE_MS);
+	check(order_count == 0, "Signalled Thread Ran While The Mutex Was Held");
+	mutex_unlock(mutex);
+	check(mutex_trylock(mutex) == -1, "Signalled Thread Not Handed The Mutex");
+
+	mutex_lock(mutex);
+	check(order_count == 3 && order[0] == 1 && order[1] == 2 && order[2] == 3, "Signalled Threads Not Woken In Order");
+	mutex_unlock(mutex);
+	condvar_destroy(condvar);
+	mutex_destroy(mutex);
+}
+
+
+// Category 3: readers share the lock, a writer has it alone, and once
+// a writer waits, new readers wait behind it
+int rwlock_reader(arg_t arg) {
+	started++;
+	rwlock_read_lock(rwlock);
+	record((int)arg);
+	rwlock_read_unlock(rwlock);
+	return 0;
+}
+
+int rwlock_writer(arg_t arg) {
+	started++;
+	rwlock_write_lock(rwlock);
+	inside++;
+	check(inside == 1, "Writer Does Not Hold The Lock Alone");
+	record((int)arg);
+	minithread_yield();
+	inside--;
+	rwlock_write_unlock(rwlock);
+	return 0;
+}
+
+void test_rwlock(void) {
+	rwlock = rwlock_create();
+	order_count = 0;
+	inside = 0;
+
+	// a reader does not wait for another reader
+	rwlock_read_lock(rwlock);
+	fork_and_settle(rwlock_reader, 1);
+	check(order_count == 1, "Reader Waited For A Reader");
+
+	// a writer waits for the reader, and a reader for the writer
+	fork_and_settle(rwlock_writer, 2);
+	fork_and_settle(rwlock_reader, 3);
+	check(order_count == 1, "Lock Taken Past A Waiting Writer");
+	rwlock_read_unlock(rwlock);
+
+	rwlock_write_lock(rwlock);
+	check(order_count == 3 && order[1] == 2 && order[2] == 3, "Writer Not Preferred To A Later Reader");
+	rwlock_write_unlock(rwlock);
+	rwlock_destroy(rwlock);
+}
+
+
+int run_tests(arg_t arg) {
+	test_mutex();
+	test_condvar();
+	test_rwlock();
+	return 0;
+}
+
+
+int main(void) {
+	printf("Running Tests on Synchronization API.\n");
+	printf("Errors will be output. Successes will be silent\n\n");
+
+	minithread_system_initialize(run_tests, NULL);
+
+	printf("%d checks failed.\n", failures);
+
+	// Now print out memory leak report (this just works when
+	// running in Debug mode in Visual Studio. output can be
+	// found in the Output Pane, not the console window
+	_CrtDumpMemoryLeaks();
+	
+	// Finally keep the Command Window open 'til enter is pressed
+	system("pause");
+
+	return 0;
+}
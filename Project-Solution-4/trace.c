@@ -0,0 +1,212 @@
+/*
+ * trace.c - implements scheduler event tracing
+ */
+
+#include <stdio.h>
+
+#include "defs.h"
+#include "machineprimitives_ext.h"
+#include "trace.h"
+
+
+#if TRACE
+
+/*
+ * DATA STRUCTURE DEFINITIONS
+ */
+
+struct trace_record {
+	__int64 time;
+	int type;
+	int thread;
+	long arg;
+};
+
+/*
+ * the ring of one worker. next counts every event recorded,
+ * and the next is stored at next % TRACE_RING_SIZE
+ */
+struct trace_ring {
+	int worker;
+	int next;
+	struct trace_ring* link;
+	struct trace_record records[TRACE_RING_SIZE];
+};
+
+/* every ring, most recently created first */
+static struct trace_ring* rings = NULL;
+static tas_lock_t rings_lock = 0;
+
+/* the ring of this OS thread */
+static __declspec(thread) struct trace_ring* this_ring = NULL;
+
+/* the lanes of a worker's interrupts follow those of the workers */
+#define TRACE_INTERRUPT_LANE (1000)
+
+
+/*
+ * HELPER FUNCTIONS
+ */
+
+/* write the separator before every event but the first */
+static void trace_separate(FILE* out, int* first) {
+	if ( *first ) {
+		*first = 0;
+	} else {
+		fprintf(out, ",\n");
+	}
+}
+
+/* microseconds, which the format uses, since the start of the trace */
+static double trace_us(__int64 time, __int64 start) {
+	return (double)(time - start) / 1000.0;
+}
+
+static void trace_export_ring(FILE* out, struct trace_ring* ring, __int64 start, int* first) {
+	struct trace_record* record = NULL;
+	int i = ring->next > TRACE_RING_SIZE ? ring->next - TRACE_RING_SIZE : 0;
+	int running = -1;
+	__int64 since = 0;
+
+	trace_separate(out, first);
+	fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+		"\"args\":{\"name\":\"worker %d\"}}", ring->worker, ring->worker);
+	trace_separate(out, first);
+	fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+		"\"args\":{\"name\":\"worker %d interrupts\"}}",
+		TRACE_INTERRUPT_LANE + ring->worker, ring->worker);
+
+	for ( ; i < ring->next; i++ ) {
+		record = &ring->records[i % TRACE_RING_SIZE];
+		trace_separate(out, first);
+		switch ( record->type ) {
+		case TRACE_SWITCH:
+			// a slice for the thread switched from, from when it was switched to
+			if ( running != -1 ) {
+				fprintf(out, "{\"name\":\"minithread %d\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+					"\"ts\":%.3f,\"dur\":%.3f}", running, ring->worker,
+					trace_us(since, start), trace_us(record->time, since));
+			} else {
+				fprintf(out, "{\"name\":\"switch\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,"
+					"\"ts\":%.3f,\"args\":{\"from\":%d,\"to\":%ld}}", ring->worker,
+					trace_us(record->time, start), record->thread, record->arg);
+			}
+			running = (int)record->arg;
+			since = record->time;
+			break;
+		case TRACE_NET_ENTER:
+		case TRACE_NET_EXIT:
+			fprintf(out, "{\"name\":\"network interrupt\",\"ph\":\"%s\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%.3f,\"args\":{\"thread\":%d}}",
+				record->type == TRACE_NET_ENTER ? "B" : "E",
+				TRACE_INTERRUPT_LANE + ring->worker, trace_us(record->time, start), record->thread);
+			break;
+		default:
+			fprintf(out, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%.3f,\"args\":{\"thread\":%d,\"arg\":\"0x%lx\"}}",
+				record->type == TRACE_STOP ? "stop"
+				: record->type == TRACE_START ? "start"
+				: record->type == TRACE_SEM_BLOCK ? "semaphore block"
+				: record->type == TRACE_ALARM_OVERRUN ? "alarm overrun" : "alarm",
+				ring->worker, trace_us(record->time, start), record->thread, record->arg);
+			break;
+		}
+	}
+
+	// the thread still running at the end
+	if ( running != -1 ) {
+		trace_separate(out, first);
+		fprintf(out, "{\"name\":\"minithread %d\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+			"\"ts\":%.3f,\"dur\":%.3f}", running, ring->worker,
+			trace_us(since, start), trace_us(record->time, since));
+	}
+}
+
+
+
+/*
+ * FUNCTION DEFINITIONS
+ */
+
+/*
+ * create the ring of the calling OS thread, which runs the worker
+ * with the index given. interrupts are disabled, so no interrupt
+ * handler can be waiting on rings_lock
+ */
+int trace_worker_initialize(int worker) {
+	struct trace_ring* ring = malloc(sizeof(struct trace_ring));
+	if ( !ring ) {
+		return -1;
+	}
+	ring->worker = worker;
+	ring->next = 0;
+	while ( atomic_test_and_set(&rings_lock) )
+		;
+	ring->link = rings;
+	rings = ring;
+	atomic_clear(&rings_lock);
+	this_ring = ring;
+	return 0;
+}
+
+
+/*
+ * record an event in the calling OS thread's ring, if it has one
+ */
+void trace_event(int type, int thread, long arg) {
+	struct trace_ring* ring = this_ring;
+	struct trace_record* record;
+	int slot;
+
+	if ( !ring ) {
+		return;
+	}
+
+	// an interrupt handler may record an event in the middle of this
+	// one, so claim the slot atomically
+	do {
+		slot = ring->next;
+	} while ( compare_and_swap(&ring->next, slot, slot + 1) != slot );
+
+	record = &ring->records[slot % TRACE_RING_SIZE];
+	record->time = currentTimeNanos();
+	record->type = type;
+	record->thread = thread;
+	record->arg = arg;
+}
+
+
+/*
+ * write every recorded event to the file at path, in the Chrome
+ * trace event (JSON) format
+ */
+int trace_export(const char* path) {
+	struct trace_ring* ring;
+	__int64 start = -1;
+	int first = 1;
+	int i;
+	FILE* out = fopen(path, "w");
+
+	if ( !out ) {
+		return -1;
+	}
+
+	// times are written relative to the earliest event kept
+	for ( ring = rings; ring; ring = ring->link ) {
+		i = ring->next > TRACE_RING_SIZE ? ring->next - TRACE_RING_SIZE : 0;
+		if ( i < ring->next && (start == -1 || ring->records[i % TRACE_RING_SIZE].time < start) ) {
+			start = ring->records[i % TRACE_RING_SIZE].time;
+		}
+	}
+
+	fprintf(out, "{\"traceEvents\":[\n");
+	for ( ring = rings; ring; ring = ring->link ) {
+		trace_export_ring(out, ring, start, &first);
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	fclose(out);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * trace.h - scheduler event tracing
+ *
+ * events are recorded, with their time, in a ring buffer for each
+ * worker, so recording one takes no lock - once a ring is full its
+ * oldest events are overwritten. each worker creates its ring when
+ * it starts, and events recorded on any other OS thread are dropped.
+ * trace_export writes them out in the Chrome trace event format,
+ * which chrome://tracing and Perfetto (ui.perfetto.dev) can open: a
+ * lane for each worker showing which minithread it ran when, with
+ * stops, starts, semaphore blocks and alarms marked, and a lane for
+ * its network interrupts.
+ *
+ * the TRACE_ macros are used to record events, and compile to
+ * nothing, as does trace.c, unless TRACE is set.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+
+/* if tracing is desired set value to 1 */
+#define TRACE 0
+
+/* the file the trace is written to when the system shuts down */
+#define TRACE_FILE "minisystem_trace.json"
+
+/* the number of events each ring holds */
+#define TRACE_RING_SIZE (16384)
+
+
+/*
+ * TYPE DEFINITIONS
+ */
+
+/*
+ * the events recorded. each is recorded with the id of the thread
+ * it concerns, and an argument
+ */
+enum trace_event_type {
+	TRACE_SWITCH,     /* switched from the thread to another - arg is its id */
+	TRACE_STOP,       /* the thread stopped */
+	TRACE_START,      /* the thread was made runnable */
+	TRACE_SEM_BLOCK,  /* the thread blocked on a semaphore - arg is its address */
+	TRACE_ALARM_FIRE, /* an alarm fired, on the thread */
+	TRACE_ALARM_OVERRUN, /* its callback ran over budget - arg is how long, in us */
+	TRACE_NET_ENTER,  /* a network interrupt was taken, on the thread */
+	TRACE_NET_EXIT    /* and its handler returned */
+};
+
+
+#if TRACE
+#define TRACE_WORKER_INITIALIZE(worker) trace_worker_initialize(worker)
+#define TRACE_EVENT(type, thread, arg) trace_event((type), (thread), (long)(arg))
+#define TRACE_EXPORT(path) trace_export(path)
+#else
+#define TRACE_WORKER_INITIALIZE(worker)
+#define TRACE_EVENT(type, thread, arg)
+#define TRACE_EXPORT(path)
+#endif
+
+
+/*
+ * FUNCTION DECLARATIONS
+ */
+
+/*
+ * create the ring of the calling OS thread, which runs the worker
+ * with the index given. should be called once, as the worker starts,
+ * with interrupts disabled.
+ * on success, return 0. on failure, return -1.
+ */
+extern int trace_worker_initialize(int worker);
+
+
+/*
+ * record an event in the calling OS thread's ring, if it has one
+ */
+extern void trace_event(int type, int thread, long arg);
+
+
+/*
+ * write every recorded event to the file at path, in the Chrome
+ * trace event (JSON) format. should be called once the threads
+ * recording events have stopped.
+ * on success, return 0. on failure, return -1.
+ */
+extern int trace_export(const char* path);
+
+
+#endif __TRACE_H__